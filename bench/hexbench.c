@@ -0,0 +1,245 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+/*
+** A benchmark of the hex encoding of strings in text flows (see Hex.h), before
+** and after the SIMD kernels, on BYTES random bytes:
+** encode       the byte at a time loop SB_AddQuote had, and each kernel
+** decode       each kernel
+** SB_AddQuote  the function itself, through SB_Print into a Socket Buffer
+**              collecting a frame, with the loop it had and with each kernel
+** HEX_Write    the function the controller writes strings by, and the fputc
+**              loop it had, to /dev/null
+** The kernels and HEX_Write are those of the controller's Hex.c, which is the
+** same as the debugger's; SB_AddQuote is in the debugger's SocketBuf.c. Each
+** result is checked against the scalar kernel, and the throughput in bytes of
+** the string per second is shown. Kernels the CPU doesn't support are skipped.
+**
+** Usage: hexbench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Socket.h"
+#include "SocketBuf.h"
+#include "../controller/Hex.c"  //for the kernels, which are static
+
+#define BYTES (1024 * 1024)
+#define ROUNDS 200
+
+#define HB(ch) (((ch) >> 4) & 0x0F)
+#define LB(ch) ((ch) & 0x0F)
+
+#define dec(ch) \
+    ((ch) >= '0' && (ch) <= '9' ? (ch) - '0' : (ch) - 'a' + 10)
+
+typedef struct
+{
+    const char * name;
+    Kernel encode;
+    Kernel decode;
+    int supported;
+} Kernels;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+** The loop SB_AddQuote had before the kernels, a byte at a time.
+*/
+static void EncodeBefore(char * dst, const char * src, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        dst[i * 2] = g_digits[HB(src[i])];
+        dst[i * 2 + 1] = g_digits[LB(src[i])];
+    }
+}
+
+/*
+** The loop the controller wrote strings by before HEX_Write.
+*/
+static void writeBefore(FILE * out, const char * str, int length)
+{
+    const char * end = str + length;
+
+    for (; str < end; str += 2)
+        fputc((dec(str[0]) << 4) | dec(str[1]), out);
+}
+
+static void check(const char * name, const char * out, const char * expected, size_t len)
+{
+    if (memcmp(out, expected, len)) {
+        printf("%s: wrong result!\n", name);
+        exit(1);
+    }
+}
+
+static void report(const char * what, const char * name, double t, int rounds)
+{
+    printf("%-11s %-7s %6.2f GB/s\n", what, name, BYTES * (double)rounds / t / 1e9);
+}
+
+static void runEncode(const char * name, Kernel encode, const char * src,
+    const char * expected, char * out, int rounds)
+{
+    double t;
+    int r;
+
+    memset(out, 0, BYTES * 2);
+    encode(out, src, BYTES);
+    check(name, out, expected, BYTES * 2);
+    t = now();
+    for (r = 0; r < rounds; r++)
+        encode(out, src, BYTES);
+    report("encode", name, now() - t, rounds);
+}
+
+static void runDecode(const char * name, Kernel decode, const char * hex,
+    const char * expected, char * out, int rounds)
+{
+    double t;
+    int r;
+
+    memset(out, 0, BYTES);
+    decode(out, hex, BYTES * 2);
+    check(name, out, expected, BYTES);
+    t = now();
+    for (r = 0; r < rounds; r++)
+        decode(out, hex, BYTES * 2);
+    report("decode", name, now() - t, rounds);
+}
+
+/*
+** Quote src into a frame by SB_AddQuote, and check the frame against expected
+** unless it's NULL.
+*/
+static void quote(const char * name, const char * src, const char * expected)
+{
+    SocketBuf sb;
+    Frame * frame;
+
+    SB_InitFrame(&sb);
+    SB_Print(&sb, "%Q", src, BYTES);
+    SB_Send(&sb);
+    frame = SB_TakeFrame(&sb);
+    if (!frame || sb.ioerr || frame->len != BYTES * 2) {
+        printf("%s: wrong result!\n", name);
+        exit(1);
+    }
+    if (expected)
+        check(name, frame->data, expected, BYTES * 2);
+    free(frame);
+}
+
+static void runQuote(const char * name, Kernel encode, const char * src,
+    const char * expected, int rounds)
+{
+    double t;
+    int r;
+
+    g_encode = encode;  //what HEX_Encode runs
+    quote(name, src, expected);
+    t = now();
+    for (r = 0; r < rounds; r++)
+        quote(name, src, NULL);
+    report("SB_AddQuote", name, now() - t, rounds);
+}
+
+static void runWrite(const char * name, void (* write)(FILE *, const char *, int),
+    const char * hex, FILE * out, int rounds)
+{
+    double t;
+    int r;
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+        write(out, hex, BYTES * 2);
+    fflush(out);
+    report("HEX_Write", name, now() - t, rounds);
+}
+
+int main(int argc, char * argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+    char * src = (char *)malloc(BYTES);
+    char * hex = (char *)malloc(BYTES * 2);
+    char * out = (char *)malloc(BYTES * 2);
+    FILE * null = fopen("/dev/null", "w");
+    Kernels kernels[] = {
+        {"scalar", EncodeScalar, DecodeScalar, 1},
+#if defined(HEX_X86)
+        {"sse2", EncodeSse2, DecodeSse2, 0},
+        {"avx2", EncodeAvx2, DecodeAvx2, 0},
+#endif
+    };
+    int n = sizeof(kernels) / sizeof(kernels[0]);
+    int i;
+
+    if (!src || !hex || !out || !null)
+        return 1;
+    if (rounds < 1)
+        rounds = 1;
+#if defined(HEX_X86)
+    kernels[1].supported = HasSse2();
+    kernels[2].supported = HasAvx2();
+#endif
+    srand(1);
+    for (i = 0; i < BYTES; i++)
+        src[i] = (char)rand();
+    EncodeScalar(hex, src, BYTES);
+    SB_SetBinary(0);
+
+    runEncode("before", EncodeBefore, src, hex, out, rounds);
+    for (i = 0; i < n; i++) {
+        if (kernels[i].supported)
+            runEncode(kernels[i].name, kernels[i].encode, src, hex, out, rounds);
+    }
+    for (i = 0; i < n; i++) {
+        if (kernels[i].supported)
+            runDecode(kernels[i].name, kernels[i].decode, hex, src, out, rounds);
+    }
+
+    runQuote("before", EncodeBefore, src, hex, rounds);
+    for (i = 0; i < n; i++) {
+        if (kernels[i].supported)
+            runQuote(kernels[i].name, kernels[i].encode, src, hex, rounds);
+    }
+
+    g_encode = NULL;    //HEX_Encode chooses again
+    runWrite("before", writeBefore, hex, null, rounds / 10 ? rounds / 10 : 1);
+    runWrite(HEX_Kernel(), HEX_Write, hex, null, rounds);
+
+    fclose(null);
+    free(src);
+    free(hex);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+/*
+** A benchmark of Lz (see Lz.h) on what the debuggee typically sends. The
+** payloads are made the way the debuggee makes them, by a Socket Buffer on one
+** end of a socket pair, and captured at the other end:
+** w       a table of W_ENTRIES string keys and values
+** lg      G_ENTRIES globals holding tables
+** rs      RS_BYTES bytes of a long string
+** Each is made in a text flow (version 1) and in a binary flow interning words
+** (version 5 and above). The capture is compressed in blocks of LZ_BLOCK_MAX
+** bytes, as SB_SetCompression does, and decompressed again, and the ratio and
+** the throughput of both are shown.
+**
+** Usage: lzbench [rounds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "Socket.h"
+#include "SocketBuf.h"
+#include "Lz.h"
+
+#define W_ENTRIES 20000
+#define G_ENTRIES 2000
+#define RS_BYTES (90 * 1024)
+#define ROUNDS 20
+
+/*
+** A fake address for the n-th object, scattered over 16 MB so that the pointers
+** sent vary as those of a real heap do.
+*/
+#define ADDR(n) ((void *)(size_t)(0x01000000 + (((unsigned)(n) * 2654435761u) & 0xFFFFF0)))
+
+typedef struct
+{
+    SOCKET s;
+    char * buf;
+    size_t len;
+    size_t cap;
+} Capture;
+
+/*
+** The thread reading all that's sent on the other end of the pair.
+*/
+static void * Read(void * arg)
+{
+    Capture * c = (Capture *)arg;
+    int l;
+
+    while (1) {
+        if (c->len == c->cap) {
+            c->cap = c->cap ? c->cap * 2 : 65536;
+            c->buf = (char *)realloc(c->buf, c->cap);
+            if (!c->buf)
+                exit(1);
+        }
+        l = recv(c->s, c->buf + c->len, c->cap - c->len, 0);
+        if (l <= 0)
+            break;
+        c->len += l;
+    }
+    return NULL;
+}
+
+static void makeW(SOCKET s)
+{
+    SocketBuf sb;
+    char key[32];
+    char value[64];
+    int len;
+    int i;
+
+    SB_Init(&sb, s);
+    SB_Print(&sb, "OK\nt%p:%d\n", ADDR(0), 1);
+    for (i = 1; i <= W_ENTRIES; i++) {
+        len = sprintf(key, "key_%d", i);
+        SB_Intern(&sb, 1);
+        SB_Print(&sb, "s%p:%d:%d:%Q\n", ADDR(i * 2), len, len, key, len);
+        SB_Intern(&sb, 0);
+        len = sprintf(value, "value string number %d with some payload", i);
+        SB_Print(&sb, "s%p:%d:%d:%Q\n", ADDR(i * 2 + 1), len, len, value, len);
+    }
+    SB_Add(&sb, "\n", sizeof("\n"));
+    SB_Send(&sb);
+}
+
+static void makeLg(SOCKET s)
+{
+    SocketBuf sb;
+    char name[32];
+    int i;
+
+    SB_Init(&sb, s);
+    SB_Print(&sb, "OK\n");
+    for (i = 1; i <= G_ENTRIES; i++) {
+        sprintf(name, "glob%d", i);
+        SB_Intern(&sb, 1);
+        SB_Print(&sb, "%s\n", name);
+        SB_Intern(&sb, 0);
+        SB_Print(&sb, "t%p:%d\n", ADDR(W_ENTRIES * 2 + i), i);
+    }
+    SB_Add(&sb, "\n", sizeof("\n"));
+    SB_Send(&sb);
+}
+
+static void makeRs(SOCKET s)
+{
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+    SocketBuf sb;
+    char * str = (char *)malloc(RS_BYTES);
+    int i;
+
+    if (!str)
+        exit(1);
+    for (i = 0; i < RS_BYTES; i++)
+        str[i] = text[i % (sizeof(text) - 1)];
+    SB_Init(&sb, s);
+    SB_Print(&sb, "OK\n%08x:%08x:%08x\n", RS_BYTES, 0, RS_BYTES);
+    SB_AddRaw(&sb, str, RS_BYTES);
+    SB_Add(&sb, "\n", sizeof("\n"));
+    SB_Send(&sb);
+    free(str);
+}
+
+/*
+** Make the payloads in binary flows or text ones, and return what's captured.
+*/
+static Capture capture(int binary)
+{
+    SOCKET fds[2];
+    pthread_t t;
+    Capture c;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        perror("socketpair");
+        exit(1);
+    }
+    c.s = fds[1];
+    c.buf = NULL;
+    c.len = 0;
+    c.cap = 0;
+    pthread_create(&t, NULL, Read, &c);
+
+    SB_SetBinary(binary);
+    SB_SetStringTable(binary);
+    makeW(fds[0]);
+    makeLg(fds[0]);
+    makeRs(fds[0]);
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(t, NULL);
+    closesocket(fds[0]);
+    closesocket(fds[1]);
+    return c;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char * name, Capture * c, int rounds)
+{
+    char block[LZ_BLOCK_MAX * 2];
+    char out[LZ_BLOCK_MAX];
+    size_t packed = 0;
+    size_t off;
+    double t, tc, td;
+    int r;
+
+    t = now();
+    for (r = 0; r < rounds; r++) {
+        for (off = 0, packed = 0; off < c->len; off += LZ_BLOCK_MAX) {
+            int len = c->len - off < LZ_BLOCK_MAX ? (int)(c->len - off) : LZ_BLOCK_MAX;
+            int l = len >= LZ_MIN_BLOCK ? LZ_Compress(c->buf + off, len, block, len - 1) : 0;
+            packed += l ? l : len;
+        }
+    }
+    tc = now() - t;
+
+    t = now();
+    for (r = 0; r < rounds; r++) {
+        for (off = 0; off < c->len; off += LZ_BLOCK_MAX) {
+            int len = c->len - off < LZ_BLOCK_MAX ? (int)(c->len - off) : LZ_BLOCK_MAX;
+            int l = len >= LZ_MIN_BLOCK ? LZ_Compress(c->buf + off, len, block, len - 1) : 0;
+            if (l && (LZ_Decompress(block, l, out, sizeof(out)) != len
+                || memcmp(out, c->buf + off, len))) {
+                printf("%s: block at %lu doesn't round-trip!\n", name, (unsigned long)off);
+                exit(1);
+            }
+        }
+    }
+    td = now() - t - tc;    //The blocks are compressed again to be decompressed.
+
+    printf("%-13s %8lu -> %7lu bytes (%4.1f%%), compress %4.0f MB/s, decompress %4.0f MB/s\n",
+        name, (unsigned long)c->len, (unsigned long)packed, 100.0 * packed / c->len,
+        c->len * (double)rounds / tc / 1e6, c->len * (double)rounds / td / 1e6);
+}
+
+int main(int argc, char * argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+    Capture text = capture(0);
+    Capture binary = capture(1);
+
+    if (rounds < 1)
+        rounds = 1;
+    run("text flows:", &text, rounds);
+    run("binary flows:", &binary, rounds);
+    free(text.buf);
+    free(binary.buf);
+    return 0;
+}
@@ -29,6 +29,17 @@
 #include "Socket.h"
 #include "SocketBuf.h"
 #include "Dump.h"
+#include "ShmRing.h"
+#include "Hex.h"
+
+#if defined(OS_LINUX)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined(OS_WIN)
+#define strtoull _strtoui64     //An unsigned long is 32 bits even on Win64.
+#endif
 
 typedef enum
 {
@@ -40,12 +51,25 @@ typedef enum
     CMD_LISTU,
     CMD_LISTG,
     CMD_PRINTSTACK,
+    CMD_SNAPSTACK,
     CMD_WATCH,
+    CMD_DIFF,
+    CMD_QUERY,
     CMD_EXEC,
     CMD_SETB,
     CMD_DELB,
     CMD_LISTB,
+    CMD_BULKB,
     CMD_MEMORY,
+    CMD_READSTR,
+    CMD_SETT,
+    CMD_DELT,
+    CMD_LISTT,
+    CMD_QUEUET,
+    CMD_SETD,
+    CMD_DELD,
+    CMD_LISTD,
+    CMD_DISPS,
     CMD_HELP
 } CmdType;
 
@@ -61,12 +85,25 @@ const char * g_cmds[] =
     "lu",
     "lg",
     "ps",
+    "ss",
     "w",
+    "df",
+    "q",
     "e",
     "sb",
     "db",
     "lb",
+    "bb",
     "m",
+    "rs",
+    "st",
+    "dt",
+    "lt",
+    "tq",
+    "sd",
+    "dd",
+    "ld",
+    "ds",
     "h",
     0
 };
@@ -74,26 +111,192 @@ const char * g_cmds[] =
 static void mainloop(SOCKET s);
 static int extractArgs(char * buf, char * argv[]);
 static CmdType validateArgs(char * argv[], int argc);
-static int sendCmd(SOCKET s, CmdType t, char * argv[], int argc);
-static int waitForBreakOrQuit(SocketBuf * sb, const char ** file, const char ** lineno);
-static int waitForResponseFirstLine(SocketBuf * sb);
+static int sendCmd(SOCKET s, CmdType t, char * argv[], int argc, int id);
+static int sendExpr(SOCKET s, CmdType t, const char * line, int id);
+static int waitForBreakOrQuit(SocketBuf * sb);
+static int handshake(SocketBuf * sb);
+static int waitForResponseFirstLine(SocketBuf * sb, int id);
 static int showError(SocketBuf * sb);
 static int listL(SocketBuf * sb);
+static int listChanges(SocketBuf * sb, CmdType t, const char * level);
 static int printStack(SocketBuf * sb);
-static int watch(SocketBuf * sb);
+static int snapStack(SocketBuf * sb);
+static int watch(SocketBuf * sb, char * argv[], int argc);
+static int diff(SocketBuf * sb);
+static int query(SocketBuf * sb);
+static int exec(SocketBuf * sb);
 static int listB(SocketBuf * sb);
+static int listRejectedB(SocketBuf * sb, int keep);
+static int uploadB(SOCKET s, SocketBuf * sb, const char * file, int clear);
+static int saveB(SOCKET s, SocketBuf * sb);
+static int showB(SOCKET s, SocketBuf * sb);
 static int watchM(SocketBuf * sb, char * argv[], int argc);
+static int readS(SocketBuf * sb, char * argv[], int argc);
+static int showSamples(SocketBuf * sb);
+static int openRing(unsigned int size);
+static void closeRing(void);
+static void drainRing(void);
+static int setT(SocketBuf * sb);
+static int listT(SocketBuf * sb);
+static int queueT(SocketBuf * sb);
+static int setD(SocketBuf * sb);
+static int listD(SocketBuf * sb);
 static void showHelp();
 
 #define CMD_LINE 1024
 #define MAX_ARGS 8
+#define MAX_BATCH 8
+
+/*
+** A command of a batch typed in one line, e.g. "ps; ll 1; lu 1".
+*/
+typedef struct
+{
+    char buf[CMD_LINE];     //the arguments, extracted in place
+    char line[CMD_LINE];    //the command as typed
+    char * argv[MAX_ARGS];
+    int argc;
+    CmdType t;
+    int id;                 //request id, or -1 when sent without one
+} Request;
+
+static int parseBatch(const char * input, Request reqs[]);
 
 #define SHOW_USAGE_AND_RETURN(s) \
     do {\
-        printf("Usage:\n%s [-aXXX.XXX.XXX.XXX] [-pXXXX]\n", (s));\
+        printf("Usage:\n%s [-aXXX.XXX.XXX.XXX|-aunix:Socket-Path] [-pXXXX] [-sSample-File] [-bBreakpoint-File] [-PVersion] [-z] [-m[Ring-KB]]\n", (s));\
         return -1;\
     } while (0);
 
+/*
+** When not NULL, samples streamed from the debuggee are appended to this file
+** besides being printed.
+*/
+static FILE * g_sampleFile = NULL;
+
+/*
+** When not NULL, breakpoints in this file are set in one batch at connect time,
+** and the file is kept in sync as the user sets or deletes breakpoints.
+*/
+static const char * g_bpFile = NULL;
+
+/*
+** The entries of g_bpFile the debuggee rejected when it was last uploaded, e.g.
+** those of files it can't see yet, as "path:line" lines the way the file gives
+** them. They're written back whenever the file is rewritten, so that they
+** aren't lost.
+*/
+static char * g_rejected = NULL;
+static int g_rejectedLen = 0;
+static int g_rejectedSize = 0;
+
+/*
+** The highest version of the protocol to agree on with the debuggee, lowered by
+** option -P. In version 2 flows from the debuggee are binary, where pointers
+** (of g_ptrSize bytes) and numbers are raw, in the byte order of the debuggee.
+** Flows of versions 3 and 4 are the same as those of version 2, and those of
+** version 5 also intern paths, names and keys in a session string table.
+** Flows of version 6 are the same as those of version 5, and those of version 7
+** also pack runs of numbers in tables paged for w, which are shown in columns.
+*/
+static int g_maxVersion = 7;
+static int g_binary = 0;
+static int g_ptrSize = 0;
+static int g_littleEndian = 1;
+
+/*
+** Ask the debuggee to compress what it sends? Set by option -z, and taken by a
+** debuggee of version 10 or above. Worth it over slow links, where big
+** responses, hex-encoded strings in text flows above all, shrink a lot.
+*/
+static int g_compress = 0;
+
+/*
+** Does the debuggee take request ids? If so, the commands of a batch are sent
+** back to back, and each response is matched by the id it echoes; otherwise
+** each command waits for the response to the previous one.
+*/
+static int g_requestIds = 0;
+static int g_lastRequestId = 0;
+
+/*
+** Does the debuggee page tables for w? If so, w asks for W_PAGE entries at a
+** time, and an empty command line gets the next page of the table watched
+** last, by the command kept in g_nextPage.
+*/
+#define W_PAGE 100
+static int g_pagedWatch = 0;
+static char g_nextPage[CMD_LINE];
+
+/*
+** Does the debuggee list variables by changes? If so, ll, lu and lg receive
+** only what changed since the last listing of the same scope and level, and
+** the listing is shown from a view kept here. See listChanges.
+*/
+static int g_changeLists = 0;
+
+/*
+** Does the debuggee filter listings? If so, ll, lu, lg and w take the options
+** ~<pattern>, :<types> and #<count>, which the debuggee applies before sending
+** anything. See isFilter.
+*/
+static int g_filters = 0;
+
+/*
+** Does the debuggee diff tables? If so, w takes r<depth> to remember a table
+** along with a copy of it down to depth levels, and df lists the changes made
+** to the table since then.
+*/
+static int g_diffs = 0;
+
+/*
+** Does the debuggee aggregate tables? If so, q gets the count, sum, min, max,
+** top and types of the values in a table, or of a field of its records,
+** without the table being sent.
+*/
+static int g_queries = 0;
+
+/*
+** Does the debuggee queue samples for a thread of its own to send? If so, tq
+** sets the capacity of the queue and what's dropped when it's full, and shows
+** how many samples were dropped.
+*/
+static int g_queues = 0;
+
+/*
+** Does the debuggee resume a session, i.e. keep breakpoints and the like from a
+** controller it lost the connection to? If so, the breakpoints are synced at
+** the first break in one message: replaced by those in g_bpFile when there is
+** one, or shown otherwise.
+*/
+static int g_resumed = 0;
+
+/*
+** The ring in shared memory offered to a debuggee of version 12 or above on the
+** same host for SP messages, created by option -m, and the thread taking the
+** messages out of it and showing them. The lock keeps the samples from being
+** shown in the middle of anything else. The name is removed at the first break,
+** by which time the debuggee has mapped the ring if it could. See ShmRing.h.
+*/
+#define RING_SIZE (4 * 1024 * 1024)
+static ShmRing g_ring = {NULL, NULL, 0, 0};
+static char g_ringName[32];
+static char * g_ringBuf = NULL;
+static unsigned int g_ringBufSize = 0;
+static SocketBuf g_ringSb;
+static int g_ringIntern = 0;
+static int g_ringCompressed = 0;
+#if defined(OS_LINUX)
+static pthread_t g_ringThread;
+static pthread_mutex_t g_ringLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int g_ringStop = 0;
+#define lockRing() pthread_mutex_lock(&g_ringLock)
+#define unlockRing() pthread_mutex_unlock(&g_ringLock)
+#else
+#define lockRing()
+#define unlockRing()
+#endif
+
 #ifdef OS_WIN
 static int initSocket()
 {
@@ -111,25 +314,88 @@ void uninitSocket()
 #define uninitSocket()
 #endif
 
+/*
+** Listen on a Unix domain socket at path, for a debuggee on the same host. A
+** socket file left at path, e.g. by a controller killed before removing it, is
+** replaced, but nothing else is.
+** Return the socket, or INVALID_SOCKET when it fails or Unix domain sockets are
+** not supported.
+*/
+static SOCKET listenLocal(const char * path)
+{
+#if defined(OS_LINUX)
+    SOCKET s;
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return INVALID_SOCKET;
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET)
+        return INVALID_SOCKET;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR
+        || listen(s, 1) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+#else
+    return INVALID_SOCKET;
+#endif
+}
+
 int main(int argc, char * argv[])
 {
     SOCKET s;
     SOCKET a;
     struct sockaddr_in addr;
-    char addrStr[64] = {0};
+    char addrStr[128] = {0};
     unsigned short port = 0;
+    unsigned int ringSize = 0;
+    int local;
 
     if (argc > 1) {
         int i = 1;
         for (; i < argc; i++) {
             if (argv[i][0] == '-') {
                 if (argv[i][1] == 'a') {
-                    strncpy(addrStr, argv[i] + 2, 63);
-                    addrStr[63] = 0;
+                    strncpy(addrStr, argv[i] + 2, 127);
+                    addrStr[127] = 0;
                 }
                 else if (argv[i][1] == 'p') {
                     port = (unsigned short)atoi(argv[i] + 2);
                 }
+                else if (argv[i][1] == 's' && argv[i][2]) {
+                    if (g_sampleFile)
+                        fclose(g_sampleFile);
+                    g_sampleFile = fopen(argv[i] + 2, "a");
+                    if (!g_sampleFile) {
+                        printf("Can't open sample file %s!\n", argv[i] + 2);
+                        return -1;
+                    }
+                }
+                else if (argv[i][1] == 'b' && argv[i][2]) {
+                    g_bpFile = argv[i] + 2;
+                }
+                else if (argv[i][1] == 'P' && argv[i][2] >= '1' && argv[i][2] <= '7' && !argv[i][3]) {
+                    g_maxVersion = argv[i][2] - '0';
+                }
+                else if (argv[i][1] == 'z' && !argv[i][2]) {
+                    g_compress = 1;
+                }
+                else if (argv[i][1] == 'm') {
+                    ringSize = RING_SIZE;
+                    if (argv[i][2])
+                        ringSize = (unsigned int)atoi(argv[i] + 2) * 1024;
+                    if (ringSize < SR_MIN_SIZE || ringSize > SR_MAX_SIZE)
+                        SHOW_USAGE_AND_RETURN(argv[0]);
+                }
                 else {
                     SHOW_USAGE_AND_RETURN(argv[0]);
                 }
@@ -144,56 +410,93 @@ int main(int argc, char * argv[])
     if (port == 0)
         port = 2679;
 
+    if (ringSize && openRing(ringSize) < 0) {
+        printf("Can't create shared ring!\n");
+        return -1;
+    }
+
     if (initSocket()) {
         printf("initSocket failed!\n");
+        closeRing();
         return -1;
     }
 
-    s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (s == INVALID_SOCKET) {
-        printf("Socket error!\n");
-        uninitSocket();
-        return -1;
+    local = !strncmp(addrStr, "unix:", 5);
+    if (local) {
+        s = listenLocal(addrStr + 5);
+        if (s == INVALID_SOCKET) {
+            printf("Socket error!\nPath %s\n", addrStr + 5);
+            uninitSocket();
+            closeRing();
+            return -1;
+        }
     }
+    else {
+        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (s == INVALID_SOCKET) {
+            printf("Socket error!\n");
+            uninitSocket();
+            closeRing();
+            return -1;
+        }
 
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = inet_addr(addrStr);
-    addr.sin_port = htons(port);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = inet_addr(addrStr);
+        addr.sin_port = htons(port);
+#if defined(OS_LINUX)
+        {
+            //A controller started again, e.g. for a debuggee to resume its
+            //session, binds while the connection of the last one lingers.
+            int on = 1;
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+        }
+#endif
 
-    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR
-        || listen(s, 1) == SOCKET_ERROR) {
-        printf("Socket error!\nIP %s Port %d\n", addrStr, (int)port);
-        closesocket(s);
-        uninitSocket();
-        return -1;
+        if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR
+            || listen(s, 1) == SOCKET_ERROR) {
+            printf("Socket error!\nIP %s Port %d\n", addrStr, (int)port);
+            closesocket(s);
+            uninitSocket();
+            closeRing();
+            return -1;
+        }
     }
 
     printf("RLdb 2.0.0 Copyright (C) 2011 Robert Ray<louirobert@gmail.com>\n");
-    printf("Waiting at %s:%d for remote debuggee...\n", addrStr, (int)port);
+    if (local)
+        printf("Waiting at %s for remote debuggee...\n", addrStr);
+    else
+        printf("Waiting at %s:%d for remote debuggee...\n", addrStr, (int)port);
     do {
       a = accept(s, NULL, NULL);
     } while (a == SOCKET_ERROR);
 
     printf("Connected!\n");
     closesocket(s);
+#if defined(OS_LINUX)
+    if (local)
+        unlink(addrStr + 5);
+#endif
     mainloop(a);
     closesocket(a);
     uninitSocket();
+    closeRing();
+    if (g_sampleFile)
+        fclose(g_sampleFile);
     return 0;
 }
 
 void mainloop(SOCKET s)
 {
     SocketBuf sb;
+    int connected = 1;
     SB_Init(&sb, s);
 
     while (1) {
         int rc;
-        const char * file;
-        const char * lineno;
 
         //Wait for a BREAK or QUIT message...
-        rc = waitForBreakOrQuit(&sb, &file, &lineno);
+        rc = waitForBreakOrQuit(&sb);
         if (rc < 0) {
             printf("Socket or protocol error!\n");
             break;
@@ -202,108 +505,268 @@ void mainloop(SOCKET s)
             printf("Remote script is over!\n");
             break;
         }
-        printf("Break At \"%s:%s\"\n", file, lineno);
+
+        //Set all the saved breakpoints in one go at the first break, or sync
+        //those kept by a resumed session.
+        if (connected) {
+            connected = 0;
+            if (g_ring.header)
+                SR_Unlink(g_ringName);
+            if (g_resumed)
+                printf("Session resumed!\n");
+            if (g_bpFile)
+                rc = uploadB(s, &sb, g_bpFile, g_resumed);  //The file stays as it is.
+            else
+                rc = g_resumed ? showB(s, &sb) : 0;
+            if (rc == -1) {
+                printf("Socket or protocol error!\n");
+                break;
+            }
+        }
 
         while (1) {
-            char buf[CMD_LINE];
-            char * argv[MAX_ARGS];
-            int argc;
-            CmdType t;
+            char input[CMD_LINE];
+            Request reqs[MAX_BATCH];
+            int resume = 0;
+            int save = 0;
+            int sent = 0;
+            int n;
+            int i;
 
             //Prompt user...
             printf("?>");
-            fgets(buf, CMD_LINE, stdin);
-            if ((argc = extractArgs(buf, argv)) > 0)
-                t = validateArgs(argv, argc);
-            if (argc < 1 || t == CMD_INVALID) {
+            fgets(input, CMD_LINE, stdin);
+            n = parseBatch(input, reqs);
+            if (n == 0 && g_nextPage[0])
+                n = parseBatch(g_nextPage, reqs);
+            g_nextPage[0] = 0;
+            for (i = 0; i < n && n > 1; i++) {
+                CmdType t = reqs[i].t;
+                if (t == CMD_HELP || t == CMD_BULKB
+                    || (i < n - 1 && (t == CMD_STEP || t == CMD_OVER || t == CMD_RUN)))
+                    n = -1; //Resuming ends a batch, and help or bb go alone.
+            }
+            if (n < 1) {
                 printf("Invalid command! Type 'h' for help.\n");
                 continue;
             }
 
-            if (t == CMD_HELP) {
+            if (reqs[0].t == CMD_HELP) {
                 showHelp();
                 continue;
             }
 
-            //Send command...
-            if (sendCmd(s, t, argv, argc) < 0) {
-                printf("Socket error!\n");
-                return;
-            }
-
-            if (t == CMD_STEP || t == CMD_OVER || t == CMD_RUN)
-                break;
-
-            //Wait for result message...
-            rc = waitForResponseFirstLine(&sb);
-            if (rc < 0) {
-                printf("Socket or protocol error!\n");
-                return;
-            }
-
-            //Show result...
-            if (rc == 0) {
-                if (showError(&sb) < 0) {
+            if (reqs[0].t == CMD_BULKB) {
+                rc = uploadB(s, &sb, reqs[0].argv[1], reqs[0].argc > 2);
+                if (rc == 0 && g_bpFile)
+                    rc = saveB(s, &sb);
+                if (rc == -2) {
+                    printf("Can't read breakpoint file %s!\n", reqs[0].argv[1]);
+                }
+                else if (rc < 0) {
                     printf("Socket or protocol error!\n");
                     return;
                 }
                 continue;
             }
 
-            switch (t) {
-                case CMD_LISTL:
-                case CMD_LISTU:
-                case CMD_LISTG:
-                {
-                    rc = listL(&sb);
-                    break;
+            for (i = 0; i < n; i++) {
+                Request * r = reqs + i;
+
+                //Send commands, all of the batch at once when request ids are taken...
+                for (; sent < n && (sent == i || g_requestIds); sent++) {
+                    Request * q = reqs + sent;
+                    q->id = g_requestIds ? ++g_lastRequestId : -1;
+                    if ((q->t == CMD_EXEC || q->t == CMD_SETD ? sendExpr(s, q->t, q->line, q->id)
+                        : sendCmd(s, q->t, q->argv, q->argc, q->id)) < 0) {
+                        printf("Socket error!\n");
+                        return;
+                    }
                 }
 
-                case CMD_PRINTSTACK: {
-                    rc = printStack(&sb);
+                if (r->t == CMD_STEP || r->t == CMD_OVER || r->t == CMD_RUN) {
+                    resume = 1;
                     break;
                 }
 
-                case CMD_WATCH: {
-                    rc = watch(&sb);
-                    break;
-                }
-//
-//                case CMD_EXEC: {
-//                    rc = exec(&sb);
-//                    break;
-//                }
-//
-                case CMD_SETB:
-                case CMD_DELB:
-                {
-                    //No content in this case, so read out the rest and drop it.
-                    rc = SB_Read(&sb, SB_R_LEFT);
-                    assert(sb.end);
-                    break;
+                //...and show the responses as they come.
+                rc = waitForResponseFirstLine(&sb, r->id);
+                if (rc < 0) {
+                    printf("Socket or protocol error!\n");
+                    return;
                 }
 
-                case CMD_LISTB: {
-                    rc = listB(&sb);
-                    break;
+                //Show result...
+                if (rc == 0) {
+                    if (showError(&sb) < 0) {
+                        printf("Socket or protocol error!\n");
+                        return;
+                    }
+                    continue;
                 }
 
-                case CMD_MEMORY: {
-                    rc = watchM(&sb, argv, argc);
-                    break;
+                switch (r->t) {
+                    case CMD_LISTL:
+                    case CMD_LISTU:
+                    case CMD_LISTG:
+                    {
+                        rc = g_changeLists && r->argc == 2 ? listChanges(&sb, r->t, r->argv[1])
+                            : listL(&sb);
+                        break;
+                    }
+
+                    case CMD_PRINTSTACK: {
+                        rc = printStack(&sb);
+                        break;
+                    }
+
+                    case CMD_SNAPSTACK: {
+                        rc = snapStack(&sb);
+                        break;
+                    }
+
+                    case CMD_WATCH: {
+                        rc = watch(&sb, r->argv, r->argc);
+                        break;
+                    }
+
+                    case CMD_DIFF: {
+                        rc = diff(&sb);
+                        break;
+                    }
+
+                    case CMD_QUERY: {
+                        rc = query(&sb);
+                        break;
+                    }
+
+                    case CMD_EXEC: {
+                        rc = exec(&sb);
+                        break;
+                    }
+
+                    case CMD_DELB:
+                    case CMD_DELT:
+                    case CMD_DELD:
+                    case CMD_DISPS:
+                    {
+                        //No content in this case, so read out the rest and drop it.
+                        rc = SB_Read(&sb, SB_R_LEFT);
+                        assert(sb.end);
+                        break;
+                    }
+
+                    case CMD_SETB:
+                    case CMD_LISTB: {
+                        rc = listB(&sb);
+                        break;
+                    }
+
+                    case CMD_MEMORY: {
+                        rc = watchM(&sb, r->argv, r->argc);
+                        break;
+                    }
+
+                    case CMD_READSTR: {
+                        rc = readS(&sb, r->argv, r->argc);
+                        break;
+                    }
+
+                    case CMD_SETT: {
+                        rc = setT(&sb);
+                        break;
+                    }
+
+                    case CMD_LISTT: {
+                        rc = listT(&sb);
+                        break;
+                    }
+
+                    case CMD_QUEUET: {
+                        rc = queueT(&sb);
+                        break;
+                    }
+
+                    case CMD_SETD: {
+                        rc = setD(&sb);
+                        break;
+                    }
+
+                    case CMD_LISTD: {
+                        rc = listD(&sb);
+                        break;
+                    }
+
+                    default: {
+                        assert(0 && "Impossibility!");
+                    }
                 }
 
-                default: {
-                    assert(0 && "Impossibility!");
+                //The breakpoint file is saved once all the responses are in.
+                if (rc >= 0 && g_bpFile && (r->t == CMD_SETB || r->t == CMD_DELB))
+                    save = 1;
+
+                if (rc < 0) {
+                    printf("Socket or protocol error!\n");
+                    return;
                 }
             }
 
-            if (rc < 0) {
+            if (save && saveB(s, &sb) < 0) {
                 printf("Socket or protocol error!\n");
                 return;
             }
+            if (resume)
+                break;
+        }
+    }
+}
+
+/*
+** Split a line into commands separated by ';' and validate them. A ';' within
+** double quotes doesn't separate, nor does one in the expression of e or sd,
+** which takes the rest of the line.
+** Return the number of commands, or -1 when any is invalid.
+*/
+int parseBatch(const char * input, Request reqs[])
+{
+    const char * p = input;
+    int n = 0;
+
+    while (1) {
+        Request * r = reqs + n;
+        const char * cmd = p + strspn(p, " \t\r\n");
+        int cmdLen = strcspn(cmd, " \t\r\n;");
+        int quoted = 0;
+        int len;
+
+        if (!*cmd)
+            break;
+        if (n == MAX_BATCH)
+            return -1;
+
+        if ((cmdLen == 1 && *cmd == 'e') || (cmdLen == 2 && !strncmp(cmd, "sd", 2))) {
+            len = strlen(p);
         }
+        else {
+            for (len = 0; p[len] && (quoted || p[len] != ';'); len++)
+                if (p[len] == '"')
+                    quoted = !quoted;
+        }
+
+        memcpy(r->line, p, len);
+        r->line[len] = 0;
+        strcpy(r->buf, r->line);
+        r->argc = extractArgs(r->buf, r->argv);
+        if (r->argc < 1 || (r->t = validateArgs(r->argv, r->argc)) == CMD_INVALID)
+            return -1;
+        n++;
+
+        p += len;
+        if (*p == ';')
+            ++p;
     }
+    return n;
 }
 
 int extractArgs(char * buf, char * argv[])
@@ -342,6 +805,67 @@ static int allDigits(char * str)
     return *str ? 0 : 1;
 }
 
+/*
+** Is str an expansion of w, i.e. x<depth>[,<bytes>]?
+*/
+static int isExpand(char * str)
+{
+    char * comma = strchr(str, ',');
+    int rc;
+
+    if (str[0] != 'x' || !str[1] || comma == str + 1 || (comma && !comma[1]))
+        return 0;
+    if (comma)
+        *comma = 0;
+    rc = allDigits(str + 1) && (!comma || allDigits(comma + 1));
+    if (comma)
+        *comma = ',';
+    return rc;
+}
+
+/*
+** Is str a page of w, i.e. <offset>,<limit>?
+*/
+static int isPage(char * str)
+{
+    char * comma = strchr(str, ',');
+    int rc;
+
+    if (!comma || comma == str || !comma[1])
+        return 0;
+    *comma = 0;
+    rc = allDigits(str) && allDigits(comma + 1);
+    *comma = ',';
+    return rc;
+}
+
+/*
+** Is str an option of a filter, i.e. ~<pattern>, :<types> or #<count>, quoted
+** or not?
+*/
+static int isFilter(char * str)
+{
+    if (str[0] == '"')
+        ++str;
+    if (!g_filters || !str[0] || !str[1])
+        return 0;
+    if (str[0] == ':')
+        return !str[1 + strspn(str + 1, "sntfuUbdl")];
+    if (str[0] == '#')
+        return allDigits(str + 1);
+    return str[0] == '~';
+}
+
+/*
+** Are argv[i] to the last all options of a filter?
+*/
+static int allFilters(char * argv[], int argc, int i)
+{
+    while (i < argc && isFilter(argv[i]))
+        i++;
+    return i == argc;
+}
+
 CmdType validateArgs(char * argv[], int argc)
 {
     CmdType t = CMD_INVALID;
@@ -362,42 +886,71 @@ CmdType validateArgs(char * argv[], int argc)
                 t = CMD_RUN;
         }
         else if (!strcmp(p, "ll")) {
-            if (argc == 2 && allDigits(argv[1]))
+            if (argc >= 2 && allDigits(argv[1]) && allFilters(argv, argc, 2))
                 t = CMD_LISTL;
         }
         else if (!strcmp(p, "lu")) {
-            if (argc == 2 && allDigits(argv[1]))
+            if (argc >= 2 && allDigits(argv[1]) && allFilters(argv, argc, 2))
                 t = CMD_LISTU;
         }
         else if (!strcmp(p, "lg")) {
-            if (argc == 2 && allDigits(argv[1]))
+            if (argc >= 2 && allDigits(argv[1]) && allFilters(argv, argc, 2))
                 t = CMD_LISTG;
         }
         else if (!strcmp(p, "w")) {
-            if (argc > 1) {
-                if (allDigits(argv[1]) && argc > 3 && argv[2][1] == 0
-                    && (argv[2][0] == 'l' || argv[2][0] == 'u' || argv[2][0] == 'g')) {
-                    if (argc == 5) {
-                        if (argv[4][0] == 'r' && argv[4][1] == 0)
-                            t = CMD_WATCH;
-                    }
-                    else if (argc == 4)
-                        t = CMD_WATCH;
-                }
-                else if (argv[1][0] == '|') {
-                    if (argc == 3) {
-                        if (argv[2][0] == 'r' && argv[2][1] == 0)
-                            t = CMD_WATCH;
-                    }
-                    else if (argc == 2)
-                        t = CMD_WATCH;
-                }
+            int i = 0;
+            if (argc > 3 && allDigits(argv[1]) && argv[2][1] == 0
+                && (argv[2][0] == 'l' || argv[2][0] == 'u' || argv[2][0] == 'g'))
+                i = 4;
+            else if (argc > 1 && argv[1][0] == '|')
+                i = 2;
+            if (i) {
+                if (i < argc && argv[i][0] == 'r'
+                    && (argv[i][1] == 0 || (g_diffs && allDigits(argv[i] + 1))))
+                    i++;
+                if (i < argc && isExpand(argv[i]))
+                    i++;
+                if (i < argc && g_pagedWatch && isPage(argv[i]))
+                    i++;
+                if (allFilters(argv, argc, i))
+                    t = CMD_WATCH;
             }
         }
+        else if (!strcmp(p, "df")) {
+            if (g_diffs && (argc == 1 || (argc == 2 && argv[1][0] == '|')
+                || (argc == 4 && allDigits(argv[1]) && argv[2][1] == 0
+                    && (argv[2][0] == 'l' || argv[2][0] == 'u' || argv[2][0] == 'g'))))
+                t = CMD_DIFF;
+        }
+        else if (!strcmp(p, "q")) {
+            int i = 1;
+            if (argc > 3 && allDigits(argv[1]) && argv[2][1] == 0
+                && (argv[2][0] == 'l' || argv[2][0] == 'u' || argv[2][0] == 'g'))
+                i = 4;
+            else if (argc > 1 && argv[1][0] == '|')
+                i = 2;
+            if (i < argc && argv[i][0] == '.' && argv[i][1])
+                i++;
+            if (i < argc && argv[i][0] == 'k' && argv[i][1] && allDigits(argv[i] + 1))
+                i++;
+            if (i < argc && argv[i][0] == 'b' && argv[i][1] && allDigits(argv[i] + 1))
+                i++;
+            if (g_queries && i == argc)
+                t = CMD_QUERY;
+        }
+        else if (!strcmp(p, "e")) {
+            if (argc > 2 && allDigits(argv[1]))
+                t = CMD_EXEC;
+        }
         else if (!strcmp(p, "ps")) {
             if (argc == 1)
                 t = CMD_PRINTSTACK;
         }
+        else if (!strcmp(p, "ss")) {
+            if (argc == 1 || (argc == 2 && allDigits(argv[1]))
+                || (argc == 3 && allDigits(argv[1]) && allDigits(argv[2])))
+                t = CMD_SNAPSTACK;
+        }
         else if (!strcmp(p, "sb")) {
             if (argc == 3 && allDigits(argv[2]))
                 t = CMD_SETB;
@@ -410,6 +963,10 @@ CmdType validateArgs(char * argv[], int argc)
             if (argc == 1)
                 t = CMD_LISTB;
         }
+        else if (!strcmp(p, "bb")) {
+            if (argc == 2 || (argc == 3 && !strcmp(argv[2], "c")))
+                t = CMD_BULKB;
+        }
         else if (!strcmp(p, "m")) {
             if (argc == 3) {
                 char * end;
@@ -420,6 +977,50 @@ CmdType validateArgs(char * argv[], int argc)
                     t = CMD_MEMORY;
             }
         }
+        else if (!strcmp(p, "rs")) {
+            int i = 1;
+            if (argc > 4 && allDigits(argv[1]) && argv[2][1] == 0
+                && (argv[2][0] == 'l' || argv[2][0] == 'u' || argv[2][0] == 'g'))
+                i = 4;
+            else if (argc > 2 && argv[1][0] == '|')
+                i = 2;
+            if (i < argc && isPage(argv[i]) && (argc == i + 1 || argc == i + 2))
+                t = CMD_READSTR;
+        }
+        else if (!strcmp(p, "st")) {
+            if (argc == 3 && allDigits(argv[1]))
+                t = CMD_SETT;
+        }
+        else if (!strcmp(p, "dt")) {
+            if (argc == 2 && allDigits(argv[1]))
+                t = CMD_DELT;
+        }
+        else if (!strcmp(p, "lt")) {
+            if (argc == 1)
+                t = CMD_LISTT;
+        }
+        else if (!strcmp(p, "tq")) {
+            if (g_queues && (argc == 1 || (argc <= 3 && allDigits(argv[1])
+                && (argc == 2 || !strcmp(argv[2], "o") || !strcmp(argv[2], "n")))))
+                t = CMD_QUEUET;
+        }
+        else if (!strcmp(p, "sd")) {
+            if ((argc > 2 && allDigits(argv[1]))
+                || ((argc == 3 || argc == 5) && !strcmp(argv[1], "w")))
+                t = CMD_SETD;
+        }
+        else if (!strcmp(p, "dd")) {
+            if (argc == 2 && allDigits(argv[1]))
+                t = CMD_DELD;
+        }
+        else if (!strcmp(p, "ld")) {
+            if (argc == 1)
+                t = CMD_LISTD;
+        }
+        else if (!strcmp(p, "ds")) {
+            if (argc == 2 && allDigits(argv[1]))
+                t = CMD_DISPS;
+        }
         else if (!strcmp(p, "h")) {
             t = CMD_HELP;
         }
@@ -439,65 +1040,220 @@ static int SendData(SOCKET s, const char * buf, int len)
     return 0;
 }
 
-int sendCmd(SOCKET s, CmdType t, char * argv[], int argc)
+/*
+** Put the request id, if any, that leads a command in buf.
+*/
+static void putRequestId(char * buf, int id)
+{
+    if (id >= 0)
+        sprintf(buf, "@%x ", id);
+    else
+        *buf = 0;
+}
+
+int sendCmd(SOCKET s, CmdType t, char * argv[], int argc, int id)
 {
-    //The buffer size is exactly the same with the one used by fgets in main().
-    //So it's convenient to use strcat without worrying about buffer overflow!
-    char cmdline[CMD_LINE];
+    //The buffer size is that of the one used by fgets in main() plus the room
+    //for a request id. So it's convenient to use strcat without worrying about
+    //buffer overflow!
+    char cmdline[CMD_LINE + 16];
     const char * cmd = g_cmds[t];
     int i;
 
-    strcpy(cmdline, cmd);
+    putRequestId(cmdline, id);
+    strcat(cmdline, cmd);
     for (i = 1; i < argc; i++) {
         strcat(cmdline, " ");
         strcat(cmdline, argv[i]);
     }
+    if (t == CMD_WATCH && g_pagedWatch && !isPage(argv[argc - 1]) && !isFilter(argv[argc - 1]))
+        sprintf(cmdline + strlen(cmdline), " 0,%d", W_PAGE);
+    if ((t == CMD_LISTL || t == CMD_LISTU || t == CMD_LISTG) && g_changeLists && argc == 2)
+        strcat(cmdline, " d");
 
     return SendData(s, cmdline, strlen(cmdline) + 1);
 }
 
-int waitForBreakOrQuit(SocketBuf * sb, const char ** file, const char ** lineno)
+/*
+** Send "e <level>" or "sd <level>" with the rest of line after the level as the
+** body, so that the expression is passed as typed, spaces and quotes included.
+** The level of sd may be w, the body then being a watch path.
+*/
+int sendExpr(SOCKET s, CmdType t, const char * line, int id)
 {
-    int rc;
-    char * p = sb->lbuf;
-    rc = SB_Read(sb, SB_R_LEFT);
-    if (rc < 0 || !sb->end)
-        return -1;
-
-    if (!strncmp(p, "BR\n", 3)) {
-        p += 3;
-        *file = p;
-        p = strchr(p, '\n');
-        if (!p)
-            return -1;
-        *p++ = 0;
-        *lineno = p;
-        p = strchr(p, '\n');
-        if (!p)
-            return -1;
-        *p = 0;
-        return 1;
-    }
-    else if (!strcmp(p, "QT\n\n")) {
-        return 0;
-    }
-    return -1;
+    char cmdline[CMD_LINE + 24];
+    const char * level;
+    const char * expr;
+    int levelLen;
+    int exprLen;
+
+    level = line + strspn(line, " \t");
+    level += strcspn(level, " \t");   //skip "e"
+    level += strspn(level, " \t");
+    levelLen = strcspn(level, " \t\r\n");
+    expr = level + levelLen;
+    expr += strspn(expr, " \t");
+    exprLen = strcspn(expr, "\r\n");
+
+    putRequestId(cmdline, id);
+    sprintf(cmdline + strlen(cmdline), "%s %.*s\n%.*s", g_cmds[t], levelLen, level, exprLen, expr);
+    return SendData(s, cmdline, strlen(cmdline) + 1);
 }
 
-int waitForResponseFirstLine(SocketBuf * sb)
+typedef enum
 {
-    char * p = sb->lbuf;
-    if (SB_Read(sb, 3) < 0)
-        return -1;
-    if (!strncmp(p, "OK\n", 3)) {
-        return 1;
+    BR_FILE,
+    BR_LINE,
+    BR_FRAMES,
+    BR_FRAME,
+    BR_ID,
+    BR_EXPR,
+    BR_VALUE
+} State_br;
+
+typedef enum
+{
+    PS_FILE,
+    PS_LINE,
+    PS_NAME,
+    PS_WHAT
+} State_ps;
+
+typedef struct
+{
+    State_br st;
+    int words;      //words of stack frames left
+    State_ps ps;
+} Args_br;
+
+static int br(Args_br * args, const char * word, int length);
+
+/*
+** Show the break, with the stack frames and displays that come with it.
+** Samples (SP messages) arriving in the meantime are shown as they come.
+*/
+int waitForBreakOrQuit(SocketBuf * sb)
+{
+    int rc;
+    char * p = sb->lbuf;
+
+    while (1) {
+        if (SB_Read(sb, 3) < 0)
+            return -1;
+        if (!strncmp(p, "HI\n", 3)) {
+            if (handshake(sb) < 0)
+                return -1;
+            continue;
+        }
+        if (strncmp(p, "SP\n", 3))
+            break;
+        lockRing();
+        rc = showSamples(sb);
+        unlockRing();
+        if (rc < 0)
+            return -1;
     }
-    else if (!strncmp(p, "ER\n", 3)) {
+
+    //Samples put into the shared ring before the break or quit go first.
+    drainRing();
+    if (!strncmp(p, "BR\n", 3)) {
+        Args_br args;
+        args.st = BR_FILE;
+        lockRing();
+        rc = SB_ReadAndParse(sb, "\n", (UserParser)br, &args);
+        unlockRing();
+        if (rc < 0 || args.st < BR_FRAMES)
+            return -1;
+        return 1;
+    }
+    else if (!strncmp(p, "QT\n", 3)) {
+        rc = SB_Read(sb, SB_R_LEFT);
+        if (rc < 0 || !sb->end || p[strspn(p, "\n")])
+            return -1;
         return 0;
     }
     return -1;
 }
 
+/*
+** Answer the handshake of the debuggee, which comes before anything else, with
+** the version of the protocol to use. A debuggee without a handshake speaks
+** version 1.
+*/
+int handshake(SocketBuf * sb)
+{
+    char cmd[64];
+    int version;
+    int ptrSize;
+    int little;
+    int compress;
+    int ring;
+    int resumed = 0;
+
+    if (SB_Read(sb, SB_R_LEFT) < 0 || !sb->end
+        || sscanf(sb->lbuf, "%d %d %d %d", &version, &ptrSize, &little, &resumed) < 3
+        || version < 1 || ptrSize < 1 || ptrSize > 16)
+        return -1;
+
+    g_requestIds = version >= 2;
+    g_pagedWatch = version >= 3;
+    g_changeLists = version >= 4;
+    g_filters = version >= 6;
+    g_diffs = version >= 8;
+    g_queries = version >= 9;
+    g_queues = version >= 11;
+    ring = version >= 12;
+    compress = g_compress && version >= 10;
+    if (version > g_maxVersion)
+        version = g_maxVersion;
+    sprintf(cmd, compress ? "pv %d z" : "pv %d", version);
+    if (g_ring.header && ring) {
+        strcat(cmd, " m");
+        strcat(cmd, g_ringName);
+    }
+    if (SendData(sb->s, cmd, strlen(cmd) + 1) < 0)
+        return -1;
+
+    sb->compressed = g_ringCompressed = compress;
+    g_binary = sb->binary = version >= 2;
+    sb->intern = g_ringIntern = version >= 5;
+    g_ptrSize = ptrSize;
+    g_littleEndian = little;
+    g_resumed = resumed == 1;
+    return 0;
+}
+
+/*
+** Read the tag of a response, and then, unless id is -1, the request id which
+** follows it and must be id.
+** Return 1 on OK, 0 on ER, or -1 on error.
+*/
+int waitForResponseFirstLine(SocketBuf * sb, int id)
+{
+    char * p = sb->lbuf;
+    char expected[16];
+    int rc;
+
+    if (SB_Read(sb, 3) < 0)
+        return -1;
+    if (!strncmp(p, "OK\n", 3)) {
+        rc = 1;
+    }
+    else if (!strncmp(p, "ER\n", 3)) {
+        rc = 0;
+    }
+    else {
+        return -1;
+    }
+
+    if (id >= 0) {
+        sprintf(expected, "@%08x\n", id);
+        if (SB_Read(sb, 10) < 0 || strncmp(p, expected, 10))
+            return -1;
+    }
+    return rc;
+}
+
 int showError(SocketBuf * sb)
 {
     char * p = sb->lbuf;
@@ -522,6 +1278,203 @@ int listL(SocketBuf * sb)
     return SB_ReadAndParse(sb, "\n", (UserParser)lv, &st);
 }
 
+/*
+** A variable in a view: its key, name and value as the debuggee sent them.
+*/
+typedef struct
+{
+    char * key;
+    char * name;
+    char * value;
+    int keyLen;
+    int nameLen;
+    int valueLen;
+    int changed;    //by the last listing?
+} ViewVar;
+
+/*
+** What the listing of locals, up variables or globals at a stack level shows,
+** merged from the changes sent by the debuggee.
+*/
+typedef struct View
+{
+    struct View * next;
+    char id[16];    //l, u or g, and the stack level
+    ViewVar * vars;
+    int n;
+    int cap;
+} View;
+
+static View * g_views = NULL;
+
+typedef enum
+{
+    LC_MODE = 1,
+    LC_KEY,
+    LC_NAME,
+    LC_VALUE
+} State_lc;
+
+typedef struct
+{
+    State_lc st;
+    View * view;
+    int var;    //index of the variable being received
+    int delta;  //are changes received, or all the variables?
+} Arg_lc;
+
+static int lc(Arg_lc * args, const char * word, int length);
+static int printVar(const char * str, int length);
+static void output(const char * str, int length);
+
+static View * getView(CmdType t, const char * level)
+{
+    View * v;
+    char id[16];
+
+    sprintf(id, "%c%d", t == CMD_LISTL ? 'l' : (t == CMD_LISTU ? 'u' : 'g'), atoi(level));
+    for (v = g_views; v; v = v->next)
+        if (!strcmp(v->id, id))
+            return v;
+
+    v = (View *)calloc(1, sizeof(View));
+    if (v) {
+        strcpy(v->id, id);
+        v->next = g_views;
+        g_views = v;
+    }
+    return v;
+}
+
+static char * copyWord(const char * word, int length)
+{
+    char * p = (char *)malloc(length + 1);
+    if (p) {
+        memcpy(p, word, length);
+        p[length] = 0;
+    }
+    return p;
+}
+
+static void freeVar(ViewVar * var)
+{
+    free(var->key);
+    free(var->name);
+    free(var->value);
+}
+
+/*
+** Receive a listing of ll, lu or lg at the level by changes into its view, and
+** show the view, with the variables changed marked.
+*/
+int listChanges(SocketBuf * sb, CmdType t, const char * level)
+{
+    Arg_lc args = { LC_MODE, NULL, 0, 0 };
+    int rc;
+    int i;
+
+    args.view = getView(t, level);
+    if (!args.view)
+        return -1;
+    rc = SB_ReadAndParse(sb, "\n", (UserParser)lc, &args);
+    if (rc < 0)
+        return rc;
+
+    for (i = 0; i < args.view->n; i++) {
+        ViewVar * var = args.view->vars + i;
+        fputs("Name:", stdout);
+        output(var->name, var->nameLen);
+        fputs(" \t", stdout);
+        if (printVar(var->value, var->valueLen) < 0)
+            return -3;
+        if (args.delta && var->changed)
+            fputs(" \t(changed)", stdout);
+        fputc('\n', stdout);
+    }
+    return 0;
+}
+
+int lc(Arg_lc * args, const char * word, int length)
+{
+    View * v = args->view;
+    ViewVar * var;
+    int i;
+
+    switch (args->st) {
+        case LC_MODE: {
+            if (length != 1 || (word[0] != 'F' && word[0] != 'D'))
+                return -3;
+            args->delta = word[0] == 'D';
+            for (i = 0; i < v->n; i++) {
+                if (args->delta)
+                    v->vars[i].changed = 0;
+                else
+                    freeVar(v->vars + i);
+            }
+            if (!args->delta)
+                v->n = 0;
+            args->st = LC_KEY;
+            break;
+        }
+
+        case LC_KEY: {
+            for (i = 0; i < v->n; i++)
+                if (v->vars[i].keyLen == length && !memcmp(v->vars[i].key, word, length))
+                    break;
+            if (i == v->n) {
+                if (v->n == v->cap) {
+                    int cap = v->cap ? v->cap * 2 : 16;
+                    ViewVar * vars = (ViewVar *)realloc(v->vars, cap * sizeof(ViewVar));
+                    if (!vars)
+                        return -3;
+                    v->vars = vars;
+                    v->cap = cap;
+                }
+                memset(v->vars + i, 0, sizeof(ViewVar));
+                v->vars[i].key = copyWord(word, length);
+                v->vars[i].keyLen = length;
+                v->n++;
+                if (!v->vars[i].key)
+                    return -3;
+            }
+            args->var = i;
+            args->st = LC_NAME;
+            break;
+        }
+
+        case LC_NAME: {
+            var = v->vars + args->var;
+            if (length == 1 && word[0] == '-') {   //gone
+                freeVar(var);
+                memmove(var, var + 1, (v->n - args->var - 1) * sizeof(ViewVar));
+                v->n--;
+                args->st = LC_KEY;
+                break;
+            }
+            free(var->name);
+            var->name = copyWord(word, length);
+            var->nameLen = length;
+            var->changed = 1;
+            if (!var->name)
+                return -3;
+            args->st = LC_VALUE;
+            break;
+        }
+
+        case LC_VALUE: {
+            var = v->vars + args->var;
+            free(var->value);
+            var->value = copyWord(word, length);
+            var->valueLen = length;
+            if (!var->value)
+                return -3;
+            args->st = LC_KEY;
+            break;
+        }
+    }
+    return 0;
+}
+
 static const char * typestr(char t)
 {
     const char * tstr;
@@ -553,6 +1506,9 @@ static const char * typestr(char t)
         case 'd':
             tstr = "THD";
             break;
+        case 'e':
+            tstr = "ERR";
+            break;
         default:
             tstr = "";
     }
@@ -566,50 +1522,124 @@ static void output(const char * str, int length)
         fputc(str[i], stdout);
 }
 
-#define dec(ch) \
-    ((ch) >= '0' && (ch) <= '9' ? (ch) - '0' : (ch) - 'a' + 10)
+static void outputEncStr(const char * str, int length)
+{
+    HEX_Write(stdout, str, length);
+}
 
-#define decode(s, ch) \
-    do {\
-        ch = (dec((s)[0]) << 4) | dec((s)[1]);\
-    } while (0);
+/*
+** Copy a raw value of size bytes from a binary flow to buf, turning it from the
+** byte order of the debuggee to ours.
+*/
+static void decodeRaw(const char * str, int size, void * buf)
+{
+    unsigned short one = 1;
+    int swap = g_littleEndian != *(unsigned char *)&one;
+    int i;
 
-static void outputEncStr(const char * str, int length)
+    for (i = 0; i < size; i++)
+        ((char *)buf)[i] = str[swap ? size - 1 - i : i];
+}
+
+/*
+** Output a pointer, which is raw in a binary flow, in hex with at least 8
+** digits.
+*/
+static int outputPtr(FILE * out, const char * str, int length)
 {
-    const char * end = str + length;
-    char ch;
-    for (; str < end; str += 2) {
-        decode(str, ch);
-        fputc(ch, stdout);
+    int i;
+
+    if (!g_binary) {
+        fwrite(str, 1, length, out);
+        return 0;
+    }
+    if (length != g_ptrSize)
+        return -1;
+
+    //Skip the leading zero bytes beyond the 8 digits, starting at the most significant one.
+    for (i = 0; i < g_ptrSize - 4 && !str[g_littleEndian ? g_ptrSize - 1 - i : i]; i++);
+    fputs("0x", out);
+    for (; i < g_ptrSize; i++)
+        fprintf(out, "%02x", (unsigned char)str[g_littleEndian ? g_ptrSize - 1 - i : i]);
+    return 0;
+}
+
+/*
+** Output a table, function, userdata or thread: <address>:<handle>, and the
+** handle when handle is set. Light userdata, and all values from debuggees
+** without handles, come with the address only.
+*/
+static int outputObj(FILE * out, const char * str, int length, int handle)
+{
+    const char * p = g_binary ? (length > g_ptrSize ? str + g_ptrSize : NULL)
+        : (const char *)memchr(str, ':', length);
+
+    if (!p)
+        return outputPtr(out, str, length);
+    if (*p != ':' || outputPtr(out, str, p - str) < 0)
+        return -1;
+    if (handle) {
+        fputs(" Handle:#", out);
+        fwrite(p + 1, 1, str + length - p - 1, out);
+    }
+    return 0;
+}
+
+/*
+** Output a number, which is a raw double in a binary flow.
+*/
+static int outputNum(FILE * out, const char * str, int length)
+{
+    double d;
+
+    if (!g_binary) {
+        fwrite(str, 1, length, out);
+        return 0;
     }
+    if (length != sizeof(d))
+        return -1;
+
+    decodeRaw(str, sizeof(d), &d);
+    fprintf(out, "%.17g", d);
+    return 0;
 }
 
+/*
+** Output a string value: <address>:<length>:<truncated-length>:<content>, where
+** the content is hex encoded in a text flow, while it's raw, as the address is,
+** in a binary flow.
+*/
 static int outputStr(const char * str, int length)
 {
     const char * end = str + length;
-    const char * p = strchr(str, ':');
+    const char * p;
     int len;
-    if (!p || p > end)
+
+    p = g_binary ? (length > g_ptrSize ? str + g_ptrSize : NULL)
+        : (const char *)memchr(str, ':', length);
+    if (!p || *p != ':' || outputPtr(stdout, str, p - str) < 0)
         return -1;
-    output(str, p - str);
     str = p + 1;
     fputs(" Length:", stdout);
-    p = strchr(str, ':');
-    if (!p || p > end)
+    p = (const char *)memchr(str, ':', end - str);
+    if (!p)
         return -1;
     output(str, p - str);
     fputs(" Truncated-to:", stdout);
     str = p + 1;
-    p = strchr(str, ':');
-    if (!p || p > end)
+    p = (const char *)memchr(str, ':', end - str);
+    if (!p)
         return -1;
     output(str, p - str);
     fputs(" Content:", stdout);
     len = strtol(str, NULL, 10);
     str = p + 1;
-    if (end - str != len * 2)
+    if (end - str != (g_binary ? len : len * 2))
         return -1;
-    outputEncStr(str, end - str);
+    if (g_binary)
+        output(str, end - str);
+    else
+        outputEncStr(str, end - str);
     return 0;
 }
 
@@ -627,21 +1657,38 @@ static int printVar(const char * str, int length)
             break;
         }
 
-        case 'n':
-        case 'b':
+        case 'n': {
+            if (outputNum(stdout, str + 1, length - 1) < 0)
+                return -1;
+            break;
+        }
+
+        case 'b': {
+            output(str + 1, length - 1);
+            break;
+        }
+
         case 't':
         case 'f':
         case 'u':
         case 'U':
         case 'd':
         {
-            output(str + 1, length - 1);
+            if (outputObj(stdout, str + 1, length - 1, 1) < 0)
+                return -1;
             break;
         }
 
         case 'l':
             fprintf(stdout, "nil");
             break;
+
+        case 'e':
+            if (g_binary)
+                output(str + 1, length - 1);
+            else
+                outputEncStr(str + 1, length - 1);
+            break;
     }
     return 0;
 }
@@ -665,13 +1712,23 @@ int lv(State_lv * st, const char * str, int length)
     return 0;
 }
 
-typedef enum
+static int ev(void * unused, const char * word, int length);
+
+/*
+** Show the values an expression evaluates to, one per line.
+*/
+int exec(SocketBuf * sb)
 {
-    PS_FILE,
-    PS_LINE,
-    PS_NAME,
-    PS_WHAT
-} State_ps;
+    return SB_ReadAndParse(sb, "\n", (UserParser)ev, NULL);
+}
+
+int ev(void * unused, const char * word, int length)
+{
+    if (printVar(word, length) < 0)
+        return -3;
+    fputc('\n', stdout);
+    return 0;
+}
 
 static int ps(State_ps * st, const char * word, int length);
 
@@ -681,6 +1738,58 @@ int printStack(SocketBuf * sb)
     return SB_ReadAndParse(sb, "\n", (UserParser)ps, &st);
 }
 
+int br(Args_br * args, const char * word, int length)
+{
+    switch (args->st) {
+        case BR_FILE: {
+            fputs("Break At \"", stdout);
+            output(word, length);
+            fputc(':', stdout);
+            args->st = BR_LINE;
+            break;
+        }
+        case BR_LINE: {
+            output(word, length);
+            fputs("\"\n", stdout);
+            args->st = BR_FRAMES;
+            break;
+        }
+        case BR_FRAMES: {
+            args->words = strtol(word, NULL, 10) * 4;
+            args->ps = PS_FILE;
+            args->st = args->words > 0 ? BR_FRAME : BR_ID;
+            break;
+        }
+        case BR_FRAME: {
+            ps(&args->ps, word, length);
+            if (--args->words == 0)
+                args->st = BR_ID;
+            break;
+        }
+        case BR_ID: {
+            fputc('#', stdout);
+            output(word, length);
+            fputs(" \t", stdout);
+            args->st = BR_EXPR;
+            break;
+        }
+        case BR_EXPR: {
+            output(word, length);
+            fputs(" \t", stdout);
+            args->st = BR_VALUE;
+            break;
+        }
+        case BR_VALUE: {
+            if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            args->st = BR_ID;
+            break;
+        }
+    }
+    return 0;
+}
+
 int ps(State_ps * st, const char * word, int length)
 {
     switch (*st) {
@@ -717,8 +1826,13 @@ typedef enum
 {
     W_VAR = 1,  //for all
     W_META,     //for all
+    W_TOTAL,    //for table by pages
+    W_OFFSET,   //for table by pages
     W_KEY,      //for table
     W_VAL,      //for table
+    W_FIRSTKEY, //for packed numbers
+    W_NUMBERS,  //for packed numbers
+    W_PACKED,   //for packed numbers
     W_SIZE,     //for full userdata
     W_WHAT,     //for function
     W_SRC,      //for function
@@ -731,31 +1845,178 @@ typedef struct
 {
     State_w st;
     State_w st2;    //What state after W_META
+    int handle;     //of a table
+    int total;      //entries of a table by pages
+    int offset;
+    int count;      //entries received
+    int level;      //of the table being listed, 0 for the value watched
+    int paged;      //is a table listed by pages?
+    int first;      //key of the first of packed numbers
+    int key;        //of the next packed number
+    int left;       //packed numbers yet to come
 } Arg_w;
 
+/*
+** Packed numbers are shown W_COLUMNS to a row.
+*/
+#define W_COLUMNS 4
+
 static int w(Arg_w * args, const char * word, int length);
 
-int watch(SocketBuf * sb)
+static void indent(int level)
 {
-    Arg_w args = { W_VAR, 0 };
-    return SB_ReadAndParse(sb, "\n", (UserParser)w, &args);
+    while (level-- > 0)
+        fputs("    ", stdout);
 }
 
-int w(Arg_w * args, const char * word, int length)
+/*
+** When a page of a table doesn't reach its end, tell how to get the next one
+** and keep the command for it, which refers to the table by its handle and
+** lists it to the same depth.
+*/
+int watch(SocketBuf * sb, char * argv[], int argc)
 {
-    switch (args->st) {
-        case W_KEY: {
-            fputs("--------------------------------------------------\n", stdout);
-            if (printVar(word, length) < 0)
-                return -3;
-            fputc('\n', stdout);
-            args->st = W_VAL;
-            break;
-        }
+    Arg_w args = { W_VAR, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const char * expand = "";
+    int next;
+    int rc;
+    int i;
 
-        case W_VAL: {
-            if (printVar(word, length) < 0)
-                return -3;
+    args.paged = g_pagedWatch && !isFilter(argv[argc - 1]);
+    rc = SB_ReadAndParse(sb, "\n", (UserParser)w, &args);
+    next = args.offset + args.count;
+
+    for (i = 1; i < argc; i++)
+        if (isExpand(argv[i]))
+            expand = argv[i];
+
+    if (rc >= 0 && args.handle && args.count && next < args.total) {
+        printf("-- Entries %d-%d of %d. Press Enter for more. --\n",
+            args.offset + 1, next, args.total);
+        sprintf(g_nextPage, "w |#%d %s%s%d,%d", args.handle, expand, *expand ? " " : "",
+            next, args.count);
+    }
+    return rc;
+}
+
+/*
+** Get the handle of an object from its value, in the form of <ptr>:<handle>.
+** Return 0 if it has no handle.
+*/
+static int handleOfObj(const char * str, int length)
+{
+    const char * p = g_binary ? (length > g_ptrSize ? str + g_ptrSize : NULL)
+        : (const char *)memchr(str, ':', length);
+    int id = 0;
+
+    if (!p || *p != ':')
+        return 0;
+    for (++p; p < str + length && isdigit(*p); p++)
+        id = id * 10 + (*p - '0');
+    return id;
+}
+
+int w(Arg_w * args, const char * word, int length)
+{
+    switch (args->st) {
+        case W_TOTAL: {
+            fputs("Entries:", stdout);
+            output(word, length);
+            fputc('\n', stdout);
+            args->total = strtol(word, NULL, 10);
+            args->st = W_OFFSET;
+            break;
+        }
+
+        case W_OFFSET: {
+            args->offset = strtol(word, NULL, 10);
+            args->st = W_KEY;
+            break;
+        }
+
+        case W_KEY: {
+            //A table listed within another is led by "{" and ended by "}". "^"
+            //tells it's been listed before, and "~" that the budget is spent.
+            if (length == 1 && word[0] == '{') {
+                args->level++;
+                args->st = W_META;
+                args->st2 = W_KEY;
+                break;
+            }
+            if (length == 1 && (word[0] == '}' || word[0] == '^' || word[0] == '~')) {
+                if (word[0] == '}' && --args->level < 0)
+                    return -3;
+                if (word[0] != '}') {
+                    indent(args->level + (word[0] == '^'));
+                    fputs(word[0] == '^' ? "Listed above.\n" : "...Budget spent.\n", stdout);
+                }
+                break;
+            }
+            if (length == 1 && word[0] == '[') {
+                args->st = W_FIRSTKEY;
+                break;
+            }
+            indent(args->level);
+            fputs("--------------------------------------------------\n", stdout);
+            indent(args->level);
+            if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            if (args->level == 0)
+                args->count++;
+            args->st = W_VAL;
+            break;
+        }
+
+        case W_FIRSTKEY: {
+            args->first = args->key = strtol(word, NULL, 10);
+            args->st = W_NUMBERS;
+            break;
+        }
+
+        case W_NUMBERS: {
+            args->left = strtol(word, NULL, 10);
+            if (args->left < 1)
+                return -3;
+            indent(args->level);
+            fputs("--------------------------------------------------\n", stdout);
+            indent(args->level);
+            printf("Numbers %d-%d:\n", args->key, args->key + args->left - 1);
+            if (args->level == 0)
+                args->count += args->left;
+            args->st = W_PACKED;
+            break;
+        }
+
+        case W_PACKED: {
+            //Raw numbers, W_COLUMNS to a row led by the key of the first.
+            int i;
+
+            if (length % sizeof(double) || length / (int)sizeof(double) > args->left)
+                return -3;
+            for (i = 0; i < length; i += sizeof(double)) {
+                int col = (args->key - args->first) % W_COLUMNS;
+                double d;
+
+                if (col == 0) {
+                    indent(args->level);
+                    printf("%10d:", args->key);
+                }
+                decodeRaw(word + i, sizeof(d), &d);
+                printf(" %24.17g", d);
+                args->key++;
+                if (--args->left == 0 || col == W_COLUMNS - 1)
+                    fputc('\n', stdout);
+            }
+            if (args->left == 0)
+                args->st = W_KEY;
+            break;
+        }
+
+        case W_VAL: {
+            indent(args->level);
+            if (printVar(word, length) < 0)
+                return -3;
             fputc('\n', stdout);
             args->st = W_KEY;
             break;
@@ -768,7 +2029,8 @@ int w(Arg_w * args, const char * word, int length)
             args->st = W_META;
             switch (word[0]) {
                 case 't': {
-                    args->st2 = W_KEY;
+                    args->st2 = args->paged ? W_TOTAL : W_KEY;
+                    args->handle = handleOfObj(word + 1, length - 1);
                     break;
                 }
                 case 'u': {
@@ -794,6 +2056,7 @@ int w(Arg_w * args, const char * word, int length)
             if (length != 1)
                 return -3;
 
+            indent(args->level);
             if (word[0] == '1') {
                 fputs("HasMetatable:Yes\n", stdout);
             }
@@ -856,50 +2119,601 @@ int w(Arg_w * args, const char * word, int length)
     return 0;
 }
 
+typedef enum
+{
+    DF_OP = 1,
+    DF_KEY,
+    DF_OLD,
+    DF_NEW
+} State_df;
+
+typedef struct
+{
+    State_df st;
+    char op;        //of the change being received
+    int level;      //of the table the change is in, 0 for the one diffed
+    int changes;
+} Arg_df;
+
+static int df(Arg_df * args, const char * word, int length);
+
+int diff(SocketBuf * sb)
+{
+    Arg_df args = { DF_OP, 0, 0, 0 };
+    int rc = SB_ReadAndParse(sb, "\n", (UserParser)df, &args);
+
+    if (rc >= 0 && !args.changes)
+        fputs("No changes.\n", stdout);
+    return rc;
+}
+
+int df(Arg_df * args, const char * word, int length)
+{
+    switch (args->st) {
+        case DF_OP: {
+            if (length != 1)
+                return -3;
+            args->op = word[0];
+            switch (word[0]) {
+                case '<': {
+                    if (--args->level < 0)
+                        return -3;
+                    break;
+                }
+                case '~': {
+                    indent(args->level);
+                    fputs("...Budget spent.\n", stdout);
+                    break;
+                }
+                case '>':
+                case '+':
+                case '-':
+                case '*': {
+                    args->st = DF_KEY;
+                    break;
+                }
+                default: {
+                    return -3;
+                }
+            }
+            break;
+        }
+
+        case DF_KEY: {
+            indent(args->level);
+            fputs(args->op == '>' ? "In:      " : args->op == '+' ? "Added:   "
+                : args->op == '-' ? "Removed: " : "Changed: ", stdout);
+            if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            if (args->op == '>') {
+                args->level++;
+                args->st = DF_OP;
+            }
+            else {
+                args->changes++;
+                args->st = args->op == '+' ? DF_NEW : DF_OLD;
+            }
+            break;
+        }
+
+        case DF_OLD:
+        case DF_NEW: {
+            indent(args->level + 1);
+            fputs(args->st == DF_OLD ? "Old: " : "New: ", stdout);
+            if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            args->st = args->st == DF_OLD && args->op == '*' ? DF_NEW : DF_OP;
+            break;
+        }
+
+        default: {
+            return -3;
+        }
+    }
+    return 0;
+}
+
+typedef enum
+{
+    Q_ENTRIES = 1,
+    Q_SPENT,
+    Q_NUMBERS,
+    Q_SUM,
+    Q_MIN,
+    Q_MAX,
+    Q_KINDS,
+    Q_TYPE,
+    Q_COUNT,
+    Q_KEPT,
+    Q_KEY,
+    Q_VALUE
+} State_q;
+
+typedef struct
+{
+    State_q st;
+    int numbers;
+    int left;       //types or entries of the top yet to come
+    int rank;
+} Arg_q;
+
+static int q(Arg_q * args, const char * word, int length);
+
+int query(SocketBuf * sb)
+{
+    Arg_q args = { Q_ENTRIES, 0, 0, 0 };
+    return SB_ReadAndParse(sb, "\n", (UserParser)q, &args);
+}
+
+int q(Arg_q * args, const char * word, int length)
+{
+    switch (args->st) {
+        case Q_ENTRIES: {
+            fputs("Entries:", stdout);
+            output(word, length);
+            args->st = Q_SPENT;
+            break;
+        }
+
+        case Q_SPENT: {
+            fputs(word[0] == '1' ? " (budget spent, the rest not looked at)\n" : "\n", stdout);
+            args->st = Q_NUMBERS;
+            break;
+        }
+
+        case Q_NUMBERS: {
+            args->numbers = strtol(word, NULL, 10);
+            fputs("Numbers:", stdout);
+            output(word, length);
+            args->st = Q_SUM;
+            break;
+        }
+
+        case Q_SUM:
+        case Q_MIN:
+        case Q_MAX: {
+            if (length < 1 || word[0] != 'n')
+                return -3;
+            if (args->numbers > 0) {
+                fputs(args->st == Q_SUM ? " \tSum:" : args->st == Q_MIN ? " \tMin:" : " \tMax:", stdout);
+                if (outputNum(stdout, word + 1, length - 1) < 0)
+                    return -3;
+            }
+            if (args->st == Q_MAX)
+                fputc('\n', stdout);
+            args->st++;
+            break;
+        }
+
+        case Q_KINDS: {
+            args->left = strtol(word, NULL, 10);
+            if (args->left > 0)
+                fputs("Types:", stdout);
+            args->st = args->left > 0 ? Q_TYPE : Q_KEPT;
+            break;
+        }
+
+        case Q_TYPE: {
+            const char * tstr = typestr(word[0]);
+            if (length != 1 || *tstr == 0)
+                return -3;
+            printf(" %s ", tstr);
+            args->st = Q_COUNT;
+            break;
+        }
+
+        case Q_COUNT: {
+            output(word, length);
+            if (--args->left > 0) {
+                fputc(',', stdout);
+                args->st = Q_TYPE;
+            }
+            else {
+                fputc('\n', stdout);
+                args->st = Q_KEPT;
+            }
+            break;
+        }
+
+        case Q_KEPT: {
+            args->left = strtol(word, NULL, 10);
+            if (args->left > 0)
+                fputs("Top:\n", stdout);
+            args->st = Q_KEY;
+            break;
+        }
+
+        case Q_KEY: {
+            if (args->left-- <= 0)
+                return -3;
+            printf("%4d. ", ++args->rank);
+            if (printVar(word, length) < 0)
+                return -3;
+            args->st = Q_VALUE;
+            break;
+        }
+
+        case Q_VALUE: {
+            fputs(" \t", stdout);
+            if (length < 1 || word[0] != 'n' || outputNum(stdout, word + 1, length - 1) < 0)
+                return -3;
+            fputc('\n', stdout);
+            args->st = Q_KEY;
+            break;
+        }
+
+        default: {
+            return -3;
+        }
+    }
+    return 0;
+}
+
+typedef enum
+{
+    SS_FRAME = 1,
+    SS_WHERE,   //the rest of where the frame is, as ps shows it
+    SS_LOCALS,  //the number of locals
+    SS_UPVARS,  //the number of up variables
+    SS_NAME,
+    SS_VALUE
+} State_ss;
+
+typedef struct
+{
+    State_ss st;
+    State_ps ps;
+    int frame;
+    int vars;   //variables left in the list
+    int up;     //is the list of up variables?
+} Arg_ss;
+
+static int ss(Arg_ss * args, const char * word, int length);
+
+int snapStack(SocketBuf * sb)
+{
+    Arg_ss args = { SS_FRAME, PS_FILE, 0, 0, 0 };
+    return SB_ReadAndParse(sb, "\n", (UserParser)ss, &args);
+}
+
+int ss(Arg_ss * args, const char * word, int length)
+{
+    int omitted = length == 1 && word[0] == '~';
+
+    switch (args->st) {
+        case SS_FRAME: {
+            if (omitted) {
+                fputs("...Budget spent. The rest of the stack is left out.\n", stdout);
+                break;
+            }
+            printf("#%d ", ++args->frame);
+            ps(&args->ps, word, length);
+            args->st = SS_WHERE;
+            break;
+        }
+
+        case SS_WHERE: {
+            ps(&args->ps, word, length);
+            if (args->ps == PS_FILE)
+                args->st = SS_LOCALS;
+            break;
+        }
+
+        case SS_LOCALS:
+        case SS_UPVARS: {
+            args->up = args->st == SS_UPVARS;
+            args->vars = strtol(word, NULL, 10);
+            if (args->vars > 0) {
+                indent(1);
+                fputs(args->up ? "Upvalues:\n" : "Locals:\n", stdout);
+                args->st = SS_NAME;
+            }
+            else {
+                args->st = args->up ? SS_FRAME : SS_UPVARS;
+            }
+            break;
+        }
+
+        case SS_NAME: {
+            indent(2);
+            fputs("Name:", stdout);
+            output(word, length);
+            fputs(" \t", stdout);
+            args->st = SS_VALUE;
+            break;
+        }
+
+        case SS_VALUE: {
+            if (omitted)
+                fputs("Value left out.", stdout);
+            else if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            if (--args->vars > 0)
+                args->st = SS_NAME;
+            else
+                args->st = args->up ? SS_FRAME : SS_UPVARS;
+            break;
+        }
+
+        default: {
+            return -3;
+        }
+    }
+    return 0;
+}
+
 typedef enum
 {
     LB_FILE,
-    LB_LINE
+    LB_LINE,
+    LB_STATUS
 } State_lb;
 
-static int lb(State_lb * st, const char * word, int length);
+typedef struct
+{
+    State_lb st;
+    int keep;       //keep rejected entries in g_rejected?
+    int entry;      //where the entry being listed starts in g_rejected
+} Args_lb;
+
+static int lb(Args_lb * args, const char * word, int length);
 
 int listB(SocketBuf * sb)
 {
-    State_lb st = LB_FILE;
-    return SB_ReadAndParse(sb, "\n", (UserParser)lb, &st);
+    return listRejectedB(sb, 0);
+}
+
+/*
+** List breakpoints as listB does and, with keep, remember those rejected in
+** g_rejected in place of what it held.
+** Return 0 when success, or a negative as SB_ReadAndParse does.
+*/
+static int listRejectedB(SocketBuf * sb, int keep)
+{
+    Args_lb args;
+
+    args.st = LB_FILE;
+    args.keep = keep;
+    args.entry = 0;
+    if (keep)
+        g_rejectedLen = 0;
+    return SB_ReadAndParse(sb, "\n", (UserParser)lb, &args);
+}
+
+/*
+** Append data to g_rejected.
+** Return 0 when success, or -1 when no memory.
+*/
+static int addRejected(const char * data, int len)
+{
+    if (g_rejectedLen + len > g_rejectedSize) {
+        int size = g_rejectedSize ? g_rejectedSize : CMD_LINE;
+        char * p;
+        while (size < g_rejectedLen + len)
+            size *= 2;
+        p = (char *)realloc(g_rejected, size);
+        if (!p)
+            return -1;
+        g_rejected = p;
+        g_rejectedSize = size;
+    }
+    memcpy(g_rejected + g_rejectedLen, data, len);
+    g_rejectedLen += len;
+    return 0;
 }
 
-int lb(State_lb * st, const char * word, int length)
+int lb(Args_lb * args, const char * word, int length)
 {
-    if (*st == LB_FILE) {
+    if (args->st == LB_FILE) {
         fputc('"', stdout);
         output(word, length);
         fputc(':', stdout);
-        *st = LB_LINE;
+        if (args->keep) {
+            args->entry = g_rejectedLen;
+            if (addRejected(word, length) < 0 || addRejected(":", 1) < 0)
+                return -3;
+        }
+        args->st = LB_LINE;
     }
-    else {
+    else if (args->st == LB_LINE) {
         output(word, length);
-        fputs("\"\n", stdout);
-        *st = LB_FILE;
+        fputc('"', stdout);
+        if (args->keep && addRejected(word, length) < 0)
+            return -3;
+        args->st = LB_STATUS;
+    }
+    else {
+        int rejected = length == 2 && !strncmp(word, "-1", 2);
+
+        //A breakpoint is pending until its file is loaded.
+        if (length == 1 && *word == '0')
+            fputs(" (pending)", stdout);
+        else if (rejected)
+            fputs(" (rejected)", stdout);
+        fputc('\n', stdout);
+        if (args->keep) {
+            if (!rejected)
+                g_rejectedLen = args->entry;
+            else if (addRejected("\n", 1) < 0)
+                return -3;
+        }
+        args->st = LB_FILE;
     }
     return 0;
 }
 
+/*
+** Read the breakpoints in file, one "path:line" per line, and make a "bb"
+** command flow of them in a buffer allocated by malloc. Blank lines and lines
+** starting with '#' are skipped.
+** Return the buffer and put the flow length in *len, or return NULL when the
+** file can't be read.
+*/
+static char * loadB(const char * file, int clear, int * len)
+{
+    char line[CMD_LINE];
+    char * buf;
+    int size = CMD_LINE;
+    int n;
+    FILE * fp = fopen(file, "r");
+
+    if (!fp)
+        return NULL;
+    buf = (char *)malloc(size);
+    if (!buf) {
+        fclose(fp);
+        return NULL;
+    }
+    n = sprintf(buf, clear ? "bb c" : "bb");
+
+    while (fgets(line, CMD_LINE, fp)) {
+        char * colon;
+        int l = strlen(line);
+
+        while (l > 0 && isspace(line[l - 1]))
+            line[--l] = 0;
+        if (!l || line[0] == '#')
+            continue;
+        colon = strrchr(line, ':');
+        if (!colon || colon == line || !colon[1] || !allDigits(colon + 1)) {
+            printf("Ignored \"%s\" in %s\n", line, file);
+            continue;
+        }
+        *colon = '\n';
+
+        if (n + l + 2 > size) {
+            char * p;
+            size *= 2;
+            p = (char *)realloc(buf, size);
+            if (!p) {
+                free(buf);
+                fclose(fp);
+                return NULL;
+            }
+            buf = p;
+        }
+        n += sprintf(buf + n, "\n%s", line);
+    }
+    fclose(fp);
+    *len = n + 1;   //Including the EOF
+    return buf;
+}
+
+/*
+** Set the breakpoints in file in one batch, and show where they are set.
+** With clear, existing breakpoints are deleted first. When file is g_bpFile,
+** the entries rejected are remembered for saveB, but the file isn't rewritten
+** here: it's up to the caller.
+** Return 0 when success, -1 when socket or protocol error, or -2 when the
+** file can't be read.
+*/
+int uploadB(SOCKET s, SocketBuf * sb, const char * file, int clear)
+{
+    int len;
+    int rc;
+    char * flow = loadB(file, clear, &len);
+
+    if (!flow)
+        return -2;
+    rc = SendData(s, flow, len);
+    free(flow);
+    if (rc < 0)
+        return -1;
+
+    rc = waitForResponseFirstLine(sb, -1);
+    if (rc < 0)
+        return -1;
+    if (rc == 0)
+        return showError(sb) < 0 ? -1 : 0;
+    return listRejectedB(sb, g_bpFile && !strcmp(file, g_bpFile)) < 0 ? -1 : 0;
+}
+
+/*
+** List the breakpoints kept by a resumed debuggee.
+** Return 0 when success, or -1 when socket or protocol error.
+*/
+int showB(SOCKET s, SocketBuf * sb)
+{
+    int rc;
+
+    if (SendData(s, "lb", sizeof("lb")) < 0)
+        return -1;
+    rc = waitForResponseFirstLine(sb, -1);
+    if (rc <= 0)
+        return rc < 0 ? -1 : (showError(sb) < 0 ? -1 : 0);
+    return listB(sb);
+}
+
+typedef struct
+{
+    State_lb st;
+    FILE * fp;
+} Args_svb;
+
+static int svb(Args_svb * args, const char * word, int length);
+
+/*
+** List breakpoints and write them to g_bpFile, replacing what it holds, along
+** with the entries of it the debuggee rejected.
+** Return 0 when success, or -1 when socket or protocol error.
+*/
+int saveB(SOCKET s, SocketBuf * sb)
+{
+    Args_svb args;
+    int rc;
+
+    if (SendData(s, "lb", sizeof("lb")) < 0)
+        return -1;
+    rc = waitForResponseFirstLine(sb, -1);
+    if (rc <= 0)
+        return rc < 0 ? -1 : (showError(sb) < 0 ? -1 : 0);
+
+    args.st = LB_FILE;
+    args.fp = fopen(g_bpFile, "w");
+    if (!args.fp)
+        printf("Can't write breakpoint file %s!\n", g_bpFile);
+    rc = SB_ReadAndParse(sb, "\n", (UserParser)svb, &args);
+    if (args.fp) {
+        if (g_rejectedLen)
+            fwrite(g_rejected, 1, g_rejectedLen, args.fp);
+        fclose(args.fp);
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+int svb(Args_svb * args, const char * word, int length)
+{
+    if (args->fp) {
+        if (args->st == LB_FILE) {
+            fwrite(word, 1, length, args->fp);
+            fputc(':', args->fp);
+        }
+        else if (args->st == LB_LINE) {
+            fwrite(word, 1, length, args->fp);
+            fputc('\n', args->fp);
+        }
+    }
+    args->st = args->st == LB_STATUS ? LB_FILE : args->st + 1;
+    return 0;
+}
+
 #define PROVIDER_BUF_SIZE 1024
 
 typedef struct
 {
-    SOCKET s;
+    SocketBuf * sb;
     unsigned int len;
     char buf[PROVIDER_BUF_SIZE];
 } Arg_wm;
 
-static int provide(Arg_wm * args, const char ** buf, unsigned int * size);
+static int provide(Arg_wm * args, const char ** buf, size_t * size);
 
 int watchM(SocketBuf * sb, char * argv[], int argc)
 {
-    unsigned int addr = strtoul(argv[1], NULL, 0);
+    size_t addr = (size_t)strtoull(argv[1], NULL, 0);
     unsigned int len;
     char * end;
     Arg_wm args;
@@ -911,17 +2725,17 @@ int watchM(SocketBuf * sb, char * argv[], int argc)
     if (len == 0 || *end != '\n' || sb->lbuf + 8 != end)
         return -2;
 
-    args.s = sb->s;
+    args.sb = sb;
     args.len = len;
     return Dump(addr, (DataProvider)provide, &args, stdout, NULL, NULL);
 }
 
-int provide(Arg_wm * args, const char ** buf, unsigned int * size)
+int provide(Arg_wm * args, const char ** buf, size_t * size)
 {
     if (args->len > 0) {
-        int l = recv(args->s, args->buf,
-            args->len < PROVIDER_BUF_SIZE ? args->len : PROVIDER_BUF_SIZE, 0);
-        if (l == SOCKET_ERROR || !l)
+        int l = SB_ReadRaw(args->sb, args->buf,
+            args->len < PROVIDER_BUF_SIZE ? args->len : PROVIDER_BUF_SIZE);
+        if (l < 0)
             return -1;
         args->len -= l;
         *size = l;
@@ -931,30 +2745,452 @@ int provide(Arg_wm * args, const char ** buf, unsigned int * size)
     return 0;
 }
 
+static int rs(int * matches, const char * word, int length);
+
+/*
+** Show the bytes of a string read by rs, dumped as m dumps memory with the
+** offsets in the string for addresses, or, when a pattern is searched for, the
+** offsets where it's found.
+*/
+int readS(SocketBuf * sb, char * argv[], int argc)
+{
+    unsigned int len, offset;
+    char * end;
+    Arg_wm args;
+    int matches = -1;
+    int rc;
+
+    if (isPage(argv[argc - 2])) {
+        rc = SB_ReadAndParse(sb, "\n", (UserParser)rs, &matches);
+        if (rc >= 0 && matches == 0)
+            printf("No match.\n");
+        return rc;
+    }
+
+    if (SB_Read(sb, 27) < 0 || sb->end)
+        return -1;
+    len = strtoul(sb->lbuf, &end, 16);
+    if (*end != ':')
+        return -2;
+    offset = strtoul(end + 1, &end, 16);
+    if (*end != ':')
+        return -2;
+    args.len = strtoul(end + 1, &end, 16);
+    if (*end != '\n' || sb->lbuf + 26 != end)
+        return -2;
+
+    printf("Length:%u\tOffset:%u\tBytes:%u\n", len, offset, args.len);
+    if (!args.len)
+        return 0;
+    args.sb = sb;
+    return Dump(offset, (DataProvider)provide, &args, stdout, NULL, NULL);
+}
+
+int rs(int * matches, const char * word, int length)
+{
+    if (*matches < 0)
+        printf("Length:%.*s\n", length, word);
+    else if (word[0] == '~')
+        printf("...More matches.\n");
+    else
+        printf("Match at:%.*s\n", length, word);
+    ++*matches;
+    return 0;
+}
+
+typedef enum
+{
+    SP_ID,
+    SP_TIME,
+    SP_VALUE
+} State_sp;
+
+static int sp(State_sp * st, const char * word, int length);
+
+int showSamples(SocketBuf * sb)
+{
+    State_sp st = SP_ID;
+    int rc = SB_ReadAndParse(sb, "\n", (UserParser)sp, &st);
+    fflush(stdout);
+    if (g_sampleFile)
+        fflush(g_sampleFile);
+    return rc;
+}
+
+/*
+** Show the SP messages in the shared ring, if any, until it's empty. A message
+** which isn't a valid SP message is dropped with a note.
+*/
+void drainRing(void)
+{
+    int len;
+
+    if (!g_ring.header)
+        return;
+    lockRing();
+    while ((len = SR_Get(&g_ring, g_ringBuf, g_ringBufSize))) {
+        if (len < 0) {
+            printf("Invalid message in shared ring!\n");
+            break;
+        }
+        SB_InitMemory(&g_ringSb, g_ringBuf, len);
+        g_ringSb.binary = g_binary;
+        g_ringSb.intern = g_ringIntern;
+        g_ringSb.compressed = g_ringCompressed;
+        if (SB_Read(&g_ringSb, 3) < 0 || strncmp(g_ringSb.lbuf, "SP\n", 3)
+            || showSamples(&g_ringSb) < 0)
+            printf("Invalid message in shared ring!\n");
+    }
+    unlockRing();
+}
+
+#if defined(OS_LINUX)
+static void * readRing(void * unused)
+{
+    while (!g_ringStop) {
+        SR_Wait(&g_ring, 100);
+        drainRing();
+    }
+    return NULL;
+}
+#endif
+
+/*
+** Create the shared ring of size bytes and start the thread reading it.
+** Return 0 when success, or -1 when it fails or isn't supported.
+*/
+int openRing(unsigned int size)
+{
+#if defined(OS_LINUX)
+    sprintf(g_ringName, "/rldb-%d", (int)getpid());
+    if (SR_Create(&g_ring, g_ringName, size) < 0)
+        return -1;
+    g_ringBufSize = g_ring.size;
+    g_ringBuf = (char *)malloc(g_ringBufSize);
+    if (g_ringBuf && pthread_create(&g_ringThread, NULL, readRing, NULL)) {
+        free(g_ringBuf);
+        g_ringBuf = NULL;
+    }
+    if (!g_ringBuf) {
+        closeRing();
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void closeRing(void)
+{
+#if defined(OS_LINUX)
+    if (!g_ring.header)
+        return;
+    if (g_ringBuf) {
+        g_ringStop = 1;
+        pthread_join(g_ringThread, NULL);
+    }
+    SR_Unlink(g_ringName);
+    SR_Close(&g_ring);
+    free(g_ringBuf);
+    g_ringBuf = NULL;
+#endif
+}
+
+/*
+** Write a value in the sample file: numbers and booleans as they are, strings
+** decoded (and truncated as they were sent), nil as "nil", and the others as
+** their address.
+*/
+static void saveVar(FILE * out, const char * str, int length)
+{
+    const char * end = str + length;
+    char t = str[0];
+
+    fprintf(out, "%s\t", typestr(t));
+    if (t == 's') {
+        //s<address>:<length>:<truncated-length>:<content>
+        const char * p = str + 1 + (g_binary ? g_ptrSize : 0);
+        int i;
+        for (i = 0; i < 3 && p; i++) {
+            p = (const char *)memchr(p, ':', end - p);
+            if (p)
+                ++p;
+        }
+        if (p && g_binary) {
+            fwrite(p, 1, end - p, out);
+        }
+        if (p && !g_binary) {
+            HEX_Write(out, p, end - p);
+        }
+    }
+    else if (t == 'l') {
+        fputs("nil", out);
+    }
+    else if (t == 'n') {
+        outputNum(out, str + 1, length - 1);
+    }
+    else if (t == 't' || t == 'f' || t == 'u' || t == 'U' || t == 'd') {
+        outputObj(out, str + 1, length - 1, 0);
+    }
+    else {
+        fwrite(str + 1, 1, length - 1, out);
+    }
+    fputc('\n', out);
+}
+
+int sp(State_sp * st, const char * word, int length)
+{
+    switch (*st) {
+        case SP_ID: {
+            fputs("Sample #", stdout);
+            output(word, length);
+            if (g_sampleFile) {
+                fwrite(word, 1, length, g_sampleFile);
+                fputc('\t', g_sampleFile);
+            }
+            *st = SP_TIME;
+            break;
+        }
+        case SP_TIME: {
+            fputs(" \tTime:", stdout);
+            if (outputNum(stdout, word, length) < 0)
+                return -3;
+            fputs(" \t", stdout);
+            if (g_sampleFile) {
+                outputNum(g_sampleFile, word, length);
+                fputc('\t', g_sampleFile);
+            }
+            *st = SP_VALUE;
+            break;
+        }
+        case SP_VALUE: {
+            if (printVar(word, length) < 0)
+                return -3;
+            fputc('\n', stdout);
+            if (g_sampleFile)
+                saveVar(g_sampleFile, word, length);
+            *st = SP_ID;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int st(void * ud, const char * word, int length);
+
+int setT(SocketBuf * sb)
+{
+    return SB_ReadAndParse(sb, "\n", (UserParser)st, NULL);
+}
+
+int st(void * ud, const char * word, int length)
+{
+    fputs("Sample #", stdout);
+    output(word, length);
+    fputs(" is set.\n", stdout);
+    return 0;
+}
+
+typedef enum
+{
+    LT_ID,
+    LT_INTERVAL,
+    LT_EXPR
+} State_lt;
+
+static int lt(State_lt * st, const char * word, int length);
+
+int listT(SocketBuf * sb)
+{
+    State_lt st = LT_ID;
+    return SB_ReadAndParse(sb, "\n", (UserParser)lt, &st);
+}
+
+int lt(State_lt * st, const char * word, int length)
+{
+    switch (*st) {
+        case LT_ID: {
+            fputc('#', stdout);
+            output(word, length);
+            *st = LT_INTERVAL;
+            break;
+        }
+        case LT_INTERVAL: {
+            fputs(" \tEvery:", stdout);
+            output(word, length);
+            fputs("ms \t", stdout);
+            *st = LT_EXPR;
+            break;
+        }
+        case LT_EXPR: {
+            output(word, length);
+            fputc('\n', stdout);
+            *st = LT_ID;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int tq(int * field, const char * word, int length);
+
+int queueT(SocketBuf * sb)
+{
+    int field = 0;
+    int rc = SB_ReadAndParse(sb, "\n", (UserParser)tq, &field);
+    if (rc >= 0)
+        fputc('\n', stdout);
+    return rc;
+}
+
+int tq(int * field, const char * word, int length)
+{
+    static const char * labels[] = {"Capacity:", " \tDrop:", "\nQueued:", " \tSent:",
+        " \tDropped:"};
+
+    if (*field < 5) {
+        fputs(labels[*field], stdout);
+        if (*field == 1)
+            fputs(*word == 'o' ? "oldest" : "newest", stdout);
+        else
+            output(word, length);
+    }
+    ++*field;
+    return 0;
+}
+
+static int sd(void * ud, const char * word, int length);
+
+int setD(SocketBuf * sb)
+{
+    return SB_ReadAndParse(sb, "\n", (UserParser)sd, NULL);
+}
+
+int sd(void * ud, const char * word, int length)
+{
+    fputs("Display #", stdout);
+    output(word, length);
+    fputs(" is set.\n", stdout);
+    return 0;
+}
+
+typedef enum
+{
+    LD_ID,
+    LD_LEVEL,
+    LD_EXPR
+} State_ld;
+
+static int ld(State_ld * st, const char * word, int length);
+
+int listD(SocketBuf * sb)
+{
+    State_ld st = LD_ID;
+    return SB_ReadAndParse(sb, "\n", (UserParser)ld, &st);
+}
+
+int ld(State_ld * st, const char * word, int length)
+{
+    switch (*st) {
+        case LD_ID: {
+            fputc('#', stdout);
+            output(word, length);
+            *st = LD_LEVEL;
+            break;
+        }
+        case LD_LEVEL: {
+            fputs(" \tLevel:", stdout);
+            output(word, length);
+            fputs(" \t", stdout);
+            *st = LD_EXPR;
+            break;
+        }
+        case LD_EXPR: {
+            output(word, length);
+            fputc('\n', stdout);
+            *st = LD_ID;
+            break;
+        }
+    }
+    return 0;
+}
+
 #define HELP_CONTENT \
 "RLdb 2.0.0 Copyright (C) 2011 Robert Ray<louirobert@gmail.com>\n"\
 "All rights reserved\n"\
 "Debug commands are listed below in alphabetical order. Please refer to online document for details. (If you don't know where to get one, write to me.)\n"\
+"Several commands can be typed in one line separated by ';', e.g. ps; ll 1; lu 1,\n"\
+"which are sent in one go. s, o and r can only be the last one, and an e or sd\n"\
+"takes the rest of the line as its expression.\n"\
+"\n"\
+"bb\n"\
+"Brief:  Set breakpoints listed in a file in one go.\n"\
+"Format: bb <file-path> [c]\n"\
+"        The file holds one <file-path>:<line-no> per line. With c, existing\n"\
+"        breakpoints are deleted first.\n"\
 "\n"\
 "db \n"\
 "Brief:  Delete a breakpoint.\n"\
 "Format: db <file-path> <line-no>\n"\
 "\n"\
+"df\n"\
+"Brief:  Show what changed in a table since it was remembered by w ... r<depth>.\n"\
+"Format1:df <stack-level> <l|u|g> <variable-name>[properties]\n"\
+"Format2:df [properties]\n"\
+"        The entries added, removed and changed are listed, within the tables\n"\
+"        in it as well down to depth levels, e.g. w 1 l state r3, then s, then\n"\
+"        df. Without a variable the remembered table is diffed.\n"\
+"\n"\
+"dd\n"\
+"Brief:  Delete a display.\n"\
+"Format: dd <display-id>\n"\
+"\n"\
+"ds\n"\
+"Brief:  Set how many stack frames are shown at each break, 0 for none.\n"\
+"Format: ds <depth>\n"\
+"\n"\
+"dt\n"\
+"Brief:  Delete a sample.\n"\
+"Format: dt <sample-id>\n"\
+"\n"\
+"e\n"\
+"Brief:  Evaluate an expression or run statements in a function on the stack.\n"\
+"Format: e <stack-level> <expression>\n"\
+"        Locals and upvalues of the function can be read and assigned.\n"\
+"\n"\
 "lb\n"\
 "Brief:  List breakpoints.\n"\
 "Format: lb\n"\
 "\n"\
+"ld\n"\
+"Brief:  List displays.\n"\
+"Format: ld\n"\
+"\n"\
 "lg\n"\
 "Brief:  List globals.\n"\
-"Format: lg <stack-level>\n"\
+"Format: lg <stack-level> [<filter>]\n"\
+"        As with ll, only the changes are received, and a filter is taken.\n"\
 "\n"\
 "ll\n"\
 "Brief:  List locals.\n"\
-"Format: ll <stack-level>\n"\
+"Format: ll <stack-level> [<filter>]\n"\
+"        Only the variables changed since the last ll at the level are received\n"\
+"        from the debuggee, and they are marked by (changed).\n"\
+"        A filter lists only the variables passing it, applied by the debuggee.\n"\
+"        It's any of ~<pattern>, :<types> and #<count>: names starting with\n"\
+"        pattern, or matching it as a Lua pattern when it has any of ^$*+?.([%-;\n"\
+"        values of the types given by s, n, t, f, u, U, b, d and l; and at most\n"\
+"        count of them. E.g. lg 1 ~cfg_ :sn #20\n"\
+"\n"\
+"lt\n"\
+"Brief:  List samples.\n"\
+"Format: lt\n"\
 "\n"\
 "lu\n"\
 "Brief:  List upvalues.\n"\
-"Format: lu <stack-level>\n"\
+"Format: lu <stack-level> [<filter>]\n"\
+"        As with ll, only the changes are received, and a filter is taken.\n"\
 "\n"\
 "m\n"\
 "Brief:  Watch memory.\n"\
@@ -968,10 +3204,33 @@ int provide(Arg_wm * args, const char ** buf, unsigned int * size)
 "Brief:  Print calling stack.\n"\
 "Format: ps\n"\
 "\n"\
+"q\n"\
+"Brief:  Aggregate the values of a table in the debuggee.\n"\
+"Format1:q <stack-level> <l|u|g> <variable-name>[properties] [.<field>] [k<count>]\n"\
+"        [b<entries>]\n"\
+"Format2:q [properties] [.<field>] [k<count>] [b<entries>]\n"\
+"        The table is given as for w. The number of its values, the sum, min\n"\
+"        and max of the numbers among them, the types they are of and the\n"\
+"        entries of the greatest numbers are shown. With .<field> the values\n"\
+"        are the field of each record in the table, a key of string or the\n"\
+"        properties of a path, e.g. q 1 l sessions .bytes k5 or .|s'stat'|n1.\n"\
+"        The top keeps 10 entries, or count up to 100; at most 1000000 entries\n"\
+"        are looked at, or the entries given.\n"\
+"\n"\
 "r\n"\
 "Brief:  Run program until a breakpoint.\n"\
 "Format: r\n"\
 "\n"\
+"rs\n"\
+"Brief:  Read a long string by ranges, or search it.\n"\
+"Format1:rs <stack-level> <l|u|g> <variable-name>[properties] <offset>,<length>\n"\
+"        [<pattern>]\n"\
+"Format2:rs [properties] <offset>,<length> [<pattern>]\n"\
+"        The string is given as for w. Its bytes from offset are dumped, or,\n"\
+"        with a pattern, the offsets of the pattern within them are listed.\n"\
+"        Quote the pattern if it contains spaces, e.g. rs 1 l body 0,10000000\n"\
+"        \"HTTP/1.1 500\".\n"\
+"\n"\
 "s\n"\
 "Brief:  Step into.\n"\
 "Format: s\n"\
@@ -979,11 +3238,54 @@ int provide(Arg_wm * args, const char ** buf, unsigned int * size)
 "sb\n"\
 "Brief:  Set a breakpoint.\n"\
 "Format: sb <file-path> <line-no>\n"\
+"        The line moves to the next one holding code. A breakpoint in a file not\n"\
+"        loaded yet stays pending until the file is loaded.\n"\
+"\n"\
+"sd\n"\
+"Brief:  Display an expression or a watched value at each break.\n"\
+"Format1:sd <stack-level> <expression>\n"\
+"Format2:sd w <stack-level> <l|u|g> <variable-name>[properties]\n"\
+"Format3:sd w <properties>\n"\
+"        A watch path is looked up as w does, e.g. sd w 1 l state|s'mode', or\n"\
+"        sd w |#12|s'name'.\n"\
+"\n"\
+"ss\n"\
+"Brief:  Print calling stack with the locals and upvalues of each function.\n"\
+"Format: ss [<frame-bytes> [<total-bytes>]]\n"\
+"        Values beyond 16K bytes in a frame and frames beyond 256K bytes in all\n"\
+"        are left out, or beyond the bytes given. 0 bytes means no limit.\n"\
+"\n"\
+"st\n"\
+"Brief:  Sample an expression periodically while the script runs.\n"\
+"Format: st <interval-ms> <expression>\n"\
+"        Quote the expression if it contains spaces, e.g. st 100 \"#queue + #pool\".\n"\
+"\n"\
+"tq\n"\
+"Brief:  Set up the queue samples are sent from, and show how many were dropped.\n"\
+"Format: tq [<capacity> [o|n]]\n"\
+"        Batches of samples are queued for the debuggee to send on a thread of\n"\
+"        its own, 64 at most unless told another capacity, which is rounded\n"\
+"        up to a power of 2. When the queue is full, the oldest batch (o, the\n"\
+"        default) or the newest (n) is dropped.\n"\
 "\n"\
 "w\n"\
 "Brief:  Watch a variable.\n"\
-"Format1:w <stack-level> <l|u|g> <variable-name>[properties] [r]\n"\
-"Format2:w <properties> [r]\n"\
+"Format1:w <stack-level> <l|u|g> <variable-name>[properties] [r[<depth>]]\n"\
+"        [x<depth>] [<offset>,<limit>]\n"\
+"Format2:w <properties> [r[<depth>]] [x<depth>] [<offset>,<limit>]\n"\
+"        A property #<handle> is the value shown with that handle, looked up\n"\
+"        directly, e.g. w |#12|s'name'. It can also start Format2 when nothing\n"\
+"        is remembered. Values shown hold until the script resumes, and a\n"\
+"        value keeps its handle as long as it lives.\n"\
+"        A table is shown by pages of 100 entries; press Enter for the next page.\n"\
+"        Give <offset>,<limit> for a page of your own.\n"\
+"        With x<depth>, tables within the value are listed as well, down to\n"\
+"        depth levels, e.g. w 1 l request x4. Listing stops once 64K bytes are\n"\
+"        received, or the bytes given by x<depth>,<bytes>.\n"\
+"        A filter as for ll in place of <offset>,<limit> lists only the entries\n"\
+"        of the table passing it, by their keys, e.g. w 1 g _G ~^on :f.\n"\
+"        With r the value is remembered for Format2, and with r<depth> a table\n"\
+"        is also copied down to depth levels for df to diff against.\n"\
 
 void showHelp()
 {
@@ -0,0 +1,58 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef __HEX_H__
+#define __HEX_H__
+
+#include <stdio.h>
+
+/*
+** The hex encoding of strings in text flows, where each byte is 2 lowercase hex
+** digits, the high 4 bits first. Kernels using SSE2 or AVX2 do 16 or 32 bytes
+** at a time, the widest one the CPU supports being chosen when first called,
+** and a scalar one does the rest and runs where neither is available.
+*/
+
+/*
+** Encode len bytes of src into the 2 * len characters at dst.
+*/
+void HEX_Encode(char * dst, const char * src, int len);
+
+/*
+** Decode the len characters of src, len being even, into the len / 2 bytes at
+** dst. Characters other than hex digits give undefined bytes.
+*/
+void HEX_Decode(char * dst, const char * src, int len);
+
+/*
+** Decode the len characters of src, len being even, and write the bytes to out
+** a piece at a time.
+*/
+void HEX_Write(FILE * out, const char * src, int len);
+
+/*
+** Return the name of the kernel chosen: "avx2", "sse2" or "scalar".
+*/
+const char * HEX_Kernel(void);
+
+#endif
@@ -0,0 +1,176 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#include <string.h>
+#include "Lz.h"
+
+#define MIN_MATCH 4
+#define MF_LIMIT 12     //no match starts within the last 12 bytes
+#define LAST_LITERALS 5 //nor reaches into the last 5
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+static unsigned int Read32(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static int Hash(unsigned int v)
+{
+    return (int)((v * 2654435761U) >> (32 - HASH_BITS));
+}
+
+/*
+** Put a length of the form of a token's: the bytes of 255 and the last byte
+** following the 15 in the token.
+*/
+static unsigned char * PutLength(unsigned char * d, int len)
+{
+    for (len -= 15; len >= 255; len -= 255)
+        *d++ = 255;
+    *d++ = (unsigned char)len;
+    return d;
+}
+
+/*
+** Put a sequence of lit literals from s, followed by a match of len bytes at
+** offset back when len isn't 0.
+** Return where it ends, or NULL when it doesn't fit before end.
+*/
+static unsigned char * PutSequence(unsigned char * d, unsigned char * end,
+    const unsigned char * s, int lit, int offset, int len)
+{
+    unsigned char * token = d;
+
+    if (end - d < 1 + lit / 255 + 1 + lit + 2 + len / 255 + 1)
+        return NULL;
+
+    *d++ = (unsigned char)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15)
+        d = PutLength(d, lit);
+    memcpy(d, s, lit);
+    d += lit;
+    if (!len)
+        return d;
+
+    *d++ = (unsigned char)(offset & 0xFF);
+    *d++ = (unsigned char)(offset >> 8);
+    len -= MIN_MATCH;
+    *token |= (unsigned char)(len < 15 ? len : 15);
+    if (len >= 15)
+        d = PutLength(d, len);
+    return d;
+}
+
+int LZ_Compress(const char * src, int len, char * dst, int cap)
+{
+    const unsigned char * s = (const unsigned char *)src;
+    unsigned char * d = (unsigned char *)dst;
+    unsigned char * end = d + cap;
+    int table[1 << HASH_BITS];  //the last position of each hash, -1 for none
+    int anchor = 0;             //where the literals not put yet start
+    int i = 0;
+
+    memset(table, 0xFF, sizeof(table));
+    while (i < len - MF_LIMIT) {
+        unsigned int v = Read32(s + i);
+        int h = Hash(v);
+        int ref = table[h];
+        int m;
+
+        table[h] = i;
+        if (ref < 0 || i - ref > MAX_OFFSET || Read32(s + ref) != v) {
+            i++;
+            continue;
+        }
+
+        for (m = i + MIN_MATCH; m < len - LAST_LITERALS && s[m] == s[ref + m - i]; m++);
+        d = PutSequence(d, end, s + anchor, i - anchor, i - ref, m - i);
+        if (!d)
+            return 0;
+        i = anchor = m;
+    }
+
+    d = PutSequence(d, end, s + anchor, len - anchor, 0, 0);
+    return d ? (int)(d - (unsigned char *)dst) : 0;
+}
+
+/*
+** Get a length of the form of a token's following the 15 in it.
+** Return the length, or -1 when it runs beyond end.
+*/
+static int GetLength(const unsigned char ** s, const unsigned char * end)
+{
+    int len = 15;
+    unsigned char b;
+
+    do {
+        if (*s >= end)
+            return -1;
+        b = *(*s)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+int LZ_Decompress(const char * src, int len, char * dst, int cap)
+{
+    const unsigned char * s = (const unsigned char *)src;
+    const unsigned char * send = s + len;
+    unsigned char * d = (unsigned char *)dst;
+    unsigned char * dend = d + cap;
+
+    while (s < send) {
+        int token = *s++;
+        int lit = token >> 4;
+        int offset;
+        int mlen;
+
+        if (lit == 15 && (lit = GetLength(&s, send)) < 0)
+            return -1;
+        if (lit > send - s || lit > dend - d)
+            return -1;
+        memcpy(d, s, lit);
+        d += lit;
+        s += lit;
+        if (s == send)
+            break;  //the last sequence
+
+        if (send - s < 2)
+            return -1;
+        offset = s[0] | (s[1] << 8);
+        s += 2;
+        if (!offset || offset > d - (unsigned char *)dst)
+            return -1;
+        mlen = token & 15;
+        if (mlen == 15 && (mlen = GetLength(&s, send)) < 0)
+            return -1;
+        mlen += MIN_MATCH;
+        if (mlen > dend - d)
+            return -1;
+        for (; mlen > 0; mlen--, d++)   //a match may overlap its own output
+            *d = *(d - offset);
+    }
+    return (int)(d - (unsigned char *)dst);
+}
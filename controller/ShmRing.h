@@ -0,0 +1,107 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef __SHMRING_H__
+#define __SHMRING_H__
+
+/*
+** A ring of messages in shared memory, through which a debuggee streams SP
+** messages to a controller on the same host without a send per message. The
+** controller creates it under a name (a file under /dev/shm) and tells the
+** debuggee the name in the handshake, and the debuggee maps it.
+** The ring is a header followed by size bytes, size being a power of 2, where
+** each message is its length as 4 bytes in host order followed by its bytes,
+** wrapping around at the end. head and tail are byte counts which only grow,
+** taken modulo size. The debuggee, the only producer, puts a message at head
+** and moves head; whoever takes the message at tail moves tail by a
+** compare-and-swap, i.e. the controller once it has copied the message out, or
+** the debuggee when it drops the oldest message to make room, and the copy of
+** one which fails to move tail is thrown away.
+** The controller sleeps on head by a futex when the ring is empty, setting
+** waiting, and only then does the debuggee make a system call to wake it.
+** Any process of the user may write the mapping, so nothing in it is trusted:
+** the size is checked and copied to ShmRing when the ring is created or mapped,
+** and only the copy is used, positions are taken modulo it, and lengths are
+** checked against it.
+** Linux only; elsewhere the ring can't be created or mapped.
+*/
+typedef struct
+{
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    volatile unsigned int waiting;
+    unsigned int size;
+} RingHeader;
+
+typedef struct
+{
+    RingHeader * header;
+    char * data;
+    size_t mapped;
+    unsigned int size;  //of the data, copied from the header
+} ShmRing;
+
+#define SR_MIN_SIZE (64 * 1024)
+#define SR_MAX_SIZE (1024 * 1024 * 1024)
+
+/*
+** Create a ring of size bytes under name, rounding size up to a power of 2.
+** Return 0 when success, or -1 when it fails.
+*/
+int SR_Create(ShmRing * ring, const char * name, unsigned int size);
+
+/*
+** Map the ring created under name.
+** Return 0 when success, or -1 when it fails.
+*/
+int SR_Open(ShmRing * ring, const char * name);
+
+/*
+** Remove the name of a ring. Those who mapped it keep it until they close it.
+*/
+void SR_Unlink(const char * name);
+
+void SR_Close(ShmRing * ring);
+
+/*
+** Put a message of len bytes, dropping the oldest messages to make room when
+** dropOldest is nonzero.
+** Return how many messages were dropped, or -1 when the message itself is
+** dropped, as there's no room for it. When tail or the length at tail is
+** invalid, all in the ring is dropped, which counts as one.
+*/
+int SR_Put(ShmRing * ring, const void * data, unsigned int len, int dropOldest);
+
+/*
+** Take the message at tail into buf, which holds cap bytes.
+** Return the length of the message, or 0 when the ring is empty, or -1 when
+** the length at tail is invalid, in which case all in the ring is dropped.
+*/
+int SR_Get(ShmRing * ring, char * buf, unsigned int cap);
+
+/*
+** Sleep until a message is put or ms milliseconds pass.
+*/
+void SR_Wait(ShmRing * ring, int ms);
+
+#endif
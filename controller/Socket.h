@@ -32,6 +32,8 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>     //sockaddr_un
+#include <sys/stat.h>   //stat
 #include <netinet/in.h> //sockaddr_in
 #include <arpa/inet.h>  //inet_addr
 #include <unistd.h>     //close
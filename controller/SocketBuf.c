@@ -22,6 +22,7 @@
 ******************************************************************************/
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "SocketBuf.h"
@@ -29,11 +30,33 @@
 void SB_Init(SocketBuf * sb, SOCKET s)
 {
     sb->s = s;
+    sb->pbeg = 0;
+    sb->pend = 0;
     sb->eobL = 0;
     sb->eobR = 0;
 //    sb->tempLen = 0;
     sb->end = 0;
     sb->err = 0;
+    sb->binary = 0;
+    sb->left = 0;
+    sb->more = 0;
+    sb->intern = 0;
+    sb->strs = NULL;
+    sb->lens = NULL;
+    sb->nstrs = 0;
+    sb->ref = NULL;
+    sb->compressed = 0;
+    sb->zbeg = 0;
+    sb->zend = 0;
+    sb->mem = NULL;
+    sb->memLen = 0;
+}
+
+void SB_InitMemory(SocketBuf * sb, const char * data, int len)
+{
+    SB_Init(sb, INVALID_SOCKET);
+    sb->mem = data;
+    sb->memLen = len;
 }
 
 static void SB_Reset(SocketBuf * sb)
@@ -43,41 +66,385 @@ static void SB_Reset(SocketBuf * sb)
     sb->err = 0;
 }
 
-static int RecvData(SOCKET s, char * buf, int len)
+/*
+** Receive at most len bytes into buf, from the socket or from memory.
+** Return the bytes received, or 0 when the peer closes the connection or there
+** are no more in memory, or SOCKET_ERROR when a socket IO error happens.
+*/
+static int Receive(SocketBuf * sb, char * buf, int len)
+{
+    if (!sb->mem)
+        return recv(sb->s, buf, len, 0);
+    if (len > sb->memLen)
+        len = sb->memLen;
+    memcpy(buf, sb->mem, len);
+    sb->mem += len;
+    sb->memLen -= len;
+    return len;
+}
+
+/*
+** Receive exactly len bytes into buf.
+** Return 0 when success, or -1 when a socket IO error happens or the peer
+** closes the connection.
+*/
+static int RecvAll(SocketBuf * sb, char * buf, int len)
+{
+    while (len > 0) {
+        int l = Receive(sb, buf, len);
+        if (l == SOCKET_ERROR || l == 0)
+            return -1;
+        buf += l;
+        len -= l;
+    }
+    return 0;
+}
+
+/*
+** Receive the next block of a compressed stream into zbuf, decompressing it
+** when it's compressed.
+** Return 0 when success, or -1 when a socket IO error happens or the block is
+** invalid.
+*/
+static int RecvBlock(SocketBuf * sb)
+{
+    char block[LZ_BLOCK_MAX];
+    unsigned int h = 0;
+    unsigned char ch;
+    int shift = 0;
+    int len;
+
+    do {
+        if (shift > 28 || RecvAll(sb, (char *)&ch, 1) < 0)
+            return -1;
+        h |= (unsigned int)(ch & 0x7F) << shift;
+        shift += 7;
+    } while (ch & 0x80);
+
+    len = (int)(h >> 1);
+    if (len > LZ_BLOCK_MAX)
+        return -1;
+    if (!(h & 1)) {
+        sb->zend = len;
+        return RecvAll(sb, sb->zbuf, len);
+    }
+    if (RecvAll(sb, block, len) < 0)
+        return -1;
+    sb->zend = LZ_Decompress(block, len, sb->zbuf, LZ_BLOCK_MAX);
+    return sb->zend < 0 ? -1 : 0;
+}
+
+/*
+** Make sure there are staged bytes in pbuf, receiving more when it's empty.
+** Return 0 when success, or -1 when a socket IO error happens or the peer
+** closes the connection.
+*/
+static int Stage(SocketBuf * sb)
+{
+    if (sb->pbeg == sb->pend && sb->compressed) {
+        int l;
+        while (sb->zbeg == sb->zend) {
+            sb->zbeg = 0;
+            sb->zend = 0;
+            if (RecvBlock(sb) < 0)
+                return -1;
+        }
+        l = sb->zend - sb->zbeg;
+        if (l > SOCKET_BUF_CAP)
+            l = SOCKET_BUF_CAP;
+        memcpy(sb->pbuf, sb->zbuf + sb->zbeg, l);
+        sb->zbeg += l;
+        sb->pbeg = 0;
+        sb->pend = l;
+    }
+    else if (sb->pbeg == sb->pend) {
+        int l = Receive(sb, sb->pbuf, SOCKET_BUF_CAP);
+        if (l == SOCKET_ERROR || l == 0)
+            return -1;
+        sb->pbeg = 0;
+        sb->pend = l;
+    }
+    return 0;
+}
+
+static int RecvData(SocketBuf * sb, char * buf, int len)
 {
-    char * p = buf;
-    int avail = len;
     int received = 0;
 
-    while (avail > 0) {
-        int l = recv(s, p, avail, 0);
-        if (l == SOCKET_ERROR)
+    while (received < len) {
+        const char * p;
+        const char * eof;
+        int l;
+
+        if (Stage(sb) < 0)
             return -1;
 
+        p = sb->pbuf + sb->pbeg;
+        l = sb->pend - sb->pbeg;
+        if (l > len - received)
+            l = len - received;
+        eof = (const char *)memchr(p, 0, l);
+        if (eof)
+            l = eof - p + 1;
+
+        memcpy(buf + received, p, l);
+        sb->pbeg += l;
         received += l;
-        if (p[l - 1] == 0)
+        if (eof)
             return received - 1;    //Return payload length, excluding the EOF character.
-
-        p += l;
-        avail -= l;
     }
 
     return len; //Buffer is full, but EOF is not reached.
 }
 
+/*
+** Read the len bytes following a header into a new string of the string table.
+** Return 0 when success, or -1 when a socket IO error happens or no memory.
+*/
+static int AddString(SocketBuf * sb, int len)
+{
+    char ** strs;
+    int * lens;
+    char * str;
+    int n = 0;
+
+    //The table holds 64 strings at first and doubles when it's full.
+    if (!sb->nstrs || (sb->nstrs >= 64 && !(sb->nstrs & (sb->nstrs - 1)))) {
+        int size = sb->nstrs ? sb->nstrs * 2 : 64;
+        strs = (char **)realloc(sb->strs, size * sizeof(char *));
+        if (!strs)
+            return -1;
+        sb->strs = strs;
+        lens = (int *)realloc(sb->lens, size * sizeof(int));
+        if (!lens)
+            return -1;
+        sb->lens = lens;
+    }
+
+    str = (char *)malloc(len ? len : 1);
+    if (!str)
+        return -1;
+    while (n < len) {
+        int l;
+        if (Stage(sb) < 0) {
+            free(str);
+            return -1;
+        }
+        l = sb->pend - sb->pbeg;
+        if (l > len - n)
+            l = len - n;
+        memcpy(str + n, sb->pbuf + sb->pbeg, l);
+        sb->pbeg += l;
+        n += l;
+    }
+    sb->strs[sb->nstrs] = str;
+    sb->lens[sb->nstrs++] = len;
+    return 0;
+}
+
+/*
+** Read the header of the next frame of a binary flow, and, for a word of the
+** string table, take it from there.
+** Return 1 when a frame follows, 0 when the EOF is reached, or -1 when a socket
+** IO error happens or the header is invalid.
+*/
+static int RecvHeader(SocketBuf * sb)
+{
+    unsigned int h = 0;
+    unsigned char ch;
+    int shift = 0;
+    int kind;
+
+    do {
+        if (shift > 28 || Stage(sb) < 0)
+            return -1;
+        ch = (unsigned char)sb->pbuf[sb->pbeg++];
+        h |= (unsigned int)(ch & 0x7F) << shift;
+        shift += 7;
+    } while (ch & 0x80);
+
+    if (!h)
+        return 0;
+    sb->ref = NULL;
+    if (!sb->intern) {
+        sb->left = (int)((h - 1) >> 1);
+        sb->more = (int)((h - 1) & 1);
+        return 1;
+    }
+
+    kind = (int)((h - 1) & 3);
+    sb->left = (int)((h - 1) >> 2);
+    sb->more = kind == 1;
+    if (kind == 2 && AddString(sb, sb->left) < 0)
+        return -1;
+    if (kind >= 2) {
+        int id = kind == 2 ? sb->nstrs - 1 : sb->left;
+        if (id >= sb->nstrs)
+            return -1;
+        sb->ref = sb->strs[id];
+        sb->left = sb->lens[id];
+    }
+    return 1;
+}
+
+/*
+** Get the bytes of the current frame at hand, from the string table or from
+** those staged.
+** Return how many there are with *data set to them, or -1 when a socket IO
+** error happens.
+*/
+static int Peek(SocketBuf * sb, const char ** data)
+{
+    int l;
+
+    if (sb->ref) {
+        *data = sb->ref;
+        return sb->left;
+    }
+    if (Stage(sb) < 0)
+        return -1;
+    *data = sb->pbuf + sb->pbeg;
+    l = sb->pend - sb->pbeg;
+    return l < sb->left ? l : sb->left;
+}
+
+/*
+** Take l bytes got by Peek off the current frame.
+*/
+static void Skip(SocketBuf * sb, int l)
+{
+    if (sb->ref)
+        sb->ref += l;
+    else
+        sb->pbeg += l;
+    sb->left -= l;
+}
+
+/*
+** Read a word of a binary flow into buf, which holds cap bytes. The part of the
+** word beyond cap is dropped.
+** Return 1 with the length of the word put in buf set in *len, 0 when the EOF
+** is reached, -1 when a socket IO error happens, or -2 when the word is too long.
+*/
+static int RecvWord(SocketBuf * sb, char * buf, int cap, int * len)
+{
+    int rc = RecvHeader(sb);
+
+    *len = 0;
+    if (rc <= 0)
+        return rc;
+
+    while (1) {
+        while (sb->left > 0) {
+            const char * d;
+            int l = Peek(sb, &d);
+            int c;
+
+            if (l < 0)
+                return -1;
+            c = cap - *len;
+            if (c >= l)
+                c = l;
+            else
+                rc = -2;
+            memcpy(buf + *len, d, c);
+            *len += c;
+            Skip(sb, l);
+        }
+        if (!sb->more)
+            break;
+        if (RecvHeader(sb) <= 0)
+            return -1;  //The EOF can't break a word.
+    }
+    return rc;
+}
+
+/*
+** SB_Read for a binary flow: read one word, or all the words left when bytes is
+** SB_R_LEFT, into the left buffer, each followed by an end-of-line character.
+*/
+static int ReadWords(SocketBuf * sb, int bytes)
+{
+    char * p = sb->lbuf;
+    int cap = SOCKET_BUF_CAP - 1;   //Leave room for the terminating zero.
+    int len;
+    int rc;
+
+    do {
+        rc = RecvWord(sb, p, cap > 1 ? cap - 1 : 0, &len);
+        if (rc == -1)
+            return -1;
+        if (rc == 0) {
+            sb->end = 1;
+            break;
+        }
+        if (cap > 0) {
+            p += len;
+            *p++ = '\n';
+            cap -= len + 1;
+        }
+    } while (bytes == SB_R_LEFT);
+
+    *p = 0;
+    return p - sb->lbuf;
+}
+
+int SB_ReadRaw(SocketBuf * sb, char * buf, int len)
+{
+    const char * d;
+    int l;
+
+    if (sb->binary) {
+        while (sb->left == 0) {
+            if (RecvHeader(sb) <= 0) {
+                sb->err = 1;
+                return -1;
+            }
+        }
+        l = Peek(sb, &d);
+        if (l < 0) {
+            sb->err = 1;
+            return -1;
+        }
+        if (l > len)
+            l = len;
+        memcpy(buf, d, l);
+        Skip(sb, l);
+        return l;
+    }
+
+    if (Stage(sb) < 0) {
+        sb->err = 1;
+        return -1;
+    }
+    l = sb->pend - sb->pbeg;
+    if (l > len)
+        l = len;
+    memcpy(buf, sb->pbuf + sb->pbeg, l);
+    sb->pbeg += l;
+    return l;
+}
+
 int SB_Read(SocketBuf * sb, int bytes)
 {
     int rc;
     SB_Reset(sb);
 
+    if (sb->binary) {
+        rc = ReadWords(sb, bytes);
+        if (rc < 0)
+            sb->err = 1;
+        return rc;
+    }
+
     if (bytes == SB_R_LEFT) {
-        rc = RecvData(sb->s, sb->lbuf, SOCKET_BUF_CAP);
+        rc = RecvData(sb, sb->lbuf, SOCKET_BUF_CAP);
     }
     else if (bytes == SB_R_RIGHT) {
-        rc = RecvData(sb->s, sb->rbuf, SOCKET_BUF_CAP);
+        rc = RecvData(sb, sb->rbuf, SOCKET_BUF_CAP);
     }
     else {
-        rc = RecvData(sb->s, sb->lbuf, bytes < SOCKET_BUF_CAP ? bytes : SOCKET_BUF_CAP);
+        rc = RecvData(sb, sb->lbuf, bytes < SOCKET_BUF_CAP ? bytes : SOCKET_BUF_CAP);
     }
 
     if (rc < 0) {
@@ -112,6 +479,19 @@ int SB_ReadAndParse(SocketBuf * sb, const char * separaters, UserParser parser,
     int tempLen = 0;    //length of available str in temp
 
     SB_Reset(sb);
+    if (sb->binary) {
+        //Words come in frames, so separaters don't matter. A word is ended by
+        //0 for the parser to take numbers out of it as in text flows.
+        while ((rc = RecvWord(sb, temp, SOCKET_BUF_TMP - 1, &tempLen)) == 1) {
+            temp[tempLen] = 0;
+            rc = parser(userdata, temp, tempLen);
+            if (rc < 0)
+                return rc;
+        }
+        if (rc == -1)
+            sb->err = 1;
+        return rc;
+    }
     while (st != EOF && st != ERR) {
         switch (st) {
             case EOB: {
@@ -25,6 +25,7 @@
 #define __SOCKETBUF_H__
 
 #include "Socket.h"
+#include "Lz.h"
 
 #ifndef SOCKET_BUF_CAP
 #define SOCKET_BUF_CAP 1024
@@ -38,8 +39,34 @@
 #error "Socket temp buf can not be greater than a single socket buf."
 #endif
 
+/*
+** Data received from the socket is staged in pbuf and handed out flow by flow,
+** so that bytes following an EOF (the beginning of the next flow, when the
+** remote sends several flows back to back) are kept for the next read rather
+** than lost.
+** A flow is either text, where words are separated by end-of-line characters
+** and the flow ends with a terminating zero(EOF), or, when binary is set,
+** binary, where each word comes in one or more frames, each led by a header
+** which is an unsigned LEB128 varint of ((length << 1) | more) + 1, where more
+** tells that the word continues in the next frame, and a zero byte in place of
+** a header is the EOF. The functions below handle both, presenting the words of
+** a binary flow as if they were separated by end-of-line characters.
+** When intern is set as well, the header is ((length << 2) | kind) + 1: kind 0
+** is a frame ending its word, 1 a frame with the word continued in the next, 2
+** a whole word to add to the session string table under the next id (from 0
+** on), and 3 a whole word given only by its id in place of length. Words from
+** the table are handed out as if they had come in full.
+** When compressed is set, the bytes received come in blocks, each led by an
+** unsigned LEB128 varint of (length << 1) | compressed, and a block compressed
+** by LZ is decompressed into zbuf before its bytes are staged.
+** A SocketBuf may also read a message held in memory, e.g. one taken from the
+** shared ring (see ShmRing.h), in place of the socket; see SB_InitMemory.
+*/
 typedef struct {
     SOCKET s;
+    char pbuf[SOCKET_BUF_CAP];
+    int pbeg;
+    int pend;
     char lbuf[SOCKET_BUF_CAP];
     int eobL;
     char rbuf[SOCKET_BUF_CAP];
@@ -48,10 +75,32 @@ typedef struct {
 //    int tempLen;
     int end;
     int err;
+    int binary;     //binary flows?
+    int left;       //bytes left in the current frame of a binary flow
+    int more;       //does the current word continue in the next frame?
+    int intern;     //may words of binary flows come from the string table?
+    char ** strs;   //the session string table, grown by realloc as needed
+    int * lens;     //lengths of the strings in strs
+    int nstrs;
+    const char * ref;   //the rest of the current word when it's from strs
+    int compressed; //are the bytes received in blocks?
+    char zbuf[LZ_BLOCK_MAX];
+    int zbeg;
+    int zend;
+    const char * mem;   //the bytes left of a message in memory, when not NULL
+    int memLen;
 } SocketBuf;
 
 void SB_Init(SocketBuf * sb, SOCKET s);
 
+/*
+** Init sb to read the len bytes at data rather than a socket, running out of
+** bytes being taken as the peer closing the connection. The flags telling how
+** to read flows, binary, intern and compressed, are set by the caller as for a
+** socket.
+*/
+void SB_InitMemory(SocketBuf * sb, const char * data, int len);
+
 #define SB_R_LEFT -2
 #define SB_R_RIGHT -3
 /*
@@ -61,6 +110,14 @@ void SB_Init(SocketBuf * sb, SOCKET s);
 */
 int SB_Read(SocketBuf * sb, int bytes);
 
+/*
+** Read at most len raw bytes, regardless of EOF characters. In a binary flow
+** the bytes are the content of the current word, or of the next one when no
+** word is being read, and the frame headers are skipped.
+** Return the bytes read. When a socket IO error happens, -1 is returned.
+*/
+int SB_ReadRaw(SocketBuf * sb, char * buf, int len);
+
 /*
 ** Should return 0 on success and a negative on error.
 */
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
 
 #ifdef OS_WIN
@@ -35,6 +36,7 @@
 
 #ifdef OS_LINUX
 #include <unistd.h> //access, getcwd
+#include <sys/time.h> //gettimeofday
 #define _MAX_PATH PATH_MAX
 #define _access access
 
@@ -61,7 +63,32 @@ static char * _fullpath(char * absPath, const char * relPath, size_t maxLen)
                 strcpy(absPath + len, relPath);
                 ret = absPath;
             }
+            else
+                ret = 0;
+        }
+    }
+    if (ret) { //drop "." and ".." components as _fullpath does on Windows
+        char * src = absPath;
+        char * dst = absPath;
+        while (*src) {
+            size_t n;
+            while (*src == '/')
+                src++;
+            n = strcspn(src, "/");
+            if (n == 2 && src[0] == '.' && src[1] == '.') {
+                while (dst > absPath && *--dst != '/')
+                    ;
+            }
+            else if (n && !(n == 1 && src[0] == '.')) {
+                *dst++ = '/';
+                memmove(dst, src, n);
+                dst += n;
+            }
+            src += n;
         }
+        if (dst == absPath)
+            *dst++ = '/';
+        *dst = 0;
     }
     return ret;
 }
@@ -69,10 +96,15 @@ static char * _fullpath(char * absPath, const char * relPath, size_t maxLen)
 #endif
 
 #include "Protocol.h"
+#include "SendQueue.h"
+#include "Reconnect.h"
 
 static const luaL_Reg entries[] = { {0, 0} };
 
 static void hook(lua_State *L, lua_Debug *ar);
+static void indexChunk(lua_State * L, lua_Debug * ar);
+static void indexStack(lua_State * L);
+static void resetHandles(lua_State * L);
 
 typedef enum
 {
@@ -82,20 +114,160 @@ typedef enum
     RUN
 } CMD;
 
+/*
+** Levels of tables under package.loaded looked in for functions of a file set
+** breakpoints in, see indexLoaded: modules and globals, and the tables in them.
+*/
+#define LOADED_DEPTH 3
+
+/*
+** Samples of watch expressions are taken on count hook ticks. The tick interval
+** (in VM instructions) is adjusted on every tick so that the hook fires about
+** SAMPLE_TICKS times per shortest sampling interval, which keeps the overhead
+** proportional to the sampling rate rather than to the executed code.
+*/
+#define SAMPLE_TICKS 4
+#define SAMPLE_INIT_COUNT 1000
+#define SAMPLE_MIN_COUNT 100
+#define SAMPLE_MAX_COUNT 10000000
+
+/*
+** Taken samples are sent in one SP message when SAMPLE_BATCH records are pending
+** or the oldest pending record is SAMPLE_BATCH_MS milliseconds old.
+*/
+#define SAMPLE_BATCH 64
+#define SAMPLE_BATCH_MS 500
+
+/*
+** Indices of fields in a sample record stored in the "samples" table.
+*/
+#define SAMPLE_FN 1
+#define SAMPLE_INTERVAL 2
+#define SAMPLE_DUE 3
+#define SAMPLE_EXPR 4
+#define SAMPLE_OVERRUNS 5
+
+/*
+** A sample is evaluated under the budget of an evaluated expression (see
+** EXEC_BUDGET), and dropped once it goes over it SAMPLE_MAX_OVERRUNS times in a
+** row.
+*/
+#define SAMPLE_MAX_OVERRUNS 3
+
+/*
+** An evaluated expression is aborted after EXEC_BUDGET VM instructions. Up to
+** EXEC_CACHE_MAX compiled expressions are kept, keyed by their text.
+*/
+#define EXEC_BUDGET 1000000
+#define EXEC_CACHE_MAX 64
+
+/*
+** w lists tables in a value down to at most W_MAX_DEPTH levels, and stops
+** listing them once W_EXPAND_BUDGET bytes are in the response unless told
+** another budget.
+*/
+#define W_MAX_DEPTH 32
+#define W_EXPAND_BUDGET (64 * 1024)
+
+/*
+** In flows of version 7 a run of at least W_PACK_MIN numbers in the sequence of
+** a table paged for w is sent packed, W_PACK_WORD numbers to a word.
+*/
+#define W_PACK_MIN 8
+#define W_PACK_WORD 64
+
+/*
+** w ... r<depth> copies at most DF_SNAP_MAX entries for the snapshot df diffs
+** against, and df stops listing changes once DF_BUDGET bytes are in the
+** response.
+*/
+#define DF_SNAP_MAX (1024 * 1024)
+#define DF_BUDGET (64 * 1024)
+
+/*
+** Unless told otherwise, q keeps Q_TOP entries for the top, at most Q_MAX_TOP,
+** and looks at Q_BUDGET entries of a table at most.
+*/
+#define Q_TOP 10
+#define Q_MAX_TOP 100
+#define Q_BUDGET 1000000
+
+/*
+** Unless told otherwise, ss leaves out the values of a frame beyond
+** SS_FRAME_BUDGET bytes, and the frames beyond SS_TOTAL_BUDGET bytes.
+*/
+#define SS_FRAME_BUDGET (16 * 1024)
+#define SS_TOTAL_BUDGET (256 * 1024)
+
+/*
+** Max number of matches rs sends for a search.
+*/
+#define RS_MAX_MATCHES 1000
+
+/*
+** Indices of fields in a display record stored in the "displays" table. The
+** level is 0 for a watch path, which is held as the expression.
+*/
+#define DISPLAY_LEVEL 1
+#define DISPLAY_EXPR 2
+
+/*
+** Max length of the watch path of a display.
+*/
+#define DISPLAY_MAX_PATH 1024
+
 typedef struct
 {
     SOCKET s;
     CMD cmd;    //last cmd from remote controller
     int level;  //relative stack level pertaining to the last "step over" command
+    int samples;        //number of registered samples
+    int lastSampleId;   //id of the last registered sample
+    int minInterval;    //the shortest sampling interval, in milliseconds
+    int tickCount;      //VM instructions between two count hook ticks
+    double lastTick;    //time of the last count hook tick
+    double nextSample;  //time when the earliest sample is due
+    int pending;        //number of records in the "sampleBuf" table
+    double firstPending;//time when the oldest pending record was taken
+    FlowReader reader;  //reader of commands
+    int exprs;          //number of compiled expressions in the "exprs" table
+    int lastDisplayId;  //id of the last registered display
+    int stackDepth;     //stack frames sent with each break
+    int version;        //of the protocol agreed on with the remote controller
+    const char * lastSource;//source of the main function checked last, NULL after a call
+    lua_State * L;      //the state loading the library, hooked again on reconnecting
 } DebuggerInfo;
 
+/*
+** Return the wall clock time in milliseconds.
+*/
+static double getMilliseconds()
+{
+#ifdef OS_WIN
+    FILETIME ft;
+    ULARGE_INTEGER t;
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return (double)(t.QuadPart - 116444736000000000ULL) / 10000.0;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+#endif
+}
+
 static int onGC(lua_State * L)
 {
     DebuggerInfo * info = (DebuggerInfo *)lua_touserdata(L, -1);
+    RC_Stop();
     if (info->s != INVALID_SOCKET) {
+        SQ_Drain();
+        SQ_Stop();
         SendQuit(info->s);
         closesocket(info->s);
     }
+    FR_Free(&info->reader);
     return 0;
 }
 
@@ -105,17 +277,28 @@ __declspec(dllexport)
 int luaopen_RLdb(lua_State * L)
 {
     SOCKET s;
+    FlowReader reader;
     DebuggerInfo * info;
     unsigned short port;
     const char * addr;
-    char env[64];
+    const char * path = NULL;
+    Agreement agreed;
+    char env[128];
+    char peer[144];
     char * p;
 
     //read config and set up connection with a remote controller
     p = getenv("REMOTE_LDB");
-    if (p) {    //REMOTE_LDB's value is sth. like "192.168.0.1:6688".
-        strncpy(env, p, 63);
-        env[63] = 0;
+    if (p && !strncmp(p, "unix:", 5)) {   //or like "unix:/tmp/rldb.sock"
+        strncpy(env, p + 5, 127);
+        env[127] = 0;
+        path = env;
+        port = 0;
+        addr = NULL;
+    }
+    else if (p) {    //REMOTE_LDB's value is sth. like "192.168.0.1:6688".
+        strncpy(env, p, 127);
+        env[127] = 0;
         p = strchr(env, ':');
         if (p && p != env) {
             *p++ = 0;
@@ -139,12 +322,28 @@ int luaopen_RLdb(lua_State * L)
         addr = "127.0.0.1";
     }
 
-    if ((s = Connect(addr, port)) == INVALID_SOCKET) {
-        fprintf(stderr, "Socket or protocol error!\nFailed connecting remote controller at %s:%d.\n",
-            addr, (int)port);
+    if (path)
+        sprintf(peer, "unix:%s", path);
+    else
+        sprintf(peer, "%s:%d", addr, (int)port);
+    if ((s = path ? ConnectLocal(path) : Connect(addr, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "Socket or protocol error!\nFailed connecting remote controller at %s.\n",
+            peer);
+        return 0;
+    }
+
+    FR_Init(&reader, s);
+    if (Handshake(&reader, 0, &agreed) < 0) {
+        fprintf(stderr, "Socket or protocol error!\nFailed handshaking with remote controller at %s.\n",
+            peer);
+        FR_Free(&reader);
+        closesocket(s);
         return 0;
     }
 
+    Agree(&agreed);
+    RC_SetPeer(addr, port, path);
+
     //store debugger info into a table
     lua_pushliteral(L, "debugger");
     lua_newtable(L);
@@ -153,11 +352,70 @@ int luaopen_RLdb(lua_State * L)
     lua_newtable(L);
     lua_rawset(L, -3);
 
+    lua_pushliteral(L, "pending");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "chunks");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "sources");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "indexed");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "__mode");
+    lua_pushliteral(L, "k");
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "samples");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "sampleBuf");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "exprs");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "displays");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    //Keep the state loading the library alive, should it be a coroutine.
+    lua_pushliteral(L, "L");
+    lua_pushthread(L);
+    lua_rawset(L, -3);
+
+    resetHandles(L);
+
     lua_pushliteral(L, "info");
     info = (DebuggerInfo *)lua_newuserdata(L, sizeof(DebuggerInfo));
     info->s = s;
     info->cmd = STEP;
     info->level = 0;
+    info->samples = 0;
+    info->lastSampleId = 0;
+    info->minInterval = 0;
+    info->tickCount = SAMPLE_INIT_COUNT;
+    info->lastTick = 0;
+    info->nextSample = 0;
+    info->pending = 0;
+    info->firstPending = 0;
+    info->reader = reader;
+    info->exprs = 0;
+    info->lastDisplayId = 0;
+    info->stackDepth = 0;
+    info->version = agreed.version;
+    info->lastSource = NULL;
+    info->L = L;
     lua_newtable(L);
     lua_pushliteral(L, "__gc");
     lua_pushcfunction(L, onGC);
@@ -167,6 +425,13 @@ int luaopen_RLdb(lua_State * L)
 
     lua_rawset(L, LUA_REGISTRYINDEX);
 
+    //Chunks already running, e.g. the one requiring this library, will never
+    //be called again, so index them now.
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    indexStack(L);
+    lua_pop(L, 1);
+
     luaL_register(L, "robert.debugger", entries);
     lua_sethook(L, hook, LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET, 0);
     return 1;
@@ -174,11 +439,87 @@ int luaopen_RLdb(lua_State * L)
 
 static int prompt(lua_State *L, lua_Debug * ar, DebuggerInfo * info);
 static int checkBreakPoint(lua_State *L, lua_Debug * ar, DebuggerInfo * info);
+static void pushSourcePath(lua_State * L, lua_Debug * ar);
+static void checkChunk(lua_State * L, lua_Debug * ar, DebuggerInfo * info);
+static int sortKey(lua_State * L);
+static int tick(lua_State * L, DebuggerInfo * info);
+
+/*
+** Install the hook with the events the debugger currently needs: line, call
+** and return events when lineHook is set, i.e. when stepping or breakpoints
+** exist, and count events when samples are registered. When nothing is needed,
+** the hook is removed.
+*/
+static void setHook(lua_State * L, DebuggerInfo * info, int lineHook)
+{
+    int mask = lineHook ? LUA_MASKLINE | LUA_MASKCALL | LUA_MASKRET : 0;
+    if (info->samples)
+        mask |= LUA_MASKCOUNT;
+    lua_sethook(L, hook, mask, info->tickCount);
+}
+
+/*
+** Go detached once the connection to the remote controller is lost: remove the
+** hook from L and from the state loading the library, drop what's bound to the
+** connection, keep the rest of the session, and connect again in the
+** background (see Reconnect.h).
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+static void detach(lua_State * L, DebuggerInfo * info)
+{
+    lua_sethook(L, hook, 0, 0);
+    lua_sethook(info->L, hook, 0, 0);
+    SQ_Stop();
+    closesocket(info->s);
+    info->s = INVALID_SOCKET;
+    FR_Free(&info->reader);
+
+    lua_pushliteral(L, "sampleBuf");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    info->pending = 0;
+
+    if (RC_Start(info->L, hook) < 0)
+        fprintf(stderr, "Failed reconnecting remote controller!\n");
+}
+
+/*
+** Attach to the connection made while detached, if there is one, put in effect
+** what's agreed on in its handshake, and break at the next line, where the
+** remote controller syncs breakpoints. Listings by changes start over, as the
+** controller has no views of them. With no connection, L is a coroutine still
+** having the hook from before the connection was lost, and drops it.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+static void attach(lua_State * L, DebuggerInfo * info)
+{
+    Agreement agreed;
+    SOCKET s = RC_Take(&info->reader, &agreed);
+
+    if (s == INVALID_SOCKET) {
+        lua_sethook(L, hook, 0, 0);
+        return;
+    }
+    RC_Stop();  //after which the thread no longer sets the hook of info->L
+    Agree(&agreed);
+    info->s = s;
+    info->version = agreed.version;
+    info->cmd = STEP;
+    info->level = 0;
+    info->lastTick = getMilliseconds();
+
+    lua_pushliteral(L, "digests");
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    setHook(info->L, info, 1);
+    setHook(L, info, 1);
+}
 
 void hook(lua_State * L, lua_Debug * ar)
 {
     int event = ar->event;
     int top = lua_gettop(L);
+    int rc = 0;
     DebuggerInfo * info;
 
     lua_pushliteral(L, "debugger");
@@ -188,9 +529,16 @@ void hook(lua_State * L, lua_Debug * ar)
     info = lua_touserdata(L, -1);
     lua_pop(L, 1);
 
+    //While detached, the hook is left on coroutines hooked before, or installed
+    //on the state loading the library once a connection is made.
+    if (info->s == INVALID_SOCKET) {
+        attach(L, info);
+        lua_pop(L, 1);
+        return;
+    }
+
     if (event == LUA_HOOKLINE) {
         CMD cmd;
-        int rc = 0;
 
         cmd = info->cmd;
 
@@ -210,26 +558,25 @@ void hook(lua_State * L, lua_Debug * ar)
         else if (cmd == RUN) {
             rc = checkBreakPoint(L, ar, info);
         }
-
-        //If a socket IO error or a protocol error happened, stop debugging
-        //without informing the remote Controller.
-        if (rc < 0) {
-            lua_sethook(L, hook, 0, 0);
-            closesocket(info->s);
-            info->s = INVALID_SOCKET;
-        }
+    }
+    else if (event == LUA_HOOKCOUNT) {
+        rc = tick(L, info);
     }
     else {
-        assert(event != LUA_HOOKCOUNT);
-
         if (event == LUA_HOOKCALL) {
             info->level++;
+            info->lastSource = NULL;    //A new chunk runs only by a call.
         }
         else if (event == LUA_HOOKRET || event == LUA_HOOKTAILRET) {
             if (info->level)
                 info->level--;
         }
     }
+
+    //If a socket IO error or a protocol error happened, go detached
+    //without informing the remote Controller.
+    if (rc < 0)
+        detach(L, info);
     lua_pop(L, 1);
     assert(top == lua_gettop(L));
 }
@@ -243,962 +590,4382 @@ void hook(lua_State * L, lua_Debug * ar)
 */
 int checkBreakPoint(lua_State * L, lua_Debug * ar, DebuggerInfo * info)
 {
-    int breakpoint;
-    char path[_MAX_PATH + 1];
+    int breakpoint = 0;
 
     lua_getinfo(L, "Sl", ar);
-    if (_fullpath(path, ar->short_src, _MAX_PATH)) {
-#ifdef OS_WIN
-        _strlwr(path);
-#endif
-
+    if (*ar->what == 'm' && ar->source != info->lastSource)
+        checkChunk(L, ar, info);
+    pushSourcePath(L, ar);
+    if (lua_isstring(L, -1)) {
         lua_pushliteral(L, "breakpoints");
-        lua_rawget(L, -2);
-        lua_pushstring(L, path);
+        lua_rawget(L, -3);
+        lua_pushvalue(L, -2);
         lua_rawget(L, -2);
         if (lua_istable(L, -1)) {
             lua_rawgeti(L, -1, ar->currentline);
             breakpoint = lua_isnil(L, -1) ? 0 : 1;
             lua_pop(L, 1);
         }
-        else
-            breakpoint = 0;
         lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
 
-        if (breakpoint) {
-            info->level = 0;
-            return prompt(L, ar, info);
-        }
+    if (breakpoint) {
+        info->level = 0;
+        return prompt(L, ar, info);
     }
     return 0;
 }
 
-static int getCmd(SOCKET s, char * buf, int bufLen, char ** argv);
-static int listLocals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
-static int listUpVars(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
-static int listGlobals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
-static int printStack(lua_State * L, SOCKET s);
-static int watch(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
-static int exec(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
-static int setBreakPoint(lua_State * L, const char * src, char * argv[], int argc, int del, SOCKET s);
-static int listBreakPoints(lua_State * L, SOCKET s);
-static int watchMemory(char * argv[], int argc, SOCKET s);
+/*
+** Get the full path of file into path, which can hold _MAX_PATH + 1 characters.
+** On Windows, the path is in lower case.
+** Return 1 when success, or 0 when the path can't be resolved.
+*/
+static int getFullPath(const char * file, char * path)
+{
+    if (!_fullpath(path, file, _MAX_PATH))
+        return 0;
+#ifdef OS_WIN
+    _strlwr(path);
+#endif
+    return 1;
+}
 
 /*
-** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
-** unchanged after call, but the "debugger" table may be changed.
-** Return -1 when a socket io error happens, or 0 when succeed.
+** Push the full path of the file where the function described by ar (with
+** "S" info) is defined, or false if it's not defined in a file. Resolved
+** paths are cached in the "sources" table by chunk name, so that a file
+** path is resolved only once rather than on every line.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
 */
-int prompt(lua_State * L, lua_Debug * ar, DebuggerInfo * info)
+static void pushSourcePath(lua_State * L, lua_Debug * ar)
 {
-    SOCKET s = info->s;
-    CMD cmd;
-    int top = lua_gettop(L);
+    lua_pushliteral(L, "sources");
+    lua_rawget(L, -2);
+    lua_pushstring(L, ar->source);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        char path[_MAX_PATH + 1];
 
-    lua_getinfo(L, "nSl", ar);
-    if (SendBreak(s, ar->short_src, ar->currentline) < 0) {
-        fprintf(stderr, "Socket error!\n");
-        return -1;
+        lua_pop(L, 1);
+        lua_pushstring(L, ar->source);
+        if (ar->source[0] == '@' && getFullPath(ar->source + 1, path))
+            lua_pushstring(L, path);
+        else
+            lua_pushboolean(L, 0);
+        lua_pushvalue(L, -1);
+        lua_insert(L, -3);
+        lua_rawset(L, -4);
     }
+    lua_remove(L, -2);
+}
 
-    while (1) {
-        char buf[PROT_MAX_CMD_LEN];
-        char * argv[PROT_MAX_ARGS];
-        int argc;
-        char * pCmd;
-        char ** pArgv;
-        int rc;
+typedef struct
+{
+    char * buf;
+    size_t len;
+    size_t cap;
+} DumpBuf;
 
-        assert(lua_istable(L, -1));
-        argc = getCmd(s, buf, PROT_MAX_CMD_LEN, argv);
-        if (argc == -1) {
-            fprintf(stderr, "Socket or protocol error!\n");
-            return -1;
-        }
-        if (argc == 0) {
-            if (SendErr(s, "Invalid command!") < 0) {
-                fprintf(stderr, "Socket error!\n");
-                return -1;
-            }
-            continue;
-        }
-        pCmd = argv[0];
-        argc--;
-        pArgv = argv + 1;
+static int dumpWriter(lua_State * L, const void * p, size_t sz, DumpBuf * db)
+{
+    if (db->len + sz > db->cap) {
+        size_t cap = db->cap ? db->cap : 4096;
+        char * buf;
+        while (cap < db->len + sz)
+            cap *= 2;
+        buf = (char *)realloc(db->buf, cap);
+        if (!buf)
+            return 1;
+        db->buf = buf;
+        db->cap = cap;
+    }
+    memcpy(db->buf + db->len, p, sz);
+    db->len += sz;
+    return 0;
+}
 
-        if (!strcmp(pCmd, "s")) {
-            cmd = STEP;
-            break;
+typedef struct
+{
+    const char * p;
+    const char * end;
+} Undump;
+
+static int skipBytes(Undump * u, size_t n)
+{
+    if ((size_t)(u->end - u->p) < n)
+        return 0;
+    u->p += n;
+    return 1;
+}
+
+static int readInt(Undump * u, int * n)
+{
+    if ((size_t)(u->end - u->p) < sizeof(int))
+        return 0;
+    memcpy(n, u->p, sizeof(int));
+    u->p += sizeof(int);
+    return *n >= 0;
+}
+
+static int skipString(Undump * u)
+{
+    size_t n;
+    if ((size_t)(u->end - u->p) < sizeof(size_t))
+        return 0;
+    memcpy(&n, u->p, sizeof(size_t));
+    u->p += sizeof(size_t);
+    return skipBytes(u, n);
+}
+
+/*
+** Walk a dumped function prototype and its nested ones, and add the lines
+** in their line info into the table on top of L.
+** Return 1 when success, or 0 when the dump is malformed.
+*/
+static int collectLines(lua_State * L, Undump * u, int * maxLine)
+{
+    int i, n;
+
+    //source, linedefined, lastlinedefined, nups, numparams, is_vararg, maxstacksize
+    if (!skipString(u) || !skipBytes(u, 2 * sizeof(int) + 4))
+        return 0;
+    //code
+    if (!readInt(u, &n) || !skipBytes(u, (size_t)n * 4))
+        return 0;
+    //constants
+    if (!readInt(u, &n))
+        return 0;
+    for (i = 0; i < n; i++) {
+        int t;
+        if (u->p >= u->end)
+            return 0;
+        t = *u->p++;
+        if (t == LUA_TBOOLEAN) {
+            if (!skipBytes(u, 1))
+                return 0;
         }
-        else if (!strcmp(pCmd, "o")) {
-            cmd = OVER;
-            break;
+        else if (t == LUA_TNUMBER) {
+            if (!skipBytes(u, sizeof(lua_Number)))
+                return 0;
         }
-        else if (!strcmp(pCmd, "f")) {
-            cmd = FINISH;
-            break;
+        else if (t == LUA_TSTRING) {
+            if (!skipString(u))
+                return 0;
         }
-        else if (!strcmp(pCmd, "r")) {
-            cmd = RUN;
-            lua_pushliteral(L, "breakpoints");
-            lua_rawget(L, -2);
-            lua_pushnil(L);
-            if (!lua_next(L, -2)) { //When no breakpoints exists, disable the hook.
-                lua_sethook(L, hook, 0, 0);
-                lua_pop(L, 1);
-            }
-            else
-                lua_pop(L, 3);
-            break;
+        else if (t != LUA_TNIL) {
+            return 0;
         }
-        else if (!strcmp(pCmd, "ll")) {
-            rc = listLocals(L, ar, pArgv, argc, s);
-        }
-        else if (!strcmp(pCmd, "lu")) {
-            rc = listUpVars(L, ar, pArgv, argc, s);
-        }
-        else if (!strcmp(pCmd, "lg")) {
-            rc = listGlobals(L, ar, pArgv, argc, s);
-        }
-        else if (!strcmp(pCmd, "w")) {
-            rc = watch(L, ar, pArgv, argc, s);
-        }
-        else if (!strcmp(pCmd, "ps")) {
-            rc = printStack(L, s);
-        }
-        else if (!strcmp(pCmd, "sb")) {
-            rc = setBreakPoint(L, ar->short_src, pArgv, argc, 0, s);
-        }
-        else if (!strcmp(pCmd, "db")) {
-            rc = setBreakPoint(L, ar->short_src, pArgv, argc, 1, s);
-        }
-        else if (!strcmp(pCmd, "lb")) {
-            rc = listBreakPoints(L, s);
-        }
-        else if (!strcmp(pCmd, "e")) {
-            rc = exec(L, ar, pArgv, argc, s);
-        }
-        else if (!strcmp(pCmd, "m")) {
-            rc = watchMemory(pArgv, argc, s);
+    }
+    //nested prototypes
+    if (!readInt(u, &n))
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (!collectLines(L, u, maxLine))
+            return 0;
+    }
+    //line info
+    if (!readInt(u, &n))
+        return 0;
+    for (i = 0; i < n; i++) {
+        int line;
+        if (!readInt(u, &line))
+            return 0;
+        lua_pushboolean(L, 1);
+        lua_rawseti(L, -2, line);
+        if (line > *maxLine)
+            *maxLine = line;
+    }
+    //local variables
+    if (!readInt(u, &n))
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (!skipString(u) || !skipBytes(u, 2 * sizeof(int)))
+            return 0;
+    }
+    //upvalue names
+    if (!readInt(u, &n))
+        return 0;
+    for (i = 0; i < n; i++) {
+        if (!skipString(u))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+** Given the main function of a chunk on top of L, push a table whose keys are
+** all lines holding code in the chunk, including nested functions not created
+** yet. Index 0 holds the last such line. The lines are taken from the line info
+** in the chunk's dump, since the Lua API exposes active lines only for
+** functions that exist. Return 1 when success; otherwise return 0 and push
+** nothing, e.g. when the dump format isn't the one of Lua 5.1.
+*/
+static int pushActiveLines(lua_State * L)
+{
+    static const char header[] = { 0x1b, 'L', 'u', 'a', 0x51, 0, 1,
+        sizeof(int), sizeof(size_t), 4, sizeof(lua_Number) };
+    DumpBuf db = { NULL, 0, 0 };
+    Undump u;
+    int maxLine = 0;
+    int ok = 0;
+
+    if (!lua_dump(L, (lua_Writer)dumpWriter, &db) && db.len > 12
+        && !memcmp(db.buf, header, sizeof(header))) {
+        u.p = db.buf + 12;
+        u.end = db.buf + db.len;
+        lua_newtable(L);
+        ok = collectLines(L, &u, &maxLine);
+        if (ok) {
+            lua_pushinteger(L, maxLine);
+            lua_rawseti(L, -2, 0);
         }
         else {
-            rc = SendErr(s, "Invalid command!");
+            lua_pop(L, 1);
         }
+    }
+    free(db.buf);
+    return ok;
+}
 
-        if (rc < 0) {
-            fprintf(stderr, "Socket or protocol error!\n");
-            return -1;
+/*
+** Return the first line holding code at or after line, in the active lines
+** table on top of L, or 0 when there's none.
+*/
+static int snapLine(lua_State * L, int line)
+{
+    int maxLine;
+
+    lua_rawgeti(L, -1, 0);
+    maxLine = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    for (; line <= maxLine; line++) {
+        int active;
+        lua_rawgeti(L, -1, line);
+        active = !lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if (active)
+            return line;
+    }
+    return 0;
+}
+
+/*
+** Set or clear debugger[name][path][line]. The table for path is created when
+** needed and removed when it gets empty.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static void setLine(lua_State * L, const char * name, const char * path, int line, int on)
+{
+    lua_pushstring(L, name);
+    lua_rawget(L, -2);
+    lua_pushstring(L, path);
+    lua_rawget(L, -2);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        if (!on) {
+            lua_pop(L, 1);
+            return;
         }
+        lua_newtable(L);
+        lua_pushstring(L, path);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
     }
+    if (on)
+        lua_pushboolean(L, 1);
+    else
+        lua_pushnil(L);
+    lua_rawseti(L, -2, line);
 
-    info->cmd = cmd;
-    assert(top == lua_gettop(L));
-    return 0;
+    if (!on) { //check if the path table is empty
+        lua_pushnil(L);
+        if (!lua_next(L, -2)) { //remove the entry if it's empty
+            lua_pushstring(L, path);
+            lua_pushnil(L);
+            lua_rawset(L, -4);
+        }
+        else
+            lua_pop(L, 2);
+    }
+    lua_pop(L, 2);
 }
 
 /*
-** Get command from via socket s and put it in buf; then extract arguments in
-** buf, which are separated by one single space. The result argument array is
-** stored in argv, which can hold PROT_MAX_ARGS arguments at most. The actual number
-** of arguments is returned. If a socket IO error happens, -1 is returned.
+** Index a chunk seen for the first time: record the lines holding code in the
+** "chunks" table, and bind the pending breakpoints of the file by moving each
+** to the first line holding code at or after it. A pending breakpoint with no
+** code after it is dropped.
+** The main function of the chunk is on top of L, and under it is the "debugger"
+** table stored in LUA_REGISTRYINDEX. ar holds "S" info of the function. L stays
+** unchanged after call.
 */
-int getCmd(SOCKET s, char * buf, int bufLen, char ** argv)
+void indexChunk(lua_State * L, lua_Debug * ar)
 {
-    int argc = 0;
-    char * end;
-    char * p = buf;
-    int received = RecvCmd(s, buf, bufLen);
-    if (received < 0) {
-        return -1;
+    const char * path;
+    int n, i;
+
+    lua_pushliteral(L, "indexed");
+    lua_rawget(L, -3);
+    lua_pushvalue(L, -2);
+    lua_rawget(L, -2);
+    if (!lua_isnil(L, -1)) {
+        lua_pop(L, 2);
+        return;
     }
-    end = buf + received;
-    *end = 0;
+    lua_pop(L, 1);
+    lua_pushvalue(L, -2);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
 
-    while (p < end && argc < PROT_MAX_ARGS) {
-        while (*p == ' ' && p < end)
-            ++p;
+    lua_pushvalue(L, -2);   //the "debugger" table
+    pushSourcePath(L, ar);
+    if (!lua_isstring(L, -1)) {
+        lua_pop(L, 2);
+        return;
+    }
+    path = lua_tostring(L, -1);
 
-        if (*p != '"') {
-            argv[argc++] = p;
-            while (*p != ' ' && p < end)
-                ++p;
-            if (p == end)
-                break;
-        }
-        else {
-            argv[argc++] = ++p;
-            p = strchr(p, '"');
-            if (!p)
-                return -2;  //The end '"' is not found!
+    //Merge the lines into those of the chunks loaded from the same file before.
+    lua_pushvalue(L, -3);
+    if (!pushActiveLines(L)) {
+        lua_pop(L, 3);
+        return;
+    }
+    lua_remove(L, -2);
+    lua_pushliteral(L, "chunks");
+    lua_rawget(L, -4);
+    lua_pushvalue(L, -3);
+    lua_rawget(L, -2);
+    if (lua_istable(L, -1)) {
+        int maxLine;
+        lua_rawgeti(L, -1, 0);
+        maxLine = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        while (lua_next(L, -4)) {
+            if (lua_tointeger(L, -2) == 0 && lua_tointeger(L, -1) < maxLine) {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
         }
-        *p++ = 0;
+        lua_replace(L, -3);
     }
-    return argc;
+    else {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -3);
+        lua_pushvalue(L, -3);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+    //Now the stack is: debugger, path, lines
+
+    lua_pushliteral(L, "pending");
+    lua_rawget(L, -4);
+    lua_pushvalue(L, -3);
+    lua_rawget(L, -2);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 5);
+        return;
+    }
+    n = sortKey(L);
+    lua_pushvalue(L, -6);
+    for (i = 1; i <= n; i++) {
+        int line, bound;
+        lua_rawgeti(L, -2, i);
+        line = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        lua_pushvalue(L, -5);
+        bound = snapLine(L, line);
+        lua_pop(L, 1);
+        setLine(L, "breakpoints", path, line, 0);
+        if (bound)
+            setLine(L, "breakpoints", path, bound, 1);
+    }
+    lua_pop(L, 3);
+    lua_pushvalue(L, -3);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 4);
 }
 
 /*
-** Print one line text containing a variable name and its value into sb.
-** Variable value is on top of L. L stays unchanged after call.
+** Index the chunk whose main function runs at ar, which holds "S" info. Chunks
+** are spotted on the lines of main functions seen by the line hook rather than
+** on calls, so calls and the lines of other functions don't pay for it, and
+** pending breakpoints are still bound before a line of the chunk runs. Callers
+** skip the check while the source is the one checked last, which is forgotten
+** on every call, as a new chunk can't run without one.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
 */
-static void printVar(SocketBuf * sb, const char * name, lua_State * L)
+void checkChunk(lua_State * L, lua_Debug * ar, DebuggerInfo * info)
 {
-    int type = lua_type(L, -1);
+    lua_getinfo(L, "f", ar);
+    indexChunk(L, ar);
+    lua_pop(L, 1);
+    info->lastSource = ar->source;
+}
 
-    if (name)
-        SB_Print(sb, "%s\n", name);
+/*
+** Index the chunks whose main functions are on the stack.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+void indexStack(lua_State * L)
+{
+    lua_Debug ar;
+    int i = 0;
 
-    switch(type) {
-        case LUA_TSTRING: {
-            int len;
-            const char * str = lua_tolstring(L, -1, (unsigned int *)&len);
-            int truncLen = len > PROT_MAX_STR_LEN ? PROT_MAX_STR_LEN : len;
-            SB_Print(sb, "s0x%08x:%d:%d:%Q\n", str, len, truncLen,
-                str, truncLen); //%Q requires two arguments: buf and length
-            break;
-        }
-        case LUA_TNUMBER: {
-            /*
-            ** LUA_NUMBER may be double or integer, So a runtime check may be required.
-            ** Otherwise SB_Print may be crashed.
-            */
-            SB_Print(sb, "n%N\n", lua_tonumber(L, -1));
-            break;
-        }
-        case LUA_TTABLE: {
-            SB_Print(sb, "t0x%08x\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TFUNCTION: {
-            SB_Print(sb, "f0x%08x\n", lua_topointer(L, -1));
-            break;
-        }
-        case LUA_TUSERDATA: {
-            SB_Print(sb, "u0x%08x\n", lua_touserdata(L, -1));
-            break;
-        }
-        case LUA_TLIGHTUSERDATA: {
-            SB_Print(sb, "U0x%08x\n", lua_touserdata(L, -1));
-            break;
-        }
-        case LUA_TBOOLEAN: {
-            SB_Print(sb, "b%d\n", lua_toboolean(L, -1) ? 1 : 0);
-            break;
+    while (lua_getstack(L, i++, &ar)) {
+        lua_getinfo(L, "Sf", &ar);
+        if (!strcmp(ar.what, "main"))
+            indexChunk(L, &ar);
+        lua_pop(L, 1);
+    }
+}
+
+/*
+** Look for a Lua function defined in the file at path among the values of the
+** table on top of L and of the tables in it, down to depth levels of tables.
+** Tables looked in are put in the table at seen. debugger is the index of the
+** "debugger" table stored in LUA_REGISTRYINDEX.
+** Return 1 when one is found. L stays unchanged after call.
+*/
+static int findFunction(lua_State * L, int debugger, int seen, const char * path, int depth)
+{
+    int found = 0;
+
+    lua_pushvalue(L, -1);
+    lua_rawget(L, seen);
+    if (depth < 1 || !lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, seen);
+
+    lua_pushnil(L);
+    while (!found && lua_next(L, -2)) {
+        if (lua_isfunction(L, -1) && !lua_iscfunction(L, -1)) {
+            lua_Debug ar;
+            lua_pushvalue(L, -1);
+            lua_getinfo(L, ">S", &ar);
+            lua_pushvalue(L, debugger);
+            pushSourcePath(L, &ar);
+            found = lua_isstring(L, -1) && !strcmp(lua_tostring(L, -1), path);
+            lua_pop(L, 2);
         }
-        case LUA_TTHREAD: {
-            SB_Print(sb, "d0x%08x\n", lua_topointer(L, -1));
-            break;
+        else if (lua_istable(L, -1)) {
+            found = findFunction(L, debugger, seen, path, depth - 1);
         }
-        case LUA_TNIL: {
-            SB_Print(sb, "l\n");
+        lua_pop(L, 1);
+    }
+    if (found)
+        lua_pop(L, 1);  //the key left by lua_next
+    return found;
+}
+
+/*
+** Index the file at path if it's loaded though its main function was never
+** seen, e.g. a module required while the hook had no line events, which has
+** returned since. It's taken as loaded when a function defined in it is found
+** among the values reachable from package.loaded, globals included, down to
+** LOADED_DEPTH levels of tables; the file is then compiled again, not run, for
+** the lines of all its functions.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static void indexLoaded(lua_State * L, const char * path)
+{
+    int top = lua_gettop(L);
+    int found = 0;
+
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    if (lua_istable(L, -1)) {
+        lua_newtable(L);
+        lua_insert(L, -2);
+        found = findFunction(L, top, top + 1, path, LOADED_DEPTH);
+    }
+    lua_settop(L, top);
+
+    if (found && !luaL_loadfile(L, path)) {
+        lua_Debug ar;
+        lua_pushvalue(L, -1);
+        lua_getinfo(L, ">S", &ar);
+        indexChunk(L, &ar);
+    }
+    lua_settop(L, top);
+}
+
+static int getCmd(DebuggerInfo * info, char ** argv, char ** body);
+static int listLocals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int listUpVars(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int listGlobals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int printStack(lua_State * L, SOCKET s);
+static int snapStack(lua_State * L, char * argv[], int argc, SOCKET s);
+static int watch(lua_State * L, lua_Debug * ar, char * argv[], int argc, DebuggerInfo * info);
+static int diff(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int query(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int exec(lua_State * L, lua_Debug * ar, char * argv[], int argc, char * body, DebuggerInfo * info);
+static int setBreakPoint(lua_State * L, const char * src, char * argv[], int argc, int del, SOCKET s);
+static int setBreakPoints(lua_State * L, const char * src, char * argv[], int argc, char * body, SOCKET s);
+static int listBreakPoints(lua_State * L, SOCKET s);
+static int watchMemory(char * argv[], int argc, SOCKET s);
+static int readString(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s);
+static int setSample(lua_State * L, DebuggerInfo * info, char * argv[], int argc);
+static int delSample(lua_State * L, DebuggerInfo * info, char * argv[], int argc);
+static int listSamples(lua_State * L, SOCKET s);
+static int setQueue(char * argv[], int argc, SOCKET s);
+static int flushSamples(lua_State * L, DebuggerInfo * info);
+static int setDisplay(lua_State * L, DebuggerInfo * info, char * argv[], int argc, char * body);
+static int delDisplay(lua_State * L, DebuggerInfo * info, char * argv[], int argc);
+static int setDisplayStack(DebuggerInfo * info, char * argv[], int argc);
+static int listDisplays(lua_State * L, SOCKET s);
+
+typedef struct
+{
+    lua_State * L;
+    lua_Debug * ar;
+    DebuggerInfo * info;
+} Args_br;
+
+static int br(Args_br * args, SocketBuf * sb);
+
+/*
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+** Return -1 when a socket io error happens, or 0 when succeed.
+*/
+int prompt(lua_State * L, lua_Debug * ar, DebuggerInfo * info)
+{
+    SOCKET s = info->s;
+    CMD cmd;
+    Args_br args;
+    int lineHook = 1;
+    int top = lua_gettop(L);
+
+    //Samples taken so far go out before the break.
+    if ((info->pending && flushSamples(L, info) < 0) || SQ_Drain() < 0) {
+        fprintf(stderr, "Socket error!\n");
+        return -1;
+    }
+
+    lua_getinfo(L, "nSl", ar);
+    if (*ar->what == 'm' && ar->source != info->lastSource)
+        checkChunk(L, ar, info);
+    args.L = L;
+    args.ar = ar;
+    args.info = info;
+    if (SendBreak(s, ar->short_src, ar->currentline, (Writer)br, &args) < 0) {
+        fprintf(stderr, "Socket error!\n");
+        return -1;
+    }
+
+    while (1) {
+        char * argv[PROT_MAX_ARGS];
+        char * body;
+        int argc;
+        char * pCmd;
+        char ** pArgv;
+        int rc;
+
+        assert(lua_istable(L, -1));
+        argc = getCmd(info, argv, &body);
+        if (argc == -1) {
+            fprintf(stderr, "Socket or protocol error!\n");
+            return -1;
+        }
+        if (argc == 0) {
+            if (SendErr(s, "Invalid command!") < 0) {
+                fprintf(stderr, "Socket error!\n");
+                return -1;
+            }
+            continue;
+        }
+        pCmd = argv[0];
+        argc--;
+        pArgv = argv + 1;
+
+        if (!strcmp(pCmd, "s")) {
+            cmd = STEP;
+            break;
+        }
+        else if (!strcmp(pCmd, "o")) {
+            cmd = OVER;
+            break;
+        }
+        else if (!strcmp(pCmd, "f")) {
+            cmd = FINISH;
+            break;
+        }
+        else if (!strcmp(pCmd, "r")) {
+            cmd = RUN;
+            lua_pushliteral(L, "breakpoints");
+            lua_rawget(L, -2);
+            lua_pushnil(L);
+            if (!lua_next(L, -2)) { //When no breakpoints exists, disable the line hook.
+                lineHook = 0;
+                lua_pop(L, 1);
+            }
+            else
+                lua_pop(L, 3);
+            break;
+        }
+        else if (!strcmp(pCmd, "ll")) {
+            rc = listLocals(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "lu")) {
+            rc = listUpVars(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "lg")) {
+            rc = listGlobals(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "w")) {
+            rc = watch(L, ar, pArgv, argc, info);
+        }
+        else if (!strcmp(pCmd, "df")) {
+            rc = diff(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "q")) {
+            rc = query(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "ps")) {
+            rc = printStack(L, s);
+        }
+        else if (!strcmp(pCmd, "ss")) {
+            rc = snapStack(L, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "sb")) {
+            rc = setBreakPoint(L, ar->short_src, pArgv, argc, 0, s);
+        }
+        else if (!strcmp(pCmd, "db")) {
+            rc = setBreakPoint(L, ar->short_src, pArgv, argc, 1, s);
+        }
+        else if (!strcmp(pCmd, "bb")) {
+            rc = setBreakPoints(L, ar->short_src, pArgv, argc, body, s);
+        }
+        else if (!strcmp(pCmd, "lb")) {
+            rc = listBreakPoints(L, s);
+        }
+        else if (!strcmp(pCmd, "e")) {
+            rc = exec(L, ar, pArgv, argc, body, info);
+        }
+        else if (!strcmp(pCmd, "m")) {
+            rc = watchMemory(pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "rs")) {
+            rc = readString(L, ar, pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "st")) {
+            rc = setSample(L, info, pArgv, argc);
+        }
+        else if (!strcmp(pCmd, "dt")) {
+            rc = delSample(L, info, pArgv, argc);
+        }
+        else if (!strcmp(pCmd, "lt")) {
+            rc = listSamples(L, s);
+        }
+        else if (!strcmp(pCmd, "tq")) {
+            rc = setQueue(pArgv, argc, s);
+        }
+        else if (!strcmp(pCmd, "sd")) {
+            rc = setDisplay(L, info, pArgv, argc, body);
+        }
+        else if (!strcmp(pCmd, "dd")) {
+            rc = delDisplay(L, info, pArgv, argc);
+        }
+        else if (!strcmp(pCmd, "ld")) {
+            rc = listDisplays(L, s);
+        }
+        else if (!strcmp(pCmd, "ds")) {
+            rc = setDisplayStack(info, pArgv, argc);
+        }
+        else {
+            rc = SendErr(s, "Invalid command!");
+        }
+
+        if (rc < 0) {
+            fprintf(stderr, "Socket or protocol error!\n");
+            return -1;
+        }
+    }
+
+    //The table paged by w is let go, and so are the values given handles.
+    lua_pushliteral(L, "pager");
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "anchors");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+
+    info->cmd = cmd;
+    info->lastTick = getMilliseconds();
+    setHook(L, info, lineHook);
+    assert(top == lua_gettop(L));
+    return 0;
+}
+
+/*
+** Get command via info->reader, which holds it until the next call; then
+** extract arguments in the first line, which are separated by one single space. The
+** result argument array is stored in argv, which can hold PROT_MAX_ARGS
+** arguments at most. The rest lines, if any, are the command body pointed by
+** *body, or *body is NULL. The actual number of arguments is returned. If a
+** socket IO error happens, -1 is returned.
+*/
+int getCmd(DebuggerInfo * info, char ** argv, char ** body)
+{
+    int argc = 0;
+    char * end;
+    char * p;
+    int received = RecvFlow(&info->reader, &p);
+    if (received < 0) {
+        return -1;
+    }
+    end = p + received;
+    *end = 0;
+    *body = strchr(p, '\n');
+    if (*body) {
+        end = *body;
+        *end = 0;
+        ++*body;
+    }
+
+    while (p < end && argc < PROT_MAX_ARGS) {
+        while (*p == ' ' && p < end)
+            ++p;
+
+        if (*p != '"') {
+            argv[argc++] = p;
+            while (*p != ' ' && p < end)
+                ++p;
+            if (p == end)
+                break;
+        }
+        else {
+            argv[argc++] = ++p;
+            p = strchr(p, '"');
+            if (!p)
+                return -2;  //The end '"' is not found!
+        }
+        *p++ = 0;
+    }
+    return argc;
+}
+
+/*
+** Replace the handle tables with empty ones: "handles" maps handles, which are
+** small integers, to tables, functions, userdata and threads sent to the
+** controller, and "handleIds" maps them back. Both are weak, so that a value
+** keeps its handle as long as it lives and listings sent at different breaks
+** agree on it. The last handle given is kept in handles[0], and handles are
+** never given again. "anchors" holds the values given handles strongly, by
+** their handles, until the script resumes, so that a value listed only as a
+** result or a temporary isn't collected before the controller looks it up.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+void resetHandles(lua_State * L)
+{
+    lua_pushliteral(L, "handles");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "__mode");
+    lua_pushliteral(L, "v");
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "handleIds");
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushliteral(L, "__mode");
+    lua_pushliteral(L, "k");
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "anchors");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+}
+
+/*
+** Return the handle of the value on top of L, giving it one if it has none,
+** and anchor the value until the script resumes.
+** L stays unchanged after call.
+*/
+static int handleOf(lua_State * L)
+{
+    int id;
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "handleIds");
+    lua_rawget(L, -2);
+    lua_pushvalue(L, -3);
+    lua_rawget(L, -2);
+    id = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    if (!id) {
+        lua_pushliteral(L, "handles");
+        lua_rawget(L, -3);
+        lua_rawgeti(L, -1, 0);
+        id = lua_tointeger(L, -1) + 1;
+        lua_pop(L, 1);
+        lua_pushinteger(L, id);
+        lua_rawseti(L, -2, 0);
+        lua_pushvalue(L, -4);
+        lua_rawseti(L, -2, id);
+        lua_pop(L, 1);
+
+        lua_pushvalue(L, -3);
+        lua_pushinteger(L, id);
+        lua_rawset(L, -3);
+    }
+    lua_pushliteral(L, "anchors");
+    lua_rawget(L, -3);
+    lua_pushvalue(L, -4);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 3);
+    return id;
+}
+
+/*
+** Print one line text containing a variable name and its value into sb.
+** Variable value is on top of L. L stays unchanged after call.
+** Tables, functions, userdata and threads come with their handles, by which
+** the controller can refer to them in the fields of w. The name is interned.
+*/
+static void printVar(SocketBuf * sb, const char * name, lua_State * L)
+{
+    int type = lua_type(L, -1);
+
+    if (name) {
+        SB_Intern(sb, 1);
+        SB_Print(sb, "%s\n", name);
+        SB_Intern(sb, 0);
+    }
+
+    switch(type) {
+        case LUA_TSTRING: {
+            size_t len;
+            const char * str = lua_tolstring(L, -1, &len);
+            int truncLen = len > PROT_MAX_STR_LEN ? PROT_MAX_STR_LEN : (int)len;
+            SB_Print(sb, "s%p:%d:%d:%Q\n", str, (int)len, truncLen,
+                str, truncLen); //%Q requires two arguments: buf and length
+            break;
+        }
+        case LUA_TNUMBER: {
+            /*
+            ** LUA_NUMBER may be double or integer, So a runtime check may be required.
+            ** Otherwise SB_Print may be crashed.
+            */
+            SB_Print(sb, "n%N\n", lua_tonumber(L, -1));
+            break;
+        }
+        case LUA_TTABLE: {
+            SB_Print(sb, "t%p:%d\n", lua_topointer(L, -1), handleOf(L));
+            break;
+        }
+        case LUA_TFUNCTION: {
+            SB_Print(sb, "f%p:%d\n", lua_topointer(L, -1), handleOf(L));
+            break;
+        }
+        case LUA_TUSERDATA: {
+            SB_Print(sb, "u%p:%d\n", lua_touserdata(L, -1), handleOf(L));
+            break;
+        }
+        case LUA_TLIGHTUSERDATA: {
+            SB_Print(sb, "U%p\n", lua_touserdata(L, -1));
+            break;
+        }
+        case LUA_TBOOLEAN: {
+            SB_Print(sb, "b%d\n", lua_toboolean(L, -1) ? 1 : 0);
+            break;
+        }
+        case LUA_TTHREAD: {
+            SB_Print(sb, "d%p:%d\n", lua_topointer(L, -1), handleOf(L));
+            break;
+        }
+        case LUA_TNIL: {
+            SB_Print(sb, "l\n");
+            break;
+        }
+    }
+}
+
+/*
+** Print the key on top of L as printVar does. String keys, which recur across
+** tables, are interned.
+*/
+static void printKey(SocketBuf * sb, lua_State * L)
+{
+    SB_Intern(sb, lua_type(L, -1) == LUA_TSTRING);
+    printVar(sb, NULL, L);
+    SB_Intern(sb, 0);
+}
+
+/*
+** A filter of listings, applied before anything is sent. It's given by the
+** options, each at most once:
+** ~<pattern>   names starting with pattern, or, when it has any of the magic
+**              characters ^$*+?.([%-, names matching it by string.find
+** :<types>     values of the types given by the letters of printVar, e.g. :tf
+** #<count>     at most count entries
+** Names of w are the keys of the table; keys neither strings nor numbers don't
+** match any pattern.
+*/
+typedef struct
+{
+    const char * pattern;   //NULL for any name
+    size_t patternLen;
+    int magic;              //is pattern a Lua pattern, rather than a prefix?
+    const char * types;     //NULL for any type
+    int count;              //0 for no limit
+    int passed;             //entries passed so far
+} Filter;
+
+/*
+** Push string.find, or return 0 with L unchanged when there's none.
+*/
+static int pushFind(lua_State * L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    if (lua_istable(L, -1)) {
+        lua_getfield(L, -1, "string");
+        lua_replace(L, -2);
+        if (lua_istable(L, -1)) {
+            lua_getfield(L, -1, "find");
+            lua_replace(L, -2);
+        }
+    }
+    if (lua_isfunction(L, -1))
+        return 1;
+    lua_pop(L, 1);
+    return 0;
+}
+
+/*
+** Match name against the pattern of f. L stays unchanged after call.
+*/
+static int matchName(lua_State * L, Filter * f, const char * name, size_t len)
+{
+    int rc;
+
+    if (!f->magic)
+        return len >= f->patternLen && !memcmp(name, f->pattern, f->patternLen);
+    if (!lua_checkstack(L, LUA_MINSTACK) || !pushFind(L))
+        return 0;
+    lua_pushlstring(L, name, len);
+    lua_pushlstring(L, f->pattern, f->patternLen);
+    if (lua_pcall(L, 2, 1, 0)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    rc = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    return rc;
+}
+
+/*
+** Read the options of a filter from argv[i] on into f.
+** Return the index of the first argument that isn't an option, or -1 when an
+** option is invalid, or its pattern is a malformed Lua pattern.
+*/
+static int parseFilter(lua_State * L, Filter * f, char * argv[], int argc, int i)
+{
+    f->pattern = NULL;
+    f->patternLen = 0;
+    f->magic = 0;
+    f->types = NULL;
+    f->count = 0;
+    f->passed = 0;
+
+    for (; i < argc; i++) {
+        char * p = argv[i];
+        if (p[0] == '~' && p[1] && !f->pattern) {
+            f->pattern = p + 1;
+            f->patternLen = strlen(f->pattern);
+            f->magic = strpbrk(f->pattern, "^$*+?.([%-") != NULL;
+        }
+        else if (p[0] == ':' && p[1] && !f->types) {
+            if (p[strspn(p + 1, "sntfuUbdl") + 1])
+                return -1;
+            f->types = p + 1;
+        }
+        else if (p[0] == '#' && !f->count) {
+            f->count = strtol(p + 1, &p, 10);
+            if (*p || f->count < 1)
+                return -1;
+        }
+        else {
+            break;
+        }
+    }
+
+    if (f->magic) {
+        if (!pushFind(L))
+            return -1;
+        lua_pushliteral(L, "");
+        lua_pushstring(L, f->pattern);
+        if (lua_pcall(L, 2, 0, 0)) {
+            lua_pop(L, 1);
+            return -1;
+        }
+    }
+    return i;
+}
+
+/*
+** Has f passed as many entries as it takes? Never when f is NULL.
+*/
+static int filterFull(Filter * f)
+{
+    return f && f->count && f->passed >= f->count;
+}
+
+/*
+** Does the entry of name, whose value is at vidx of L, pass f? Passed entries
+** are counted. Every entry passes when f is NULL. L stays unchanged after call.
+*/
+static int passFilter(lua_State * L, Filter * f, const char * name, size_t len, int vidx)
+{
+    static const char letters[] = "lbUnstfud";   //by LUA_TNIL to LUA_TTHREAD
+
+    if (!f)
+        return 1;
+    if (filterFull(f)
+        || (f->types && !strchr(f->types, letters[lua_type(L, vidx) - LUA_TNIL]))
+        || (f->pattern && !(name && matchName(L, f, name, len))))
+        return 0;
+    f->passed++;
+    return 1;
+}
+
+/*
+** passFilter for the entry of a table with the key at -2 of L and the value on
+** top. L stays unchanged after call.
+*/
+static int passEntry(lua_State * L, Filter * f)
+{
+    int rc;
+    size_t len;
+
+    switch (lua_type(L, -2)) {
+        case LUA_TSTRING: {
+            const char * name = lua_tolstring(L, -2, &len);
+            return passFilter(L, f, name, len, -1);
+        }
+        case LUA_TNUMBER: {
+            //lua_tolstring would turn the key itself into a string.
+            lua_pushvalue(L, -2);
+            rc = passFilter(L, f, lua_tolstring(L, -1, &len), len, -2);
+            lua_pop(L, 1);
+            return rc;
+        }
+        default: {
+            return passFilter(L, f, NULL, 0, -1);
+        }
+    }
+}
+
+static int listChanges(lua_State * L, lua_Debug * ar, char scope, int level, SOCKET s);
+
+typedef struct
+{
+    lua_State * L;
+    lua_Debug * ar;
+    Filter * filter;
+} Args_ll;
+
+static int ll(Args_ll * args, SocketBuf * sb);
+
+/*
+** Input format:
+** ll [stack level [d | filter]]
+**
+** Output format:
+** OK
+** Name Value
+** Name Value
+** ...
+**
+** With d only what changed since the last time is listed. See listChanges.
+** With the options of a filter only the variables passing it are listed. See
+** Filter.
+** L stays unchanged.
+*/
+int listLocals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+{
+    struct lua_Debug AR;
+    int level;
+    Args_ll args;
+    Filter filter;
+
+    if (argc > 0) {
+        level = strtol(argv[0], NULL, 10);
+    }
+    else {
+        level = 1;
+    }
+
+    if (--level != 0) {
+        if (!lua_getstack(L, level, &AR)) {
+            return SendErr(s, "No local variable info available at stack level %d.",
+                level + 1);
+        }
+        ar = &AR;
+    }
+    if (argc > 1 && !strcmp(argv[1], "d"))
+        return argc > 2 ? SendErr(s, "Invalid argument!") : listChanges(L, ar, 'l', level + 1, s);
+    if (argc > 1 && parseFilter(L, &filter, argv, argc, 1) != argc)
+        return SendErr(s, "Invalid argument!");
+    args.L = L;
+    args.ar = ar;
+    args.filter = argc > 1 ? &filter : NULL;
+    return SendOK(s, (Writer)ll, &args);
+}
+
+int ll(Args_ll * args, SocketBuf * sb)
+{
+    int i = 1;
+    const char * name;
+
+    while (!filterFull(args->filter) && (name = lua_getlocal(args->L, args->ar, i++))) {
+        if (name[0] != '('   //(*temporary)
+            && passFilter(args->L, args->filter, name, strlen(name), -1))
+            printVar(sb, name, args->L);
+        lua_pop(args->L, 1);
+    }
+    return 0;
+}
+
+static int lu(Args_ll * args, SocketBuf * sb);
+
+/*
+** Input format:
+** lu [stack level [d | filter]]
+**
+** Output format:
+** OK
+** Name Value
+** Name Value
+** ...
+**
+** With d only what changed since the last time is listed. See listChanges.
+** With the options of a filter only the variables passing it are listed. See
+** Filter.
+** L stays unchanged.
+*/
+int listUpVars(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+{
+    struct lua_Debug AR;
+    int level;
+    int rc;
+    Args_ll args;
+    Filter filter;
+
+    if (argc > 0) {
+        level = strtol(argv[0], NULL, 10);
+    }
+    else {
+        level = 1;
+    }
+
+    if (--level != 0) {
+        if (!lua_getstack(L, level, &AR)) {
+            return SendErr(s, "No up variable info available at stack level %d.",
+                level + 1);
+        }
+        ar = &AR;
+    }
+    if (argc > 1 && !strcmp(argv[1], "d"))
+        return argc > 2 ? SendErr(s, "Invalid argument!") : listChanges(L, ar, 'u', level + 1, s);
+    if (argc > 1 && parseFilter(L, &filter, argv, argc, 1) != argc)
+        return SendErr(s, "Invalid argument!");
+
+    lua_getinfo(L, "f", ar);
+    args.L = L;
+    args.filter = argc > 1 ? &filter : NULL;
+    rc = SendOK(s, (Writer)lu, &args);
+    lua_pop(L, 1);
+    return rc;
+}
+
+int lu(Args_ll * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    int i = 1;
+    const char * name;
+
+    while (!filterFull(args->filter) && (name = lua_getupvalue(L, -1, i++))) {
+        if (passFilter(L, args->filter, name, strlen(name), -1))
+            printVar(sb, name, L);
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+static int lg(Args_ll * args, SocketBuf * sb);
+
+/*
+** Input format:
+** lg [stack level [d | filter]]
+**
+** Output format:
+** OK
+** Name Value
+** Name Value
+** ...
+**
+** With d only what changed since the last time is listed. See listChanges.
+** With the options of a filter only the variables passing it are listed. See
+** Filter.
+** L stays unchanged.
+*/
+int listGlobals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+{
+    struct lua_Debug AR;
+    int level;
+    int rc;
+    Args_ll args;
+    Filter filter;
+
+    if (argc > 0) {
+        level = strtol(argv[0], NULL, 10);
+    }
+    else {
+        level = 1;
+    }
+
+    if (--level != 0) {
+        if (!lua_getstack(L, level, &AR)) {
+            return SendErr(s, "No global variable info available at stack level %d.",
+                level + 1);
+        }
+        ar = &AR;
+    }
+    if (argc > 1 && !strcmp(argv[1], "d"))
+        return argc > 2 ? SendErr(s, "Invalid argument!") : listChanges(L, ar, 'g', level + 1, s);
+    if (argc > 1 && parseFilter(L, &filter, argv, argc, 1) != argc)
+        return SendErr(s, "Invalid argument!");
+
+    lua_getinfo(L, "f", ar);
+    lua_getfenv(L, -1);
+    assert(lua_istable(L, -1));
+    args.L = L;
+    args.filter = argc > 1 ? &filter : NULL;
+    rc = SendOK(s, (Writer)lg, &args);
+    lua_pop(L, 2);
+    return rc;
+}
+
+static int isID(const char * name)
+{
+    if (!(isalpha(*name) || *name == '_'))
+        return 0;
+    ++name;
+    while (isalnum(*name) || *name == '_')
+        ++name;
+    return !*name ? 1 : 0;
+}
+
+int lg(Args_ll * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        if (lua_type(L, -2) == LUA_TSTRING) { //lua_tolstring would turn a number key into a string
+            size_t len;
+            const char * name = lua_tolstring(L, -2, &len);
+            if (strlen(name) == len && isID(name) && passFilter(L, args->filter, name, len, -1))
+                printVar(sb, name, L);
+        }
+        lua_pop(L, 1);
+        if (filterFull(args->filter)) {
+            lua_pop(L, 1);
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+** Indices of fields in a digest of a listing, stored in the "digests" table.
+** The owner is the function of the frame for locals and up variables, or its
+** environment for globals. Names and values are keyed by the indices of the
+** variables, or by the names of globals. The last is the last index listed.
+*/
+#define DIGEST_OWNER 1
+#define DIGEST_NAMES 2
+#define DIGEST_VALUES 3
+#define DIGEST_LAST 4
+
+/*
+** A nil value in a digest, for a nil in a table is no value.
+*/
+static char g_nilValue;
+
+typedef struct
+{
+    lua_State * L;
+    lua_Debug * ar;
+    char scope;
+    int full;   //is there no digest to tell changes against?
+    int owner;  //indices in L of the owner and the digest and its fields
+    int digest;
+    int names;
+    int values;
+} Args_lc;
+
+static int lc(Args_lc * args, SocketBuf * sb);
+
+/*
+** Output format:
+** OK
+** F or D
+** Key
+** Name Value
+** Key
+** -
+** ...
+**
+** List the variables of scope l, u or g at the stack level by what changed
+** since they were last listed so: a variable added or given another value
+** comes with its name and value, and one gone with "-". Keys are the indices
+** of locals and up variables, or the names of globals. What was listed is
+** kept as a digest per scope and level in the "digests" table, with values
+** held weakly; a value gone is taken as changed. A value not listed again as
+** it's the same is anchored until the script resumes, as one listed is, so
+** that all the handles in the controller's view of the listing hold until
+** then (see resetHandles). When the frame has another function than that of
+** the digest, or globals another environment, the listing starts over by F
+** and has all the variables; otherwise it's D.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+int listChanges(lua_State * L, lua_Debug * ar, char scope, int level, SOCKET s)
+{
+    Args_lc args;
+    char id[16];
+    int top = lua_gettop(L);
+    int rc;
+
+    lua_getinfo(L, "f", ar);
+    if (scope == 'g') {
+        lua_getfenv(L, -1);
+        lua_replace(L, -2);
+    }
+    args.owner = top + 1;
+
+    lua_pushliteral(L, "digests");
+    lua_rawget(L, top);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushliteral(L, "digests");
+        lua_pushvalue(L, -2);
+        lua_rawset(L, top);
+    }
+    sprintf(id, "%c%d", scope, level);
+    lua_getfield(L, -1, id);
+    args.full = 1;
+    if (lua_istable(L, -1)) {
+        lua_rawgeti(L, -1, DIGEST_OWNER);
+        args.full = !lua_rawequal(L, -1, args.owner);
+        lua_pop(L, 1);
+    }
+    if (args.full) {
+        lua_pop(L, 1);
+        lua_createtable(L, 4, 0);
+        lua_pushvalue(L, args.owner);
+        lua_rawseti(L, -2, DIGEST_OWNER);
+        lua_newtable(L);
+        lua_rawseti(L, -2, DIGEST_NAMES);
+        lua_newtable(L);
+        lua_newtable(L);
+        lua_pushliteral(L, "__mode");
+        lua_pushliteral(L, "v");
+        lua_rawset(L, -3);
+        lua_setmetatable(L, -2);
+        lua_rawseti(L, -2, DIGEST_VALUES);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, id);
+    }
+    args.digest = lua_gettop(L);
+    lua_rawgeti(L, args.digest, DIGEST_NAMES);
+    args.names = lua_gettop(L);
+    lua_rawgeti(L, args.digest, DIGEST_VALUES);
+    args.values = lua_gettop(L);
+
+    args.L = L;
+    args.ar = ar;
+    args.scope = scope;
+    rc = SendOK(s, (Writer)lc, &args);
+    lua_settop(L, top);
+    return rc;
+}
+
+static void pushKey(lua_State * L, int i, const char * name)
+{
+    if (i)
+        lua_pushinteger(L, i);
+    else
+        lua_pushstring(L, name);
+}
+
+/*
+** List the variable of the index i, or of name for a global, unless it's the
+** same as in the digest, and update the digest. Its value is on top of L.
+** L stays unchanged after call.
+*/
+static void putChange(Args_lc * args, SocketBuf * sb, int i, const char * name)
+{
+    lua_State * L = args->L;
+    int same;
+
+    pushKey(L, i, name);
+    lua_rawget(L, args->names);
+    same = lua_type(L, -1) == LUA_TSTRING && !strcmp(lua_tostring(L, -1), name);
+    lua_pop(L, 1);
+    pushKey(L, i, name);
+    lua_rawget(L, args->values);
+    if (lua_isnil(L, -2))
+        same = same && lua_touserdata(L, -1) == &g_nilValue;
+    else
+        same = same && lua_rawequal(L, -1, -2);
+    lua_pop(L, 1);
+    if (same) {
+        int t = lua_type(L, -1);
+        //The controller still shows the handle listed before.
+        if (t == LUA_TTABLE || t == LUA_TFUNCTION || t == LUA_TUSERDATA || t == LUA_TTHREAD)
+            handleOf(L);
+        return;
+    }
+
+    if (i) {
+        SB_Print(sb, "%d\n", i);
+    }
+    else {
+        SB_Intern(sb, 1);
+        SB_Print(sb, "%s\n", name);
+        SB_Intern(sb, 0);
+    }
+    printVar(sb, name, L);
+
+    pushKey(L, i, name);
+    lua_pushstring(L, name);
+    lua_rawset(L, args->names);
+    pushKey(L, i, name);
+    if (lua_isnil(L, -2))
+        lua_pushlightuserdata(L, &g_nilValue);
+    else
+        lua_pushvalue(L, -2);
+    lua_rawset(L, args->values);
+}
+
+/*
+** List the variable of the index i as gone if it was listed before, and take
+** it out of the digest.
+*/
+static void dropChange(Args_lc * args, SocketBuf * sb, int i)
+{
+    lua_State * L = args->L;
+
+    lua_rawgeti(L, args->names, i);
+    if (!lua_isnil(L, -1)) {
+        SB_Print(sb, "%d\n-\n", i);
+        lua_pushnil(L);
+        lua_rawseti(L, args->names, i);
+        lua_pushnil(L);
+        lua_rawseti(L, args->values, i);
+    }
+    lua_pop(L, 1);
+}
+
+/*
+** Drop the variables of indices after last, and keep last in the digest.
+*/
+static void dropChanges(Args_lc * args, SocketBuf * sb, int last)
+{
+    lua_State * L = args->L;
+    int i;
+
+    lua_rawgeti(L, args->digest, DIGEST_LAST);
+    for (i = lua_tointeger(L, -1); i > last; i--)
+        dropChange(args, sb, i);
+    lua_pop(L, 1);
+    lua_pushinteger(L, last);
+    lua_rawseti(L, args->digest, DIGEST_LAST);
+}
+
+int lc(Args_lc * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    const char * name;
+    int i;
+
+    SB_Print(sb, args->full ? "F\n" : "D\n");
+    switch (args->scope) {
+        case 'l': {
+            for (i = 1; (name = lua_getlocal(L, args->ar, i)); i++) {
+                //A local out of scope may leave its slot to a (*temporary).
+                if (name[0] != '(')
+                    putChange(args, sb, i, name);
+                else
+                    dropChange(args, sb, i);
+                lua_pop(L, 1);
+            }
+            dropChanges(args, sb, i - 1);
+            break;
+        }
+        case 'u': {
+            for (i = 1; (name = lua_getupvalue(L, args->owner, i)); i++) {
+                putChange(args, sb, i, *name ? name : "[N/A]"); //C upvalues have no names
+                lua_pop(L, 1);
+            }
+            dropChanges(args, sb, i - 1);
+            break;
+        }
+        case 'g': {
+            lua_pushnil(L);
+            while (lua_next(L, args->owner)) {
+                if (lua_type(L, -2) == LUA_TSTRING) {
+                    size_t len;
+                    name = lua_tolstring(L, -2, &len);
+                    if (strlen(name) == len && isID(name))
+                        putChange(args, sb, 0, name);
+                }
+                lua_pop(L, 1);
+            }
+
+            //Globals gone. Fields may be cleared while traversed.
+            lua_pushnil(L);
+            while (lua_next(L, args->names)) {
+                lua_pop(L, 1);
+                lua_pushvalue(L, -1);
+                lua_rawget(L, args->owner);
+                if (lua_isnil(L, -1)) {
+                    SB_Print(sb, "%s\n-\n", lua_tostring(L, -2));
+                    lua_pushvalue(L, -2);
+                    lua_pushnil(L);
+                    lua_rawset(L, args->names);
+                    lua_pushvalue(L, -2);
+                    lua_pushnil(L);
+                    lua_rawset(L, args->values);
+                }
+                lua_pop(L, 1);
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static int lookupVar(lua_State * L, lua_Debug * ar, int level, char scope,
+    const char * name, int nameLen);
+static int lookupField(lua_State * L, const char * field);
+static const char * pushPath(lua_State * L, lua_Debug * ar, char * argv[], int argc, int * used);
+static int snapshot(lua_State * L, int memo, int origs, int depth, int * left);
+
+typedef struct
+{
+    lua_State * L;
+    int offset;
+    int limit;      //0 for no paging
+    int depth;      //levels of tables to list, 1 for the watched one only
+    size_t budget;  //bytes to stop expanding at, 0 for no limit
+    int spent;      //has the budget been spent?
+    int visited;    //index in L of the table of tables listed
+    Filter * filter;    //of the entries of the watched table, NULL for none
+    int packed;     //may runs of numbers be packed? See pageTable.
+} Args_w;
+
+static int w(Args_w * args, SocketBuf * sb);
+
+/*
+** Input format:
+** w <level> <l|u|g> <name>[fields] [r[<depth>]] [x<depth>[,<bytes>]] [<offset>,<limit> | filter]
+** or:
+** w [fields] [r[<depth>]] [x<depth>[,<bytes>]] [<offset>,<limit> | filter]
+**
+** in which, fields have the form like |n123.4|b0|s"hello"|s008b917a|f006c4560|...
+** A field like |#12 is the value of handle 12, found without a scan; so a
+** path may start with one even when no value is cached.
+** Output format:
+** OK
+** Detail
+**
+** With <offset>,<limit> a table is listed by pages: the detail of it has the
+** number of entries and the offset, and then at most limit entries from there.
+** See pageTable.
+** With x<depth> tables in the value are listed down to depth levels, the
+** value being the first, in one response. See expandVar.
+** With the options of a filter only the entries of a table passing it are
+** listed, not by pages. See Filter.
+** With r the value is remembered for paths without a variable, and with
+** r<depth> a table is also copied down to depth levels for df to diff against.
+** See snapshot.
+** L stays unchanged.
+*/
+int watch(lua_State * L, lua_Debug * ar, char * argv[], int argc, DebuggerInfo * info)
+{
+    SOCKET s = info->s;
+    int remember = 0;
+    int snapDepth = 0;
+    int invalid = 0;
+    const char * err;
+    Args_w args;
+    Filter filter;
+    int rc;
+    int i;
+    int top = lua_gettop(L);
+
+    args.L = L;
+    args.offset = 0;
+    args.limit = 0;
+    args.depth = 1;
+    args.budget = 0;
+    args.spent = 0;
+    args.filter = NULL;
+    args.packed = info->version >= 7;
+
+    err = pushPath(L, ar, argv, argc, &i);
+    if (err)
+        return SendErr(s, "%s", err);
+
+    if (i < argc && argv[i][0] == 'r') {
+        char * p;
+        remember = 1;
+        if (argv[i][1]) {
+            snapDepth = strtol(argv[i] + 1, &p, 10);
+            if (*p || snapDepth < 1 || snapDepth > W_MAX_DEPTH)
+                invalid = 1;
+        }
+        i++;
+    }
+    if (i < argc && argv[i][0] == 'x') {
+        char * p;
+        args.depth = strtol(argv[i] + 1, &p, 10);
+        args.budget = W_EXPAND_BUDGET;
+        if (*p == ',')
+            args.budget = strtoul(p + 1, &p, 10);
+        if (*p || args.depth < 1 || args.depth > W_MAX_DEPTH || args.budget < 1)
+            invalid = 1;
+        if (args.depth == 1)
+            args.budget = 0;
+        i++;
+    }
+    if (i < argc && !invalid) {
+        int j = parseFilter(L, &filter, argv, argc, i);
+        if (j < 0)
+            invalid = 1;
+        else if (j > i)
+            args.filter = &filter;
+        i = j;
+    }
+    if (i < argc && !invalid && !args.filter) {
+        char * p;
+        args.offset = strtol(argv[i], &p, 10);
+        if (*p == ',')
+            args.limit = strtol(p + 1, &p, 10);
+        if (*p || args.offset < 0 || args.limit < 1)
+            invalid = 1;
+        i++;
+    }
+    if (i < argc || invalid) {
+        lua_pop(L, 1);
+        return SendErr(s, "Invalid argument!");
+    }
+
+    //A new snapshot, or none, replaces the one of the value remembered before.
+    if (remember) {
+        int left = DF_SNAP_MAX;
+        lua_pushnil(L);
+        lua_pushnil(L);
+        if (snapDepth && lua_istable(L, top + 1)) {
+            lua_settop(L, top + 1);
+            lua_newtable(L);
+            lua_newtable(L);
+            lua_pushvalue(L, top + 1);
+            if (!snapshot(L, top + 2, top + 3, snapDepth, &left)) {
+                lua_settop(L, top);
+                return SendErr(s, "Value is too large to snapshot!");
+            }
+            lua_replace(L, top + 2);
+            lua_pop(L, 1);
+        }
+        lua_pushliteral(L, "cacheOrigs");
+        lua_insert(L, -2);
+        lua_rawset(L, top);
+        lua_pushliteral(L, "cacheSnap");
+        lua_insert(L, -2);
+        lua_rawset(L, top);
+    }
+
+    rc = SendOK(s, (Writer)w, &args);
+    if (remember) {
+        lua_pushliteral(L, "cacheValue");
+        lua_insert(L, -2);
+        lua_rawset(L, -3);
+    }
+    else {
+        lua_pop(L, 1);
+    }
+
+    assert(lua_gettop(L) == top);
+    return rc;
+}
+
+/*
+** Push the value a path in argv refers to, which is either
+** <level> <l|u|g> <name>[fields]
+** or:
+** [fields]
+** where the latter refers to the fields of the cached value, or of the value of
+** the handle the fields start with. *used is set to the number of arguments the
+** path takes.
+** Return NULL when the value is pushed, or the error message with L unchanged.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+const char * pushPath(lua_State * L, lua_Debug * ar, char * argv[], int argc, int * used)
+{
+    char * fields = NULL;
+    int top = lua_gettop(L);
+
+    if (argc >= 3 && argv[0][0] != '|') {
+        int level = strtol(argv[0], NULL, 10);
+        char scope = argv[1][0];
+        char * name = argv[2];
+        char * nameEnd = strchr(name, '|');
+
+        *used = 3;
+        if (level < 1 || argv[1][1] != 0 || !(scope == 'l' || scope == 'u' || scope == 'g'))
+            return "Invalid argument!";
+        if (!lookupVar(L, ar, level, scope, name, nameEnd ? nameEnd - name : (int)strlen(name)))
+            return "Variable is not found!";
+        fields = nameEnd;
+    }
+    else {
+        *used = argc > 0 && argv[0][0] == '|' ? 1 : 0;
+        if (*used)
+            fields = argv[0];
+        lua_pushliteral(L, "cacheValue");
+        lua_rawget(L, top);
+        //A handle refers to a value by itself, so it needs no cached one.
+        if (lua_isnil(L, -1) && !(fields && fields[0] == '|' && fields[1] == '#')) {
+            lua_pop(L, 1);
+            return "Variable is not found!";
+        }
+    }
+
+    if (fields) {
+        if (!lookupField(L, fields)) {
+            lua_settop(L, top);
+            return "Field is not found!";
+        }
+        lua_remove(L, -2);
+    }
+    return NULL;
+}
+
+/*
+** Look up a lua variable with specified stack level, scope and name.
+** Return 1 when found and push it on top of L; otherwise 0 is returned and
+** L stays unchanged.
+*/
+int lookupVar(lua_State * L, lua_Debug * ar, int level, char scope, const char * name, int nameLen)
+{
+    lua_Debug AR;
+    int found = 0;
+
+    if (level != 1) {
+        if (!lua_getstack(L, level - 1, &AR))
+            return 0;
+        ar = &AR;
+    }
+
+    if (scope == 'l') {
+        int i = 1;
+        const char * p;
+
+        lua_pushnil(L); //place holder
+        while ((p = lua_getlocal(L, ar, i++))) {
+            if (!strncmp(p, name, nameLen)) {
+                found = 1;
+                lua_replace(L, -2); //The same name may have multi values(though it's odd!), use the last!
+            }
+            else {
+                lua_pop(L, 1);
+            }
+        }
+        if (!found)
+            lua_pop(L, 1);
+    }
+    else if (scope == 'u') {
+        int i = 1;
+        const char * p;
+
+        lua_getinfo(L, "f", ar);
+        while ((p = lua_getupvalue(L, -1, i++))) {
+            if (!strncmp(p, name, nameLen)) {
+                found = 1;
+                break;
+            }
+            else {
+                lua_pop(L, 1);
+            }
+        }
+        lua_remove(L, found ? -2 : -1);
+    }
+    else {
+        lua_getinfo(L, "f", ar);
+        lua_getfenv(L, -1);
+        assert(lua_istable(L, -1));
+        lua_pushlstring(L, name, nameLen);
+        lua_gettable(L, -2);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 3);
+        }
+        else {
+            found = 1;
+            lua_replace(L, -3);
+            lua_pop(L, 1);
+        }
+    }
+
+    return found;
+}
+
+static int nextField(const char * fields, const char ** begin, const char ** end)
+{
+    assert(fields);
+    if (*fields++ != '|' || !*fields)
+        return 0;
+
+    *begin = fields;
+    if (fields[0] == 's' && fields[1] == '\'') {
+        while (1) {
+            const char * p = strchr(fields + 2, '\'');
+            if (!p)
+                return 0;
+            ++p;
+            if (*p != '|' && *p != 0)
+                return 0;
+            *end = p;
+            break;
+        }
+    }
+    else {
+        const char * p = strchr(fields + 1, '|');
+        *end = p ? p : fields + strlen(fields);
+    }
+    return 1;
+}
+
+/*
+** Get a table field by comparing its value's pointer and type with the specified
+** one.
+** Return 1 and push the value on top of L when success; otherwise return 0 and
+** push nothing.
+*/
+static int getFieldValueByPtr(lua_State * L, void * ptr, int type)
+{
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        int t = lua_type(L, -1);
+
+        if (t != type) {
+            lua_pop(L, 1);
+            continue;
+        }
+
+        if (t == LUA_TTABLE || t == LUA_TFUNCTION || t == LUA_TTHREAD) {
+            if (lua_topointer(L, -1) == ptr) {
+                lua_remove(L, -2);
+                return 1;
+            }
+        }
+        else if (t == LUA_TUSERDATA || t == LUA_TLIGHTUSERDATA) {
+            if (lua_touserdata(L, -1) == ptr) {
+                lua_remove(L, -2);
+                return 1;
+            }
+        }
+        else if (t == LUA_TSTRING) {
+            if (lua_tostring(L, -1) == ptr) {
+                lua_remove(L, -2);
+                return 1;
+            }
+        }
+
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+/*
+** Convert str, in hex with a prefix "0x" or in decimal, to a pointer, like
+** strtoul does. But strtoul can't be used, for an unsigned long is narrower
+** than a pointer on some 64-bit platforms.
+*/
+static void * strtoptr(const char * str, char ** end)
+{
+    size_t n = 0;
+    int base = 10;
+
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    }
+    for (; isxdigit((unsigned char)*str); ++str) {
+        int d = isdigit((unsigned char)*str) ? *str - '0' : tolower((unsigned char)*str) - 'a' + 10;
+        if (d >= base)
+            break;
+        n = n * base + d;
+    }
+    if (end)
+        *end = (char *)str;
+    return (void *)n;
+}
+
+/*
+** Push the value of a handle field like "#12". Return 0 when the handle is
+** unknown or its value has been collected, and nothing is pushed.
+*/
+static int getHandleValue(lua_State * L, const char * fieldBegin, const char * fieldEnd)
+{
+    char * end;
+    int id = strtol(fieldBegin + 1, &end, 10);
+
+    if (end != fieldEnd || id < 1)
+        return 0;
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "handles");
+    lua_rawget(L, -2);
+    lua_rawgeti(L, -1, id);
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+** Get a table field. Return 1 and push the field value on top of L; otherwise
+** return 0 and push nothing.
+** The table is on top of L. The field is sth. like "n123.456", "f008bae20", etc.
+*/
+static int getFieldValue(lua_State * L, const char * fieldBegin, const char * fieldEnd)
+{
+    char * end;
+
+    if (*fieldBegin == 'n') {
+        double num = strtod(fieldBegin + 1, &end);
+        if (end != fieldEnd)
+            return 0;
+        lua_pushnumber(L, num);
+        lua_gettable(L, -2);
+    }
+    else if (*fieldBegin == 's' && fieldBegin[1] == '\'') {
+        const char * str = fieldBegin + 2;
+        assert(*(fieldEnd - 1) == '\'');
+        lua_pushlstring(L, str, fieldEnd - str - 1);
+        lua_gettable(L, -2);
+    }
+    else if (*fieldBegin == 'b') {
+        int n = strtol(fieldBegin + 1, &end, 0);
+        if (end != fieldEnd)
+            return 0;
+        lua_pushboolean(L, n);
+        lua_gettable(L, -2);
+    }
+    else if (*fieldBegin == 'U') {
+        void * ptr = strtoptr(fieldBegin + 1, &end);
+        if (end != fieldEnd)
+            return 0;
+        lua_pushlightuserdata(L, ptr);
+        lua_gettable(L, -2);
+    }
+    else {
+        void * ptr;
+        int t;
+
+        switch (*fieldBegin) {
+            case 't':
+                t = LUA_TTABLE;
+                break;
+            case 'u':
+                t = LUA_TUSERDATA;
+                break;
+            case 'f':
+                t = LUA_TFUNCTION;
+                break;
+            case 'd':
+                t = LUA_TTHREAD;
+                break;
+            default:
+                return 0;
+        }
+
+        ptr = strtoptr(fieldBegin + 1, &end);
+        if (end != fieldEnd)
+            return 0;
+        return getFieldValueByPtr(L, ptr, t);
+    }
+    return 1;
+}
+
+/*
+** Look up a field in a lua value on top of L. If the field is found, it's pushed
+** on top of L and 1 is returned; otherwise nothing is pushed and 0 is returned.
+** field is a descriptive string like '|n123|s"something"|f0088abe8|...'.
+** Specially, "|" is a field representing the value itself. And particularly,
+** "|m" is a legal field denoting the metatable. So surprisingly, any Lua value
+** , not limited to table, can have subfields, because according to offical Lua
+** document, "Every value in Lua may have a metatable". For example, consider
+** "a = 123", then for variable a, 'a|m|s"__add"' is legal.
+*/
+int lookupField(lua_State * L, const char * field)
+{
+    const char * subfieldBegin;
+    const char * subfieldEnd;
+
+    assert(field && *field);
+
+    lua_pushvalue(L, -1);
+    while (*field && nextField(field, &subfieldBegin, &subfieldEnd)) {
+        if (*subfieldBegin == 'm') {
+            if (!lua_getmetatable(L, -1))
+                break;
+        }
+        else if (*subfieldBegin == '#') {
+            if (!getHandleValue(L, subfieldBegin, subfieldEnd))
+                break;
+        }
+        else {
+            if (!lua_istable(L, -1))
+                break;
+            if (!getFieldValue(L, subfieldBegin, subfieldEnd))
+                break;
+        }
+        lua_replace(L, -2);
+        field = subfieldEnd;
+    }
+
+    if (field[0] && !(field[0] == '|' && field[1] == 0)) {
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+** Is the key at idx of L an integer in [1, border]?
+*/
+static int inSequence(lua_State * L, int idx, int border)
+{
+    lua_Number k;
+
+    if (lua_type(L, idx) != LUA_TNUMBER)
+        return 0;
+    k = lua_tonumber(L, idx);
+    return k >= 1 && k <= border && k == (lua_Number)(int)k;
+}
+
+/*
+** Once the bytes in sb exceed the budget of expansion, mark it spent and tell
+** it by "~". Return if it's spent.
+*/
+static int overBudget(Args_w * args, SocketBuf * sb)
+{
+    if (!args->spent && args->budget && SB_Size(sb) > args->budget) {
+        args->spent = 1;
+        SB_Print(sb, "~\n");
+    }
+    return args->spent;
+}
+
+static void expandVar(Args_w * args, SocketBuf * sb, int level);
+
+/*
+** Print the entries of the table on top of L, which is at the level-th level
+** of the watched value, those of the watched table only when they pass the
+** filter. Stop when the budget of expansion is spent.
+** L stays unchanged after call.
+*/
+static void listTable(Args_w * args, SocketBuf * sb, int level)
+{
+    lua_State * L = args->L;
+
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        if (level > 1 || passEntry(L, args->filter)) {
+            lua_pushvalue(L, -2);
+            printKey(sb, L);
+            lua_pop(L, 1);
+            expandVar(args, sb, level + 1);
+        }
+        lua_pop(L, 1);
+        if (overBudget(args, sb) || (level == 1 && filterFull(args->filter))) {
+            lua_pop(L, 1);
+            break;
+        }
+    }
+}
+
+/*
+** Print the value on top of L, which is at the level-th level of the watched
+** value. A table within the depth is followed by "{", whether it has a
+** metatable, its entries and "}"; or by "^" when it has been listed before
+** in the response, for a cycle or a table shared. Tables aren't listed any
+** more once the budget is spent.
+** L stays unchanged after call.
+*/
+void expandVar(Args_w * args, SocketBuf * sb, int level)
+{
+    lua_State * L = args->L;
+    int listed;
+    int meta;
+
+    printVar(sb, NULL, L);
+    if (level > args->depth || args->spent || !lua_istable(L, -1)
+        || !lua_checkstack(L, LUA_MINSTACK))
+        return;
+
+    lua_pushvalue(L, -1);
+    lua_rawget(L, args->visited);
+    listed = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (listed) {
+        SB_Print(sb, "^\n");
+        return;
+    }
+    lua_pushvalue(L, -1);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, args->visited);
+
+    if ((meta = lua_getmetatable(L, -1)))
+        lua_pop(L, 1);
+    SB_Print(sb, "{\n%d\n", meta ? 1 : 0);
+    listTable(args, sb, level);
+    SB_Print(sb, "}\n");
+}
+
+/*
+** If the values of the table at index t in L from key from + 1 on are numbers
+** for at least W_PACK_MIN keys up to to, print them packed: "[", the first key,
+** the number of values, and then the values as raw numbers, W_PACK_WORD to a
+** word, rather than each with its key.
+** Return the number of values packed, 0 for none. L stays unchanged.
+*/
+static int packNumbers(lua_State * L, SocketBuf * sb, int t, int from, int to)
+{
+    double buf[W_PACK_WORD];
+    int n = 0;
+    int i;
+
+    for (i = from; i < to; i++) {
+        int num;
+        lua_rawgeti(L, t, i + 1);
+        num = lua_type(L, -1) == LUA_TNUMBER;
+        lua_pop(L, 1);
+        if (!num)
+            break;
+    }
+    if (i - from < W_PACK_MIN)
+        return 0;
+
+    to = i;
+    SB_Print(sb, "[\n%d\n%d\n", from + 1, to - from);
+    for (i = from; i < to; i++) {
+        lua_rawgeti(L, t, i + 1);
+        buf[n++] = (double)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        if (n == W_PACK_WORD || i == to - 1) {
+            SB_AddRaw(sb, buf, n * sizeof(double));
+            SB_Print(sb, "\n");
+            n = 0;
+        }
+    }
+    return to - from;
+}
+
+/*
+** Print the number of entries of the table on top of L, the offset, and then
+** at most limit entries from the offset on. Entries are in the order of keys
+** 1 to the border of the table, holes shown as nil, and then the other keys
+** in the order of lua_next. So the sequence is served by index; the rest is
+** resumed from the last key of the previous page when offset is where that
+** page ended, or walked from the start otherwise. Where a page ended and the
+** number of entries, counted once per table, are kept in the "pager" table
+** of the debugger table until the debuggee resumes. Runs of numbers in the
+** sequence may be packed, see packNumbers.
+** L stays unchanged after call.
+*/
+static void pageTable(Args_w * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    int offset = args->offset;
+    int limit = args->limit;
+    int t = lua_gettop(L);
+    int border = lua_objlen(L, t);
+    int pager = t + 2;
+    int total = 0;
+    int resume = 0;
+    int walk = 1;
+    int skip;
+    int i, n;
+
+    lua_pushliteral(L, "debugger");
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    lua_pushliteral(L, "pager");
+    lua_rawget(L, -2);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_createtable(L, 4, 0);
+        lua_pushliteral(L, "pager");
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+    }
+
+    lua_rawgeti(L, pager, 1);
+    if (lua_rawequal(L, -1, t)) {
+        lua_rawgeti(L, pager, 4);
+        total = lua_tointeger(L, -1);
+        lua_rawgeti(L, pager, 3);
+        resume = offset > border && lua_tointeger(L, -1) == offset;
+        lua_pop(L, 3);
+    }
+    else {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        while (lua_next(L, t)) {
+            lua_pop(L, 1);
+            if (!inSequence(L, -1, border))
+                total++;
+        }
+        total += border;
+        lua_pushvalue(L, t);
+        lua_rawseti(L, pager, 1);
+        lua_pushinteger(L, total);
+        lua_rawseti(L, pager, 4);
+    }
+    SB_Print(sb, "%d\n%d\n", total, offset);
+
+    for (i = offset; i < border && limit > 0 && !args->spent; i += n, limit -= n) {
+        n = args->packed ? packNumbers(L, sb, t, i, i + limit < border ? i + limit : border) : 0;
+        if (n == 0) {
+            n = 1;
+            lua_pushinteger(L, i + 1);
+            printVar(sb, NULL, L);
+            lua_pop(L, 1);
+            lua_rawgeti(L, t, i + 1);
+            expandVar(args, sb, 2);
+            lua_pop(L, 1);
+        }
+        overBudget(args, sb);
+    }
+
+    if (limit > 0 && !args->spent) {
+        skip = i - border;
+        if (resume) {
+            //The key may be gone since, with which lua_next would fail.
+            lua_rawgeti(L, pager, 2);
+            lua_pushvalue(L, -1);
+            lua_rawget(L, t);
+            if (lua_isnil(L, -2)) {
+                walk = 0;   //the last page ended the table
+                lua_pop(L, 2);
+            }
+            else if (lua_isnil(L, -1)) {
+                lua_pop(L, 2);
+                lua_pushnil(L);
+            }
+            else {
+                lua_pop(L, 1);
+                skip = 0;
+            }
+        }
+        else {
+            lua_pushnil(L);
+        }
+
+        while (walk && lua_next(L, t)) {
+            if (!inSequence(L, -2, border)) {
+                if (skip > 0) {
+                    skip--;
+                }
+                else {
+                    lua_pushvalue(L, -2);
+                    printKey(sb, L);
+                    lua_pop(L, 1);
+                    expandVar(args, sb, 2);
+                    i++;
+                    if (--limit == 0 || overBudget(args, sb)) {
+                        lua_pop(L, 1);
+                        break;
+                    }
+                }
+            }
+            lua_pop(L, 1);
+        }
+        if (!walk || (limit > 0 && !args->spent))
+            lua_pushnil(L);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    lua_rawseti(L, pager, 2);
+    lua_pushinteger(L, i);
+    lua_rawseti(L, pager, 3);
+    lua_pop(L, 2);
+}
+
+int w(Args_w * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    int t = lua_type(L, -1);
+    int meta;
+    if (t != LUA_TNIL && (meta = lua_getmetatable(L, -1)))
+        lua_pop(L, 1);
+    printVar(sb, NULL, L);
+
+    switch (t) {
+        case LUA_TTABLE: {
+            SB_Print(sb, "%d\n", meta ? 1 : 0);
+            lua_newtable(L);
+            args->visited = lua_gettop(L);
+            lua_pushvalue(L, -2);
+            lua_pushboolean(L, 1);
+            lua_rawset(L, -3);
+            lua_pushvalue(L, -2);
+            if (args->limit)
+                pageTable(args, sb);
+            else
+                listTable(args, sb, 1);
+            lua_pop(L, 2);
+            break;
+        }
+        case LUA_TUSERDATA: {
+            int size = lua_objlen(L, -1);
+            SB_Print(sb, "%d\n%d\n", meta ? 1 : 0, size);
+            break;
+        }
+        case LUA_TFUNCTION: {
+            lua_Debug ar;
+            lua_pushvalue(L, -1);
+            lua_getinfo(L, ">S", &ar);
+            SB_Print(sb, "%d\n%s\n%s\n%d\n%d\n", meta ? 1 : 0, ar.what,
+                ar.short_src, ar.linedefined, ar.lastlinedefined);
+            break;
+        }
+        case LUA_TNUMBER: {
+            SB_Print(sb, "%d\n", meta ? 1 : 0);
+            break;
+        }
+        case LUA_TSTRING: {
+            SB_Print(sb, "%d\n", meta ? 1 : 0);
+            break;
+        }
+        case LUA_TBOOLEAN: {
+            SB_Print(sb, "%d\n", meta ? 1 : 0);
+            break;
+        }
+        case LUA_TLIGHTUSERDATA: {
+            SB_Print(sb, "%d\n", meta ? 1 : 0);
+            break;
+        }
+        case LUA_TTHREAD: {
+            int status = lua_status(lua_tothread(L, -1));
+            SB_Print(sb, "%d\n%d\n", meta ? 1 : 0, status);
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+** Copy the table on top of L, and the tables in it down to depth levels, for df
+** to diff against. Each table is copied once however often it's referred to:
+** memo, an index in L, maps the originals to their copies, and origs the copies
+** to their originals. Keys aren't copied. *left is the number of entries which
+** may still be copied.
+** Push the copy and return 1, or return 0 with L unchanged when there are more
+** entries than *left.
+*/
+int snapshot(lua_State * L, int memo, int origs, int depth, int * left)
+{
+    int t = lua_gettop(L);
+
+    lua_pushvalue(L, t);
+    lua_rawget(L, memo);
+    if (!lua_isnil(L, -1))
+        return 1;
+    lua_pop(L, 1);
+    if (!lua_checkstack(L, LUA_MINSTACK))
+        return 0;
+
+    lua_newtable(L);
+    lua_pushvalue(L, t);
+    lua_pushvalue(L, t + 1);
+    lua_rawset(L, memo);
+    lua_pushvalue(L, t + 1);
+    lua_pushvalue(L, t);
+    lua_rawset(L, origs);
+
+    lua_pushnil(L);
+    while (lua_next(L, t)) {
+        if (--*left < 0
+            || (depth > 1 && lua_istable(L, -1) && !snapshot(L, memo, origs, depth - 1, left))) {
+            lua_settop(L, t);
+            return 0;
+        }
+        if (lua_gettop(L) > t + 3)
+            lua_remove(L, -2);
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, t + 1);
+    }
+    return 1;
+}
+
+typedef struct
+{
+    lua_State * L;
+    int origs;      //index in L of the table of copies to their originals
+    int visited;    //index in L of the table of the tables diffed
+    int keys[W_MAX_DEPTH];  //indices in L of the keys to the tables being diffed
+    int level;      //of the tables being diffed, 0 for the watched one
+    int opened;     //levels led by ">" so far
+    int spent;      //has the budget been spent?
+} Args_df;
+
+/*
+** Push the original of the value at index idx in L when it's a copy taken by
+** snapshot, or the value itself otherwise.
+*/
+static void pushOriginal(Args_df * args, int idx)
+{
+    lua_State * L = args->L;
+
+    lua_pushvalue(L, idx);
+    lua_rawget(L, args->origs);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, idx);
+    }
+}
+
+/*
+** Print a change of op to the entry of the key at index key in L, with the old
+** value at index old and the new one at index cur, each 0 for none. The tables
+** on the way to the entry are first led by ">" and their keys unless they have
+** been. Once the bytes in sb exceed DF_BUDGET, "~" is printed instead and
+** listing stops.
+*/
+static void putDiff(Args_df * args, SocketBuf * sb, const char * op, int key, int old, int cur)
+{
+    lua_State * L = args->L;
+
+    if (args->spent)
+        return;
+    if (SB_Size(sb) > DF_BUDGET) {
+        args->spent = 1;
+        SB_Print(sb, "~\n");
+        return;
+    }
+
+    for (; args->opened < args->level; args->opened++) {
+        SB_Print(sb, ">\n");
+        lua_pushvalue(L, args->keys[args->opened]);
+        printKey(sb, L);
+        lua_pop(L, 1);
+    }
+    SB_Print(sb, "%s\n", op);
+    lua_pushvalue(L, key);
+    printKey(sb, L);
+    lua_pop(L, 1);
+    if (old) {
+        pushOriginal(args, old);
+        printVar(sb, NULL, L);
+        lua_pop(L, 1);
+    }
+    if (cur) {
+        lua_pushvalue(L, cur);
+        printVar(sb, NULL, L);
+        lua_pop(L, 1);
+    }
+}
+
+/*
+** Are the values at indices a and b in L the same? NaN is taken as itself.
+*/
+static int sameValue(lua_State * L, int a, int b)
+{
+    return lua_rawequal(L, a, b) || (lua_type(L, a) == LUA_TNUMBER
+        && lua_type(L, b) == LUA_TNUMBER && lua_tonumber(L, a) != lua_tonumber(L, a)
+        && lua_tonumber(L, b) != lua_tonumber(L, b));
+}
+
+/*
+** Print the changes from the copy of a table taken by snapshot, at -2 in L, to
+** the table at -1. An entry whose value is a copied table is diffed in turn
+** when the table is still there, or changed when it has been replaced.
+** L stays unchanged after call.
+*/
+static void diffTable(Args_df * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    int old = lua_gettop(L) - 1;
+    int cur = old + 1;
+
+    lua_pushvalue(L, cur);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, args->visited);
+
+    //Removed and changed entries...
+    lua_pushnil(L);
+    while (!args->spent && lua_next(L, old)) {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, cur);
+        pushOriginal(args, -2);
+        if (lua_isnil(L, -2)) {
+            putDiff(args, sb, "-", cur + 1, cur + 2, 0);
+        }
+        else if (!lua_rawequal(L, -1, -3)) {    //a copied table
+            if (!lua_rawequal(L, -1, -2)) {
+                putDiff(args, sb, "*", cur + 1, cur + 2, cur + 3);
+            }
+            else if (args->level + 1 < W_MAX_DEPTH && lua_checkstack(L, LUA_MINSTACK)) {
+                lua_pushvalue(L, -2);
+                lua_rawget(L, args->visited);
+                if (!lua_toboolean(L, -1)) {
+                    args->keys[args->level++] = cur + 1;
+                    lua_pushvalue(L, cur + 2);
+                    lua_pushvalue(L, cur + 3);
+                    diffTable(args, sb);
+                    lua_pop(L, 2);
+                    if (args->opened > --args->level) {
+                        args->opened = args->level;
+                        if (!args->spent)
+                            SB_Print(sb, "<\n");
+                    }
+                }
+                lua_pop(L, 1);
+            }
+        }
+        else if (!sameValue(L, -1, -2)) {
+            putDiff(args, sb, "*", cur + 1, cur + 2, cur + 3);
+        }
+        lua_pop(L, 3);
+    }
+    if (!args->spent)
+        lua_pushnil(L);
+    else
+        lua_settop(L, cur);
+
+    //...and then added ones.
+    while (!args->spent && lua_next(L, cur)) {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, old);
+        if (lua_isnil(L, -1))
+            putDiff(args, sb, "+", cur + 1, 0, cur + 2);
+        lua_pop(L, 2);
+    }
+    lua_settop(L, cur);
+}
+
+static int df(Args_df * args, SocketBuf * sb);
+
+/*
+** Input format:
+** df <level> <l|u|g> <name>[fields]
+** or:
+** df [fields]
+**
+** Output format:
+** OK
+** Change
+** Change
+** ...
+**
+** Diff the snapshot taken by w ... r<depth> against the table a path refers
+** to, the value remembered then by default. A change is "+", the key and the
+** value of an entry added; "-", the key and the old value of one removed; or
+** "*", the key, the old value and the new value of one changed. The changes
+** within a table still in place, which was copied in the snapshot, are led by
+** ">" and its key and ended by "<". Old values are given by the originals
+** rather than the copies. Listing stops with "~" once DF_BUDGET bytes are in
+** the response.
+** L stays unchanged.
+*/
+int diff(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+{
+    const char * err;
+    Args_df args;
+    int top = lua_gettop(L);
+    int i;
+    int rc;
+
+    lua_pushliteral(L, "cacheSnap");
+    lua_rawget(L, top);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        return SendErr(s, "No snapshot is taken!");
+    }
+    lua_pushliteral(L, "cacheOrigs");
+    lua_rawget(L, top);
+    lua_insert(L, -2);
+    lua_newtable(L);
+    lua_insert(L, -2);
+
+    lua_pushvalue(L, top);
+    err = pushPath(L, ar, argv, argc, &i);
+    if (err || i < argc || !lua_istable(L, -1)) {
+        lua_settop(L, top);
+        return SendErr(s, "%s", err ? err : i < argc ? "Invalid argument!" : "Not a table!");
+    }
+    lua_remove(L, -2);
+
+    args.L = L;
+    args.origs = top + 1;
+    args.visited = top + 2;
+    args.level = 0;
+    args.opened = 0;
+    args.spent = 0;
+    rc = SendOK(s, (Writer)df, &args);
+    lua_settop(L, top);
+    return rc;
+}
+
+int df(Args_df * args, SocketBuf * sb)
+{
+    diffTable(args, sb);
+    return 0;
+}
+
+typedef struct
+{
+    lua_State * L;
+    const char * field; //of the records aggregated, NULL for the values themselves
+    int top;        //entries to keep for the top
+    int budget;     //entries to look at
+    int entries;    //looked at
+    int spent;      //were there more entries than the budget?
+    int types[LUA_TTHREAD + 1]; //values by lua_type
+    int numbers;    //values which are numbers other than NaN
+    double sum;
+    double min;
+    double max;
+    int kept;       //entries in the top
+    double values[Q_MAX_TOP];   //of the top, from the greatest on
+    int keys;       //index in L of the table of the keys of the top, by rank
+} Args_q;
+
+/*
+** Push the value to aggregate of the entry whose value is on top of L: the
+** value itself, or the field of it when it's a record, nil for none.
+*/
+static void pushAggregated(Args_q * args)
+{
+    lua_State * L = args->L;
+
+    if (!args->field) {
+        lua_pushvalue(L, -1);
+    }
+    else if (!lua_istable(L, -1)) {
+        lua_pushnil(L);
+    }
+    else if (args->field[0] == '|') {
+        if (!lookupField(L, args->field))
+            lua_pushnil(L);
+    }
+    else {
+        lua_pushstring(L, args->field);
+        lua_rawget(L, -2);
+    }
+}
+
+/*
+** Take the number d of the entry whose key is at -2 of L into the top, if it's
+** greater than the least there or the top isn't full.
+*/
+static void keepTop(Args_q * args, double d)
+{
+    lua_State * L = args->L;
+    int i;
+
+    if (args->kept == args->top && (!args->top || d <= args->values[args->kept - 1]))
+        return;
+    if (args->kept < args->top)
+        args->kept++;
+    for (i = args->kept - 1; i > 0 && args->values[i - 1] < d; i--) {
+        args->values[i] = args->values[i - 1];
+        lua_rawgeti(L, args->keys, i);
+        lua_rawseti(L, args->keys, i + 1);
+    }
+    args->values[i] = d;
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, args->keys, i + 1);
+}
+
+static int q(Args_q * args, SocketBuf * sb);
+
+/*
+** Input format:
+** q <level> <l|u|g> <name>[fields] [.<field>] [k<count>] [b<entries>]
+** or:
+** q [fields] [.<field>] [k<count>] [b<entries>]
+**
+** Output format:
+** OK
+** Entries
+** Spent
+** Numbers
+** Sum
+** Min
+** Max
+** Kinds
+** Type
+** Count
+** ...
+** Kept
+** Key
+** Value
+** ...
+**
+** Aggregate the values of a table, or with .<field> the field of its records,
+** which is either a key of string or the fields of a path like |s"size"|n1.
+** Of the values, Numbers are the numbers, NaN left out, with their sum, min
+** and max; Kinds is the number of types they are of, each followed by its
+** letter as in a filter (see Filter) and the number of values of it; and Kept
+** is the number of entries in the top, which are those of the greatest
+** numbers, up to count, from the greatest on, each by its key and the
+** number. At most the budget of entries are looked at, in the order of
+** lua_next; Spent tells if there were more.
+** L stays unchanged.
+*/
+int query(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+{
+    const char * err;
+    Args_q args;
+    int top = lua_gettop(L);
+    int invalid = 0;
+    int i;
+    int rc;
+
+    args.L = L;
+    args.field = NULL;
+    args.top = Q_TOP;
+    args.budget = Q_BUDGET;
+
+    err = pushPath(L, ar, argv, argc, &i);
+    if (err)
+        return SendErr(s, "%s", err);
+
+    if (i < argc && argv[i][0] == '.') {
+        args.field = argv[i] + 1;
+        if (!*args.field)
+            invalid = 1;
+        i++;
+    }
+    if (i < argc && argv[i][0] == 'k') {
+        char * p;
+        args.top = strtol(argv[i] + 1, &p, 10);
+        if (*p || p == argv[i] + 1 || args.top < 0 || args.top > Q_MAX_TOP)
+            invalid = 1;
+        i++;
+    }
+    if (i < argc && argv[i][0] == 'b') {
+        char * p;
+        args.budget = strtol(argv[i] + 1, &p, 10);
+        if (*p || args.budget < 1)
+            invalid = 1;
+        i++;
+    }
+    if (i < argc || invalid || !lua_istable(L, -1)) {
+        lua_settop(L, top);
+        return SendErr(s, invalid || i < argc ? "Invalid argument!" : "Not a table!");
+    }
+
+    args.entries = 0;
+    args.spent = 0;
+    memset(args.types, 0, sizeof(args.types));
+    args.numbers = 0;
+    args.sum = 0;
+    args.min = 0;
+    args.max = 0;
+    args.kept = 0;
+    lua_createtable(L, args.top, 0);
+    args.keys = top + 2;
+
+    lua_pushnil(L);
+    while (lua_next(L, top + 1)) {
+        if (args.entries == args.budget) {
+            args.spent = 1;
+            lua_pop(L, 2);
+            break;
+        }
+        args.entries++;
+        pushAggregated(&args);
+        args.types[lua_type(L, -1)]++;
+        if (lua_type(L, -1) == LUA_TNUMBER) {
+            double d = (double)lua_tonumber(L, -1);
+            if (d == d) {
+                if (!args.numbers || d < args.min)
+                    args.min = d;
+                if (!args.numbers || d > args.max)
+                    args.max = d;
+                args.numbers++;
+                args.sum += d;
+                lua_pop(L, 1);
+                keepTop(&args, d);
+                lua_pop(L, 1);
+                continue;
+            }
+        }
+        lua_pop(L, 2);
+    }
+
+    rc = SendOK(s, (Writer)q, &args);
+    lua_settop(L, top);
+    return rc;
+}
+
+int q(Args_q * args, SocketBuf * sb)
+{
+    static const char letters[] = "lbUnstfud";   //by LUA_TNIL to LUA_TTHREAD
+    lua_State * L = args->L;
+    char letter[2] = { 0, 0 };
+    int kinds = 0;
+    int i;
+
+    SB_Print(sb, "%d\n%d\n%d\nn%N\nn%N\nn%N\n", args->entries, args->spent,
+        args->numbers, args->sum, args->min, args->max);
+    for (i = 0; i <= LUA_TTHREAD; i++)
+        if (args->types[i])
+            kinds++;
+    SB_Print(sb, "%d\n", kinds);
+    for (i = 0; i <= LUA_TTHREAD; i++) {
+        if (args->types[i]) {
+            letter[0] = letters[i];
+            SB_Print(sb, "%s\n%d\n", letter, args->types[i]);
+        }
+    }
+
+    SB_Print(sb, "%d\n", args->kept);
+    for (i = 0; i < args->kept; i++) {
+        lua_rawgeti(L, args->keys, i + 1);
+        printKey(sb, L);
+        lua_pop(L, 1);
+        lua_pushnumber(L, (lua_Number)args->values[i]);
+        printVar(sb, NULL, L);
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+static int ps(lua_State * L, SocketBuf * sb);
+
+/*
+** Input format:
+** ps
+**
+** Output format:
+** OK
+** File
+** Line Number
+** Function Name
+** Name What
+** File
+** Line Number
+** Function Name
+** Name What
+** ...
+**
+** L stays unchanged.
+*/
+int printStack(lua_State * L, SOCKET s)
+{
+    return SendOK(s, (Writer)ps, L);
+}
+
+/*
+** Print where the function of ar is, as ps does. A function called by a tail
+** call has "" for its name, which isn't a word, so it's "[N/A]" as well. All
+** but the line number are interned, as frames recur from break to break.
+*/
+static void printFrame(SocketBuf * sb, lua_Debug * ar)
+{
+    SB_Intern(sb, 1);
+    SB_Print(sb, "%s\n", ar->short_src);
+    SB_Intern(sb, 0);
+    SB_Print(sb, "%d\n", ar->currentline);
+    SB_Intern(sb, 1);
+    SB_Print(sb, "%s\n%s\n", ar->name && *ar->name ? ar->name : "[N/A]",
+        *ar->what ? ar->what : "[N/A]");
+    SB_Intern(sb, 0);
+}
+
+int ps(lua_State * L, SocketBuf * sb)
+{
+    struct lua_Debug ar;
+    int i = 0;
+
+    while (lua_getstack(L, i, &ar)) {
+        lua_getinfo(L, "nSl", &ar);
+        printFrame(sb, &ar);
+        i++;
+    }
+    return 0;
+}
+
+typedef struct
+{
+    lua_State * L;
+    size_t frame;   //budget of a frame, 0 for no limit
+    size_t total;   //budget of all frames, 0 for no limit
+} Args_ss;
+
+static int ss(Args_ss * args, SocketBuf * sb);
+
+/*
+** Input format:
+** ss [frame bytes [total bytes]]
+**
+** Output format:
+** OK
+** File
+** Line Number
+** Function Name
+** What
+** Number of locals
+** Name Value
+** ...
+** Number of up variables
+** Name Value
+** ...
+** File
+** ...
+**
+** Take a snapshot of the stack: each frame as ps shows it, with its locals
+** and up variables as ll and lu do. Once a frame takes the bytes given, each
+** of its values left is "~"; once all take the total, the frames left are
+** replaced by "~". Zero for bytes means no limit.
+** L stays unchanged.
+*/
+int snapStack(lua_State * L, char * argv[], int argc, SOCKET s)
+{
+    Args_ss args;
+    char * end;
+
+    args.L = L;
+    args.frame = SS_FRAME_BUDGET;
+    args.total = SS_TOTAL_BUDGET;
+    if (argc > 0) {
+        args.frame = strtoul(argv[0], &end, 10);
+        if (*end)
+            return SendErr(s, "Invalid argument!");
+    }
+    if (argc > 1) {
+        args.total = strtoul(argv[1], &end, 10);
+        if (*end)
+            return SendErr(s, "Invalid argument!");
+    }
+    return SendOK(s, (Writer)ss, &args);
+}
+
+/*
+** Print a variable of a frame starting at start bytes of sb, or "~" for its
+** value when the frame is over budget. The value is on top of L.
+*/
+static void snapVar(Args_ss * args, SocketBuf * sb, const char * name, size_t start)
+{
+    if (args->frame && SB_Size(sb) - start > args->frame)
+        SB_Print(sb, "%s\n~\n", name);
+    else
+        printVar(sb, name, args->L);
+}
+
+int ss(Args_ss * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    lua_Debug ar;
+    const char * name;
+    size_t start;
+    int level;
+    int n;
+    int i;
+
+    for (level = 0; lua_getstack(L, level, &ar); level++) {
+        start = SB_Size(sb);
+        if (args->total && start > args->total) {
+            SB_Print(sb, "~\n");
+            break;
+        }
+        lua_getinfo(L, "nSlf", &ar);
+        printFrame(sb, &ar);
+
+        for (n = 0, i = 1; (name = lua_getlocal(L, &ar, i)); i++) {
+            if (name[0] != '(')   //(*temporary)
+                n++;
+            lua_pop(L, 1);
+        }
+        SB_Print(sb, "%d\n", n);
+        for (i = 1; (name = lua_getlocal(L, &ar, i)); i++) {
+            if (name[0] != '(')
+                snapVar(args, sb, name, start);
+            lua_pop(L, 1);
+        }
+
+        for (n = 0; lua_getupvalue(L, -1, n + 1); n++)
+            lua_pop(L, 1);
+        SB_Print(sb, "%d\n", n);
+        for (i = 1; (name = lua_getupvalue(L, -1, i)); i++) {
+            snapVar(args, sb, *name ? name : "[N/A]", start);   //C upvalues have no names
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    return 0;
+}
+
+typedef struct
+{
+    char path[_MAX_PATH + 1];
+    int line;
+    int bound;
+} Args_sb;
+
+/*
+** Resolve file into the full path of an existing file in args->path. A file
+** with no chunk indexed yet is indexed if it's loaded, see indexLoaded.
+** Return 1 when success, or 0 when the path is invalid.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static int resolvePath(lua_State * L, const char * src, const char * file, Args_sb * args)
+{
+    int indexed;
+
+    if (!strcmp(file, "."))
+        file = src;
+    if (!getFullPath(file, args->path) || _access(args->path, 0))
+        return 0;
+
+    lua_pushliteral(L, "chunks");
+    lua_rawget(L, -2);
+    lua_pushstring(L, args->path);
+    lua_rawget(L, -2);
+    indexed = lua_istable(L, -1);
+    lua_pop(L, 2);
+    if (!indexed)
+        indexLoaded(L, args->path);
+    return 1;
+}
+
+/*
+** Set or delete the breakpoint at args->path and line. The resolved line and
+** whether it's bound are put in args->line and args->bound.
+** The chunks on the stack must have been indexed, see indexStack.
+** Return NULL when success, or an error message.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+static const char * putBreakPoint(lua_State * L, int line, int del, Args_sb * args)
+{
+    args->line = line;
+    lua_pushliteral(L, "chunks");
+    lua_rawget(L, -2);
+    lua_pushstring(L, args->path);
+    lua_rawget(L, -2);
+    args->bound = lua_istable(L, -1);
+    if (args->bound)
+        args->line = snapLine(L, line);
+    lua_pop(L, 2);
+
+    if (!args->line)
+        return "No code at or after the line!";
+
+    setLine(L, "breakpoints", args->path, args->line, !del);
+    if (!args->bound)
+        setLine(L, "pending", args->path, args->line, !del);
+    return NULL;
+}
+
+static int sb(Args_sb * args, SocketBuf * sb);
+
+/*
+** Input format:
+** sb <File> <Line>
+** or:
+** db <File> <Line>
+**
+** Output format:
+** OK
+** File
+** Line Number
+** Bound
+**
+** When the file has been loaded, the line is moved to the first line holding
+** code at or after it, and the breakpoint is bound(1). Otherwise it's pending(0)
+** until the file is loaded. The resolved location is returned.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int setBreakPoint(lua_State * L, const char * src, char * argv[], int argc, int del, SOCKET s)
+{
+    int line;
+    const char * err;
+    Args_sb args;
+
+    if (argc < 2 || (line = strtol(argv[1], NULL, 10)) <= 0) {
+        return SendErr(s, "Invalid argument!");
+    }
+
+    //The file may be loaded while the hook was off; look at the stack.
+    indexStack(L);
+    if (!resolvePath(L, src, argv[0], &args)) {
+        return SendErr(s, "Invalid path!");
+    }
+
+    err = putBreakPoint(L, line, del, &args);
+    if (err) {
+        return SendErr(s, "%s", err);
+    }
+    return SendOK(s, (Writer)sb, &args);
+}
+
+int sb(Args_sb * args, SocketBuf * sb)
+{
+    SB_Print(sb, "%s\n%d\n%d\n", args->path, args->line, args->bound);
+    return 0;
+}
+
+typedef struct
+{
+    lua_State * L;
+    const char * src;
+    char * body;
+} Args_bb;
+
+static int bb(Args_bb * args, SocketBuf * sb);
+
+/*
+** Input format:
+** bb [c]
+** File
+** Line Number
+** File
+** Line Number
+** ...
+**
+** Output format:
+** OK
+** File
+** Line Number
+** Bound
+** File
+** Line Number
+** Bound
+** ...
+**
+** Set a batch of breakpoints in one message. With option c, all existing
+** breakpoints are deleted first. Each breakpoint is reported as sb does, but
+** a rejected one is reported as given with Bound being -1.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int setBreakPoints(lua_State * L, const char * src, char * argv[], int argc, char * body, SOCKET s)
+{
+    Args_bb args;
+
+    if (argc > 1 || (argc == 1 && strcmp(argv[0], "c"))) {
+        return SendErr(s, "Invalid argument!");
+    }
+
+    if (argc == 1) {
+        lua_pushliteral(L, "breakpoints");
+        lua_newtable(L);
+        lua_rawset(L, -3);
+        lua_pushliteral(L, "pending");
+        lua_newtable(L);
+        lua_rawset(L, -3);
+    }
+
+    indexStack(L);
+    args.L = L;
+    args.src = src;
+    args.body = body;
+    return SendOK(s, (Writer)bb, &args);
+}
+
+int bb(Args_bb * args, SocketBuf * sb)
+{
+    char * p = args->body;
+    char lastFile[_MAX_PATH + 1] = "";
+    int valid = 0;
+    Args_sb bp;
+
+    while (p && *p) {
+        char * file = p;
+        char * lineStr;
+        int line;
+
+        lineStr = strchr(file, '\n');
+        if (!lineStr)
+            break;
+        *lineStr++ = 0;
+        p = strchr(lineStr, '\n');
+        if (p)
+            *p++ = 0;
+        line = strtol(lineStr, NULL, 10);
+
+        //Batches usually hold runs of the same file, so resolve it once a run.
+        if (strcmp(file, lastFile)) {
+            strncpy(lastFile, file, _MAX_PATH);
+            lastFile[_MAX_PATH] = 0;
+            valid = resolvePath(args->L, args->src, file, &bp);
+        }
+        if (line <= 0 || !valid || putBreakPoint(args->L, line, 0, &bp))
+            SB_Print(sb, "%s\n%s\n-1\n", file, lineStr);
+        else
+            SB_Print(sb, "%s\n%d\n%d\n", bp.path, bp.line, bp.bound);
+    }
+    return 0;
+}
+
+static int lb(lua_State * L, SocketBuf * sb);
+
+/*
+** Input format:
+** lb
+**
+** Output format:
+** OK
+** File
+** Line Number
+** Bound
+** File
+** Line Number
+** Bound
+** ...
+**
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+int listBreakPoints(lua_State * L, SOCKET s)
+{
+    return SendOK(s, (Writer)lb, L);
+}
+
+int lb(lua_State * L, SocketBuf * sb)
+{
+    int i, n;
+    int top = lua_gettop(L);
+
+    lua_pushliteral(L, "pending");
+    lua_rawget(L, -2);
+    lua_pushliteral(L, "breakpoints");
+    lua_rawget(L, -3);
+    n = sortKey(L);
+
+    for (i = 1; i <= n; i++) {
+        int j, m;
+        const char * path;
+
+        lua_rawgeti(L, -1, i);
+        path = lua_tostring(L, -1);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -5);  //pending lines of the file
+        lua_insert(L, -2);
+        lua_rawget(L, -4);
+        assert(lua_istable(L, -1));
+
+        m = sortKey(L);
+        for (j = 1; j <= m; j++) {
+            int line, bound = 1;
+            lua_rawgeti(L, -1, j);
+            line = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            if (lua_istable(L, -3)) {
+                lua_rawgeti(L, -3, line);
+                bound = lua_isnil(L, -1);
+                lua_pop(L, 1);
+            }
+            SB_Intern(sb, 1);
+            SB_Print(sb, "%s\n", path);
+            SB_Intern(sb, 0);
+            SB_Print(sb, "%d\n%d\n", line, bound);
+        }
+        lua_pop(L, 3);
+    }
+    lua_pop(L, 3);
+    assert(top == lua_gettop(L));
+    return 0;
+}
+
+/*
+** Given a table on top of L, it sorts the keys of that table and stores
+** the sorted keys in a new table returned on top of L. Thus L increases by 1.
+** Return the length of the new table.
+*/
+int sortKey(lua_State * L)
+{
+    int i = 1;
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, -3)) {
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -4, i++);
+        lua_pop(L, 1);
+    }
+
+    lua_getglobal(L, "table");
+    lua_getfield(L, -1, "sort");
+    lua_pushvalue(L, -3);
+    lua_call(L, 1, 0);
+    lua_pop(L, 1);
+    return i - 1;
+}
+
+/*
+** Push the compiled chunk of an expression or, failing that, of a statement
+** list given by text. Compiled chunks are cached in the "exprs" table.
+** Return 1 when success, or 0 and push the error message.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+static int pushChunk(lua_State * L, DebuggerInfo * info, const char * text)
+{
+    lua_pushliteral(L, "exprs");
+    lua_rawget(L, -2);
+    lua_pushstring(L, text);
+    lua_rawget(L, -2);
+    if (lua_isfunction(L, -1)) {
+        lua_remove(L, -2);
+        return 1;
+    }
+    lua_pop(L, 1);
+
+    lua_pushliteral(L, "return ");
+    lua_pushstring(L, text);
+    lua_concat(L, 2);
+    if (luaL_loadbuffer(L, lua_tostring(L, -1), lua_objlen(L, -1), "=exec")) {
+        lua_pop(L, 2);
+        if (luaL_loadbuffer(L, text, strlen(text), "=exec")) {
+            lua_remove(L, -2);
+            return 0;
+        }
+    }
+    else {
+        lua_remove(L, -2);
+    }
+
+    if (info->exprs >= EXEC_CACHE_MAX) { //start over with an empty cache
+        lua_pushliteral(L, "exprs");
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_replace(L, -5);
+        lua_rawset(L, -5);
+        info->exprs = 0;
+    }
+    lua_pushstring(L, text);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+    info->exprs++;
+    lua_remove(L, -2);
+    return 1;
+}
+
+/*
+** Look up a local or an up variable named name of the function at ar in the
+** thread T. The last local of the name wins, as lookupVar does.
+** Return its index and set *up to tell if it's an up variable, or return 0.
+*/
+static int findVar(lua_State * T, lua_Debug * ar, const char * name, int * up)
+{
+    int i = 1;
+    int found = 0;
+    const char * p;
+
+    while ((p = lua_getlocal(T, ar, i))) {
+        lua_pop(T, 1);
+        if (!strcmp(p, name))
+            found = i;
+        i++;
+    }
+    *up = 0;
+    if (found)
+        return found;
+
+    lua_getinfo(T, "f", ar);
+    for (i = 1; (p = lua_getupvalue(T, -1, i)); i++) {
+        lua_pop(T, 1);
+        if (!strcmp(p, name)) {
+            found = i;
             break;
         }
     }
+    lua_pop(T, 1);
+    *up = 1;
+    return found;
 }
 
-typedef struct
-{
-    lua_State * L;
-    lua_Debug * ar;
-} Args_ll;
-
-static int ll(Args_ll * args, SocketBuf * sb);
-
 /*
-** Input format:
-** ll [stack level]
-**
-** Output format:
-** OK
-** Name Value
-** Name Value
-** ...
-**
-** L stays unchanged.
+** __index and __newindex of the environment of an evaluated expression. Names
+** are resolved to the locals, then the up variables, and then the globals of
+** the frame the expression is evaluated in. The upvalues are the debugged
+** thread, the stack level of the frame and the frame's environment.
 */
-int listLocals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+static int envIndex(lua_State * L)
 {
-    struct lua_Debug AR;
-    int level;
-    Args_ll args;
+    lua_State * T = lua_tothread(L, lua_upvalueindex(1));
+    lua_Debug ar;
+    int i, up;
 
-    if (argc > 0) {
-        level = strtol(argv[0], NULL, 10);
-    }
-    else {
-        level = 1;
+    if (lua_type(L, 2) == LUA_TSTRING
+        && lua_getstack(T, lua_tointeger(L, lua_upvalueindex(2)), &ar)
+        && (i = findVar(T, &ar, lua_tostring(L, 2), &up))) {
+        if (up) {
+            lua_getinfo(T, "f", &ar);
+            lua_getupvalue(T, -1, i);
+            lua_remove(T, -2);
+        }
+        else {
+            lua_getlocal(T, &ar, i);
+        }
+        lua_xmove(T, L, 1);
+        return 1;
     }
+    lua_pushvalue(L, 2);
+    lua_gettable(L, lua_upvalueindex(3));
+    return 1;
+}
 
-    if (--level != 0) {
-        if (!lua_getstack(L, level, &AR)) {
-            return SendErr(s, "No local variable info available at stack level %d.",
-                level + 1);
+static int envNewIndex(lua_State * L)
+{
+    lua_State * T = lua_tothread(L, lua_upvalueindex(1));
+    lua_Debug ar;
+    int i, up;
+
+    if (lua_type(L, 2) == LUA_TSTRING
+        && lua_getstack(T, lua_tointeger(L, lua_upvalueindex(2)), &ar)
+        && (i = findVar(T, &ar, lua_tostring(L, 2), &up))) {
+        if (up) {
+            lua_getinfo(T, "f", &ar);
+            lua_pushvalue(L, 3);
+            lua_xmove(L, T, 1);
+            lua_setupvalue(T, -2, i);
+            lua_pop(T, 1);
         }
-        ar = &AR;
+        else {
+            lua_pushvalue(L, 3);
+            lua_xmove(L, T, 1);
+            lua_setlocal(T, &ar, i);
+        }
+        return 0;
     }
-    args.L = L;
-    args.ar = ar;
-    return SendOK(s, (Writer)ll, &args);
+    lua_settop(L, 3);
+    lua_settable(L, lua_upvalueindex(3));
+    return 0;
 }
 
-int ll(Args_ll * args, SocketBuf * sb)
+/*
+** Set by budgetHook, so that an evaluation aborted for running too long can be
+** told from one that failed.
+*/
+static int g_overBudget = 0;
+
+static void budgetHook(lua_State * L, lua_Debug * ar)
 {
-    int i = 1;
-    const char * name;
+    g_overBudget = 1;
+    luaL_error(L, "Instruction budget exceeded!");
+}
 
-    while ((name = lua_getlocal(args->L, args->ar, i++))) {
-        if (name[0] != '(')   //(*temporary)
-            printVar(sb, name, args->L);
-        lua_pop(args->L, 1);
+/*
+** Evaluate text, an expression or statements, in the function at ar, which is
+** at the stack level. Evaluation runs in a new coroutine, so that the hook of
+** the debugged thread isn't triggered and a count hook can abort it when it
+** runs EXEC_BUDGET instructions.
+** Return 1 and push the coroutine, holding the results on its stack, when
+** success; otherwise return 0 and push the error message.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+static int evaluate(lua_State * L, lua_Debug * ar, int level, const char * text, DebuggerInfo * info)
+{
+    lua_State * co;
+
+    if (!pushChunk(L, info, text))
+        return 0;
+
+    //Make the environment: a proxy of the frame's variables.
+    lua_newtable(L);
+    lua_createtable(L, 0, 2);
+    lua_pushliteral(L, "__index");
+    lua_pushthread(L);
+    lua_pushinteger(L, level - 1);
+    lua_getinfo(L, "f", ar);
+    lua_getfenv(L, -1);
+    lua_remove(L, -2);
+    lua_pushvalue(L, -3);
+    lua_pushvalue(L, -3);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, envIndex, 3);
+    lua_insert(L, -4);
+    lua_pushcclosure(L, envNewIndex, 3);
+    lua_pushliteral(L, "__newindex");
+    lua_insert(L, -2);
+    lua_rawset(L, -5);
+    lua_rawset(L, -3);
+    lua_setmetatable(L, -2);
+    lua_setfenv(L, -2);
+
+    co = lua_newthread(L);
+    lua_insert(L, -2);
+    lua_xmove(L, co, 1);
+    lua_sethook(co, budgetHook, LUA_MASKCOUNT, EXEC_BUDGET);
+    if (lua_pcall(co, 0, LUA_MULTRET, 0)) {
+        if (lua_isstring(co, -1))
+            lua_xmove(co, L, 1);
+        else
+            lua_pushliteral(L, "(error object is not a string)");
+        lua_remove(L, -2);
+        return 0;
     }
-    return 0;
+    return 1;
 }
 
-static int lu(lua_State * L, SocketBuf * sb);
+static int e(lua_State * co, SocketBuf * sb);
 
 /*
 ** Input format:
-** lu [stack level]
+** e <level>
+** Chunk
+** or:
+** e <level> <chunk>
 **
 ** Output format:
 ** OK
-** Name Value
-** Name Value
+** Value
+** Value
 ** ...
 **
-** L stays unchanged.
+** Evaluate an expression, or run statements, in the function at the stack
+** level, with its locals and up variables visible and assignable. The results
+** are returned.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
 */
-int listUpVars(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+int exec(lua_State * L, lua_Debug * ar, char * argv[], int argc, char * body, DebuggerInfo * info)
 {
-    struct lua_Debug AR;
+    lua_Debug AR;
+    const char * text = body ? body : (argc > 1 ? argv[1] : NULL);
     int level;
     int rc;
 
-    if (argc > 0) {
-        level = strtol(argv[0], NULL, 10);
-    }
-    else {
-        level = 1;
+    if (argc < 1 || (level = strtol(argv[0], NULL, 10)) < 1 || !text || !*text) {
+        return SendErr(info->s, "Invalid argument!");
     }
 
-    if (--level != 0) {
-        if (!lua_getstack(L, level, &AR)) {
-            return SendErr(s, "No up variable info available at stack level %d.",
-                level + 1);
+    if (level != 1) {
+        if (!lua_getstack(L, level - 1, &AR)) {
+            return SendErr(info->s, "No function at stack level %d.", level);
         }
         ar = &AR;
     }
 
-    lua_getinfo(L, "f", ar);
-    rc = SendOK(s, (Writer)lu, L);
+    if (evaluate(L, ar, level, text, info))
+        rc = SendOK(info->s, (Writer)e, lua_tothread(L, -1));
+    else
+        rc = SendErr(info->s, "%s", lua_tostring(L, -1));
     lua_pop(L, 1);
     return rc;
 }
 
-int lu(lua_State * L, SocketBuf * sb)
+int e(lua_State * co, SocketBuf * sb)
 {
-    int i = 1;
-    const char * name;
+    int i;
+    int n = lua_gettop(co);
 
-    while ((name = lua_getupvalue(L, -1, i++))) {
-        printVar(sb, name, L);
-        lua_pop(L, 1);
+    for (i = 1; i <= n; i++) {
+        lua_pushvalue(co, i);
+        printVar(sb, NULL, co);
+        lua_pop(co, 1);
     }
     return 0;
 }
 
-static int lg(lua_State * L, SocketBuf * sb);
-
 /*
 ** Input format:
-** lg [stack level]
+** m <addr> <len>
 **
 ** Output format:
 ** OK
-** Name Value
-** Name Value
-** ...
+** content
 **
-** L stays unchanged.
+** Warning:
+** This function may read an unreadable address and cause a hard/OS exception!
 */
-int listGlobals(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+int watchMemory(char * argv[], int argc, SOCKET s)
 {
-    struct lua_Debug AR;
-    int level;
-    int rc;
-
-    if (argc > 0) {
-        level = strtol(argv[0], NULL, 10);
-    }
-    else {
-        level = 1;
-    }
+    void * addr;
+    unsigned int len;
+    SocketBuf sb;
 
-    if (--level != 0) {
-        if (!lua_getstack(L, level, &AR)) {
-            return SendErr(s, "No global variable info available at stack level %d.",
-                level + 1);
-        }
-        ar = &AR;
+    if (argc < 2 || (addr = strtoptr(argv[0], NULL)) == 0
+        || (len = strtoul(argv[1], NULL, 0)) <= 0 || len > 0x7FFFFFFF
+        || (size_t)addr + len < (size_t)addr) //overflow!
+    {
+        return SendErr(s, "Invalid argument!");
     }
 
-    lua_getinfo(L, "f", ar);
-    lua_getfenv(L, -1);
-    assert(lua_istable(L, -1));
-    rc = SendOK(s, (Writer)lg, L);
-    lua_pop(L, 2);
-    return rc;
-}
-
-static int isID(const char * name)
-{
-    if (!(isalpha(*name) || *name == '_'))
-        return 0;
-    ++name;
-    while (isalnum(*name) || *name == '_')
-        ++name;
-    return !*name ? 1 : 0;
+    SB_Init(&sb, s);
+    AddResponseTag(&sb, "OK");
+    SB_Print(&sb, "%08x\n", len);
+    SB_AddRaw(&sb, addr, len);
+    return SB_Send(&sb);
 }
 
-int lg(lua_State * L, SocketBuf * sb)
+typedef struct
 {
-    lua_pushnil(L);
-    while (lua_next(L, -2)) {
-        if (lua_isstring(L, -2)) {
-            unsigned int len;
-            const char * name = lua_tolstring(L, -2, &len);
-            if (strlen(name) == len && isID(name))
-                printVar(sb, name, L);
-        }
-        lua_pop(L, 1);
-    }
-    return 0;
-}
+    const char * str;
+    int len;
+    int offset;
+    int length;     //bytes of the range
+    const char * pattern;
+    int patternLen;
+} Args_rs;
 
-static int lookupVar(lua_State * L, lua_Debug * ar, int level, char scope,
-    const char * name, int nameLen);
-static int lookupField(lua_State * L, const char * field);
-static int w(lua_State * L, SocketBuf * sb);
+static int rs(Args_rs * args, SocketBuf * sb);
 
 /*
 ** Input format:
-** w <level> <l|u|g> <name>[fields] [r]
+** rs <level> <l|u|g> <name>[fields] <offset>,<length> [pattern]
 ** or:
-** w [fields] [r]
+** rs [fields] <offset>,<length> [pattern]
 **
-** in which, fields have the form like |n123.4|b0|s"hello"|s008b917a|f006c4560|...
 ** Output format:
 ** OK
-** Detail
+** String Length:Offset:Bytes
+** content
+** or, with pattern:
+** OK
+** String Length
+** Match Offset
+** Match Offset
+** ...
 **
+** Read a string of any length by ranges, rather than the PROT_MAX_STR_LEN bytes
+** sent for it elsewhere. The string is given by a path as for w. At most length
+** of its bytes from offset are sent raw, after their numbers in 8 hex digits,
+** as m sends memory. With a pattern, the range is searched for it instead, and
+** the offsets of the first RS_MAX_MATCHES matches are sent, followed by "~"
+** when there are more.
 ** L stays unchanged.
 */
-int watch(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
+int readString(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
 {
-    int remember = 0;
-    char * fields;
+    Args_rs args;
+    const char * err;
+    size_t len;
+    char * p;
     int rc;
-    int top = lua_gettop(L);
-
-    if (argc >= 3) {
-        int level = strtol(argv[0], NULL, 10);
-        char scope = argv[1][0];
-        char * name = argv[2];
-        char * nameEnd = strchr(name, '|');
-        int nameLen = nameEnd ? nameEnd - name : strlen(name);
+    int i;
 
-        if (level < 1 || argv[1][1] != 0 || !(scope == 'l' || scope == 'u' || scope == 'g'))
-            return SendErr(s, "Invalid argument!");
-        if (!lookupVar(L, ar, level, scope, name, nameLen)) {
-            assert(lua_gettop(L) == top);
-            return SendErr(s, "Variable is not found!");
-        }
-        if (argc > 3 && !strcmp(argv[3], "r"))
-            remember = 1;
-        fields = nameEnd;
-    }
-    else {
-        lua_pushliteral(L, "cacheValue");
-        lua_rawget(L, -2);
-        if (lua_isnil(L, 1)) {
-            lua_pop(L, 1);
-            assert(lua_gettop(L) == top);
-            return SendErr(s, "Variable is not found!");
-        }
-        if (argc > 0)
-            fields = argv[0];
-        if (argc > 1 && !strcmp(argv[1], "r"))
-            remember = 1;
+    err = pushPath(L, ar, argv, argc, &i);
+    if (err)
+        return SendErr(s, "%s", err);
+    if (lua_type(L, -1) != LUA_TSTRING) {
+        lua_pop(L, 1);
+        return SendErr(s, "Not a string!");
     }
+    args.str = lua_tolstring(L, -1, &len);
 
-    if (fields && !lookupField(L, fields)) {
+    args.offset = i < argc ? strtol(argv[i], &p, 10) : -1;
+    args.length = i < argc && *p == ',' ? strtol(p + 1, &p, 10) : 0;
+    args.pattern = i + 1 < argc ? argv[i + 1] : NULL;
+    args.patternLen = args.pattern ? strlen(args.pattern) : 0;
+    if (args.offset < 0 || args.length < 1 || *p || i + 2 < argc
+        || (args.pattern && !args.patternLen) || len > 0x7FFFFFFF) {
         lua_pop(L, 1);
-        assert(lua_gettop(L) == top);
-        return SendErr(s, "Field is not found!");
+        return SendErr(s, "Invalid argument!");
     }
+    args.len = (int)len;
+    if (args.offset > args.len)
+        args.offset = args.len;
+    if (args.length > args.len - args.offset)
+        args.length = args.len - args.offset;
 
-    rc = SendOK(s, (Writer)w, L);
-    if (remember) {
-        lua_pushliteral(L, "cacheValue");
-        lua_insert(L, -2);
-        lua_rawset(L, fields ? -4 : -3);
-        if (fields)
-            lua_pop(L, 1);
+    if (args.pattern) {
+        rc = SendOK(s, (Writer)rs, &args);
     }
     else {
-        lua_pop(L, fields ? 2 : 1);
+        SocketBuf sb;
+        SB_Init(&sb, s);
+        AddResponseTag(&sb, "OK");
+        SB_Print(&sb, "%08x:%08x:%08x\n", args.len, args.offset, args.length);
+        SB_AddRaw(&sb, args.str + args.offset, args.length);
+        rc = SB_Send(&sb);
     }
-
-    assert(lua_gettop(L) == top);
+    lua_pop(L, 1);
     return rc;
 }
 
-/*
-** Look up a lua variable with specified stack level, scope and name.
-** Return 1 when found and push it on top of L; otherwise 0 is returned and
-** L stays unchanged.
-*/
-int lookupVar(lua_State * L, lua_Debug * ar, int level, char scope, const char * name, int nameLen)
+int rs(Args_rs * args, SocketBuf * sb)
 {
-    lua_Debug AR;
-    int found = 0;
-
-    if (level != 1) {
-        if (!lua_getstack(L, level - 1, &AR))
-            return 0;
-        ar = &AR;
-    }
-
-    if (scope == 'l') {
-        int i = 1;
-        const char * p;
+    const char * p = args->str + args->offset;
+    const char * last = p + args->length - args->patternLen;  //where a match starts at most
+    int n = 0;
 
-        lua_pushnil(L); //place holder
-        while ((p = lua_getlocal(L, ar, i++))) {
-            if (!strncmp(p, name, nameLen)) {
-                found = 1;
-                lua_replace(L, -2); //The same name may have multi values(though it's odd!), use the last!
-            }
-            else {
-                lua_pop(L, 1);
-            }
-        }
-        if (!found)
-            lua_pop(L, 1);
-    }
-    else if (scope == 'u') {
-        int i = 1;
-        const char * p;
+    SB_Print(sb, "%d\n", args->len);
+    if (args->length < args->patternLen)
+        return 0;
 
-        lua_getinfo(L, "f", ar);
-        while ((p = lua_getupvalue(L, -1, i++))) {
-            if (!strncmp(p, name, nameLen)) {
-                found = 1;
+    while (p <= last && (p = (const char *)memchr(p, args->pattern[0], last - p + 1))) {
+        if (!memcmp(p, args->pattern, args->patternLen)) {
+            if (n++ == RS_MAX_MATCHES) {
+                SB_Print(sb, "~\n");
                 break;
-            }
-            else {
-                lua_pop(L, 1);
-            }
-        }
-        lua_remove(L, found ? -2 : -1);
-    }
-    else {
-        lua_getinfo(L, "f", ar);
-        lua_getfenv(L, -1);
-        assert(lua_istable(L, -1));
-        lua_pushlstring(L, name, nameLen);
-        lua_gettable(L, -2);
-        if (lua_isnil(L, -1)) {
-            lua_pop(L, 3);
-        }
-        else {
-            found = 1;
-            lua_replace(L, -3);
-            lua_pop(L, 1);
+            }
+            SB_Print(sb, "%d\n", (int)(p - args->str));
         }
+        ++p;
     }
-
-    return found;
+    return 0;
 }
 
-static int nextField(const char * fields, const char ** begin, const char ** end)
+/*
+** Find the shortest sampling interval and the earliest due time among the
+** registered samples.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+*/
+static void scheduleSamples(lua_State * L, DebuggerInfo * info)
 {
-    assert(fields);
-    if (*fields++ != '|' || !*fields)
-        return 0;
+    int minInterval = 0;
+    double nextSample = 0;
 
-    *begin = fields;
-    if (fields[0] == 's' && fields[1] == '\'') {
-        while (1) {
-            const char * p = strchr(fields + 2, '\'');
-            if (!p)
-                return 0;
-            ++p;
-            if (*p != '|' && *p != 0)
-                return 0;
-            *end = p;
-            break;
-        }
-    }
-    else {
-        const char * p = strchr(fields + 1, '|');
-        *end = p ? p : fields + strlen(fields);
+    lua_pushliteral(L, "samples");
+    lua_rawget(L, -2);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        int interval;
+        double due;
+
+        lua_rawgeti(L, -1, SAMPLE_INTERVAL);
+        interval = lua_tointeger(L, -1);
+        lua_rawgeti(L, -2, SAMPLE_DUE);
+        due = lua_tonumber(L, -1);
+        lua_pop(L, 3);
+
+        if (!minInterval || interval < minInterval)
+            minInterval = interval;
+        if (!nextSample || due < nextSample)
+            nextSample = due;
     }
-    return 1;
+    lua_pop(L, 1);
+
+    info->minInterval = minInterval;
+    info->nextSample = nextSample;
 }
 
 /*
-** Get a table field by comparing its value's pointer and type with the specified
-** one.
-** Return 1 and push the value on top of L when success; otherwise return 0 and
-** push nothing.
+** Evaluate every sample that is due and append the result to the "sampleBuf"
+** table. Records are stored flatly, three slots for each: id, time and value.
+** A failed evaluation is recorded as nil, and one going over the budget as the
+** error message. Evaluation runs in a new coroutine with a count hook aborting
+** it, as e does, so that a sample looping or walking a huge table can't hang
+** the script from within the hook.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
 */
-static int getFieldValueByPtr(lua_State * L, void * ptr, int type)
+static void takeSamples(lua_State * L, DebuggerInfo * info, double now)
 {
+    int samples;
+    int buf;
+
+    lua_pushliteral(L, "samples");
+    lua_rawget(L, -2);
+    samples = lua_gettop(L);
+    lua_pushliteral(L, "sampleBuf");
+    lua_rawget(L, -3);
+    buf = lua_gettop(L);
+
     lua_pushnil(L);
-    while (lua_next(L, -2)) {
-        int t = lua_type(L, -1);
+    while (lua_next(L, samples)) {
+        lua_State * co;
+        double due;
+        int interval;
+        int overruns;
+        int n;
 
-        if (t == LUA_TTABLE || t == LUA_TFUNCTION || t == LUA_TTHREAD) {
-            if (lua_topointer(L, -1) == ptr) {
-                lua_remove(L, -2);
-                return 1;
-            }
+        lua_rawgeti(L, -1, SAMPLE_DUE);
+        due = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        if (due > now) {
+            lua_pop(L, 1);
+            continue;
         }
-        else if (t == LUA_TUSERDATA || t == LUA_TLIGHTUSERDATA) {
-            if (lua_touserdata(L, -1) == ptr) {
-                lua_remove(L, -2);
-                return 1;
+
+        lua_rawgeti(L, -1, SAMPLE_INTERVAL);
+        interval = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        due += interval;
+        if (due <= now)   //Never catch up with missed samples.
+            due = now + interval;
+        lua_pushnumber(L, due);
+        lua_rawseti(L, -2, SAMPLE_DUE);
+
+        n = info->pending * 3;
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, buf, n + 1);
+        lua_pushnumber(L, floor(now));
+        lua_rawseti(L, buf, n + 2);
+        co = lua_newthread(L);
+        lua_rawgeti(L, -2, SAMPLE_FN);
+        lua_xmove(L, co, 1);
+        lua_sethook(co, budgetHook, LUA_MASKCOUNT, EXEC_BUDGET);
+        g_overBudget = 0;
+        overruns = 0;
+        if (lua_pcall(co, 0, 1, 0)) {
+            if (g_overBudget) {
+                lua_rawgeti(L, -2, SAMPLE_OVERRUNS);
+                overruns = lua_tointeger(L, -1) + 1;
+                lua_pop(L, 1);
             }
-        }
-        else if (t == LUA_TSTRING) {
-            if (lua_tostring(L, -1) == ptr) {
-                lua_remove(L, -2);
-                return 1;
+            else {
+                lua_pop(co, 1);
+                lua_pushnil(co);
             }
         }
+        lua_xmove(co, L, 1);
+        lua_rawseti(L, buf, n + 3);
+        lua_pop(L, 1);
+        lua_pushinteger(L, overruns);
+        lua_rawseti(L, -2, SAMPLE_OVERRUNS);
 
+        if (!info->pending)
+            info->firstPending = now;
+        info->pending++;
         lua_pop(L, 1);
+
+        //Setting a field to nil is safe while traversing the table.
+        if (overruns >= SAMPLE_MAX_OVERRUNS) {
+            lua_pushvalue(L, -1);
+            lua_pushnil(L);
+            lua_rawset(L, samples);
+            info->samples--;
+        }
     }
-    return 0;
+    lua_pop(L, 2);
+    scheduleSamples(L, info);
 }
 
 /*
-** Get a table field. Return 1 and push the field value on top of L; otherwise
-** return 0 and push nothing.
-** The table is on top of L. The field is sth. like "n123.456", "f008bae20", etc.
+** Called on each count hook tick. Take the samples that are due, send them when
+** a batch is complete, and adjust the tick interval towards the shortest
+** sampling interval divided by SAMPLE_TICKS. The adjustment is limited to a
+** factor of 2 per tick so that a single long pause (e.g. in a blocking C call)
+** doesn't throw the estimate off.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+** Return -1 when a socket io error happens, or 0 when succeed.
 */
-static int getFieldValue(lua_State * L, const char * fieldBegin, const char * fieldEnd)
+int tick(lua_State * L, DebuggerInfo * info)
 {
-    char * end;
+    double now = getMilliseconds();
+    double elapsed = now - info->lastTick;
 
-    if (*fieldBegin == 'n') {
-        double num = strtod(fieldBegin + 1, &end);
-        if (end != fieldEnd)
-            return 0;
-        lua_pushnumber(L, num);
-        lua_gettable(L, -2);
-    }
-    else if (*fieldBegin == 's' && fieldBegin[1] == '\'') {
-        const char * str = fieldBegin + 2;
-        assert(*(fieldEnd - 1) == '\'');
-        lua_pushlstring(L, str, fieldEnd - str - 1);
-        lua_gettable(L, -2);
-    }
-    else if (*fieldBegin == 'b') {
-        int n = strtol(fieldBegin + 1, &end, 0);
-        if (end != fieldEnd)
-            return 0;
-        lua_pushboolean(L, n);
-        lua_gettable(L, -2);
-    }
-    else if (*fieldBegin == 'U') {
-        unsigned int ptr = strtoul(fieldBegin + 1, &end, 0);
-        if (end != fieldEnd)
-            return 0;
-        lua_pushlightuserdata(L, (void *)ptr);
-        lua_gettable(L, -2);
-    }
-    else {
-        unsigned int ptr;
-        int t;
+    info->lastTick = now;
+    if (elapsed > 0 && info->samples) {
+        double count = info->tickCount * (info->minInterval / (double)SAMPLE_TICKS) / elapsed;
+        if (count > info->tickCount * 2.0)
+            count = info->tickCount * 2.0;
+        else if (count < info->tickCount / 2.0)
+            count = info->tickCount / 2.0;
+        if (count > SAMPLE_MAX_COUNT)
+            count = SAMPLE_MAX_COUNT;
+        else if (count < SAMPLE_MIN_COUNT)
+            count = SAMPLE_MIN_COUNT;
 
-        switch (*fieldBegin) {
-            case 't':
-                t = LUA_TTABLE;
-                break;
-            case 'u':
-                t = LUA_TTABLE;
-                break;
-            case 'f':
-                t = LUA_TTABLE;
-                break;
-            case 'd':
-                t = LUA_TTABLE;
-                break;
-            default:
-                return 0;
+        if ((int)count != info->tickCount) {
+            info->tickCount = (int)count;
+            lua_sethook(L, hook, lua_gethookmask(L), info->tickCount);
         }
-
-        ptr = strtoul(fieldBegin + 1, &end, 0);
-        if (end != fieldEnd)
-            return 0;
-        return getFieldValueByPtr(L, (void *)ptr, t);
     }
-    return 1;
+
+    if (info->samples && now >= info->nextSample)
+        takeSamples(L, info, now);
+
+    if (info->pending >= SAMPLE_BATCH
+        || (info->pending && now - info->firstPending >= SAMPLE_BATCH_MS))
+        return flushSamples(L, info);
+    return 0;
 }
 
+typedef struct
+{
+    lua_State * L;
+    int n;
+} Args_sp;
+
+static int sp(Args_sp * args, SocketBuf * sb);
+
 /*
-** Look up a field in a lua value on top of L. If the field is found, it's pushed
-** on top of L and 1 is returned; otherwise nothing is pushed and 0 is returned.
-** field is a descriptive string like '|n123|s"something"|f0088abe8|...'.
-** Specially, "|" is a field representing the value itself. And particularly,
-** "|m" is a legal field denoting the metatable. So surprisingly, any Lua value
-** , not limited to table, can have subfields, because according to offical Lua
-** document, "Every value in Lua may have a metatable". For example, consider
-** "a = 123", then for variable a, 'a|m|s"__add"' is legal.
+** Send all pending sample records in one SP message and start a new buffer.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
+** Return -1 when a socket io error happens, or 0 when succeed.
 */
-int lookupField(lua_State * L, const char * field)
+int flushSamples(lua_State * L, DebuggerInfo * info)
 {
-    const char * subfieldBegin;
-    const char * subfieldEnd;
+    Args_sp args;
+    int rc;
 
-    assert(field && *field);
+    lua_pushliteral(L, "sampleBuf");
+    lua_rawget(L, -2);
+    args.L = L;
+    args.n = info->pending * 3;
+    rc = SendSamples(info->s, (Writer)sp, &args);
+    lua_pop(L, 1);
 
-    lua_pushvalue(L, -1);
-    while (*field && nextField(field, &subfieldBegin, &subfieldEnd)) {
-        if (*subfieldBegin == 'm') {
-            if (!lua_getmetatable(L, -1))
-                break;
-        }
-        else {
-            if (!lua_istable(L, -1))
-                break;
-            if (!getFieldValue(L, subfieldBegin, subfieldEnd))
-                break;
-        }
-        lua_replace(L, -2);
-        field = subfieldEnd;
-    }
+    lua_pushliteral(L, "sampleBuf");
+    lua_newtable(L);
+    lua_rawset(L, -3);
+    info->pending = 0;
+    return rc;
+}
 
-    if (field[0] && !(field[0] == '|' && field[1] == 0)) {
+int sp(Args_sp * args, SocketBuf * sb)
+{
+    lua_State * L = args->L;
+    int i;
+
+    for (i = 1; i <= args->n; i += 3) {
+        lua_rawgeti(L, -1, i);
+        lua_rawgeti(L, -2, i + 1);
+        SB_Print(sb, "%d\n%N\n", lua_tointeger(L, -2), lua_tonumber(L, -1));
+        lua_pop(L, 2);
+        lua_rawgeti(L, -1, i + 2);
+        printVar(sb, NULL, L);
         lua_pop(L, 1);
-        return 0;
     }
-    return 1;
+    return 0;
 }
 
-int w(lua_State * L, SocketBuf * sb)
+static int sampleId(int * id, SocketBuf * sb);
+
+/*
+** Input format:
+** st <interval> <expression>
+**
+** Output format:
+** OK
+** Id
+**
+** The expression is compiled once and evaluated in the global environment every
+** interval milliseconds while the script runs, without stopping it. A sample
+** going over the budget of e SAMPLE_MAX_OVERRUNS times in a row is deleted.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int setSample(lua_State * L, DebuggerInfo * info, char * argv[], int argc)
 {
-    int t = lua_type(L, -1);
-    int meta;
-    if (t != LUA_TNIL && (meta = lua_getmetatable(L, -1)))
-        lua_pop(L, 1);
-    printVar(sb, NULL, L);
+    int interval;
+    int id;
+    double now;
 
-    switch (t) {
-        case LUA_TTABLE: {
-            SB_Print(sb, "%d\n", meta ? 1 : 0);
-            lua_pushnil(L);
-            while (lua_next(L, -2)) {
-                lua_pushvalue(L, -2);
-                printVar(sb, NULL, L);
-                lua_pop(L, 1);
-                printVar(sb, NULL, L);
-                lua_pop(L, 1);
-            }
-            break;
-        }
-        case LUA_TUSERDATA: {
-            int size = lua_objlen(L, -1);
-            SB_Print(sb, "%d\n%d\n", meta ? 1 : 0, size);
-            break;
-        }
-        case LUA_TFUNCTION: {
-            lua_Debug ar;
-            lua_pushvalue(L, -1);
-            lua_getinfo(L, ">S", &ar);
-            SB_Print(sb, "%d\n%s\n%s\n%d\n%d\n", meta ? 1 : 0, ar.what,
-                ar.short_src, ar.linedefined, ar.lastlinedefined);
-            break;
-        }
-        case LUA_TNUMBER: {
-            SB_Print(sb, "%d\n", meta ? 1 : 0);
-            break;
-        }
-        case LUA_TSTRING: {
-            SB_Print(sb, "%d\n", meta ? 1 : 0);
-            break;
-        }
-        case LUA_TBOOLEAN: {
-            SB_Print(sb, "%d\n", meta ? 1 : 0);
-            break;
-        }
-        case LUA_TLIGHTUSERDATA: {
-            SB_Print(sb, "%d\n", meta ? 1 : 0);
-            break;
-        }
-        case LUA_TTHREAD: {
-            int status = lua_status(lua_tothread(L, -1));
-            SB_Print(sb, "%d\n%d\n", meta ? 1 : 0, status);
-            break;
-        }
+    if (argc != 2 || (interval = strtol(argv[0], NULL, 10)) <= 0) {
+        return SendErr(info->s, "Invalid argument!");
+    }
+
+    lua_pushliteral(L, "return ");
+    lua_pushstring(L, argv[1]);
+    lua_concat(L, 2);
+    if (luaL_loadbuffer(L, lua_tostring(L, -1), lua_objlen(L, -1), "=sample")) {
+        int rc = SendErr(info->s, "%s", lua_tostring(L, -1));
+        lua_pop(L, 2);
+        return rc;
+    }
+
+    now = getMilliseconds();
+    lua_pushliteral(L, "samples");
+    lua_rawget(L, -4);
+    lua_createtable(L, 5, 0);
+    lua_pushvalue(L, -3);
+    lua_rawseti(L, -2, SAMPLE_FN);
+    lua_pushinteger(L, interval);
+    lua_rawseti(L, -2, SAMPLE_INTERVAL);
+    lua_pushnumber(L, now + interval);
+    lua_rawseti(L, -2, SAMPLE_DUE);
+    lua_pushstring(L, argv[1]);
+    lua_rawseti(L, -2, SAMPLE_EXPR);
+    lua_pushinteger(L, 0);
+    lua_rawseti(L, -2, SAMPLE_OVERRUNS);
+    id = ++info->lastSampleId;
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 3);
+
+    if (!info->samples++) {
+        info->tickCount = SAMPLE_INIT_COUNT;
+        info->lastTick = now;
     }
+    scheduleSamples(L, info);
+    return SendOK(info->s, (Writer)sampleId, &id);
+}
+
+int sampleId(int * id, SocketBuf * sb)
+{
+    SB_Print(sb, "%d\n", *id);
     return 0;
 }
 
-static int ps(lua_State * L, SocketBuf * sb);
+/*
+** Input format:
+** dt <id>
+**
+** Output format:
+** OK
+**
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int delSample(lua_State * L, DebuggerInfo * info, char * argv[], int argc)
+{
+    int id;
+
+    if (argc < 1 || (id = strtol(argv[0], NULL, 10)) <= 0) {
+        return SendErr(info->s, "Invalid argument!");
+    }
+
+    lua_pushliteral(L, "samples");
+    lua_rawget(L, -2);
+    lua_rawgeti(L, -1, id);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 2);
+        return SendErr(info->s, "Sample is not found!");
+    }
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+
+    info->samples--;
+    scheduleSamples(L, info);
+    return SendOK(info->s, NULL, NULL);
+}
+
+static int lt(lua_State * L, SocketBuf * sb);
 
 /*
 ** Input format:
-** ps
+** lt
 **
 ** Output format:
 ** OK
-** File
-** Line Number
-** Function Name
-** Name What
-** File
-** Line Number
-** Function Name
-** Name What
+** Id
+** Interval
+** Expression
+** Id
+** Interval
+** Expression
 ** ...
 **
-** L stays unchanged.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
 */
-int printStack(lua_State * L, SOCKET s)
+int listSamples(lua_State * L, SOCKET s)
 {
-    return SendOK(s, (Writer)ps, L);
+    return SendOK(s, (Writer)lt, L);
 }
 
-int ps(lua_State * L, SocketBuf * sb)
+int lt(lua_State * L, SocketBuf * sb)
 {
-    struct lua_Debug ar;
-    int i = 0;
+    int i, n;
+    int top = lua_gettop(L);
 
-    while (lua_getstack(L, i, &ar)) {
-        lua_getinfo(L, "nSl", &ar);
-        SB_Print(sb, "%s\n%d\n%s\n%s\n", ar.short_src, ar.currentline,
-            ar.name ? ar.name : "[N/A]", *ar.what ? ar.what : "[N/A]");
-        i++;
+    lua_pushliteral(L, "samples");
+    lua_rawget(L, -2);
+    n = sortKey(L);
+
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -4);
+        lua_rawgeti(L, -1, SAMPLE_INTERVAL);
+        lua_rawgeti(L, -2, SAMPLE_EXPR);
+        SB_Print(sb, "%d\n%d\n%s\n", lua_tointeger(L, -4), lua_tointeger(L, -2),
+            lua_tostring(L, -1));
+        lua_pop(L, 4);
     }
+    lua_pop(L, 2);
+    assert(top == lua_gettop(L));
     return 0;
 }
 
+static int tq(void * ud, SocketBuf * sb);
+
 /*
 ** Input format:
-** sb <File> <Line>
+** tq [<capacity> [o|n]]
+**
+** Output format:
+** OK
+** Capacity
+** Policy
+** Queued
+** Sent
+** Dropped
+**
+** Set the capacity of the queue of SP messages and whether the oldest (o) or
+** the newest (n) message is dropped when it's full, and report how many were
+** queued, sent and dropped so far (see SendQueue.h). The capacity reported is
+** the one set, rounded up to a power of 2.
+*/
+int setQueue(char * argv[], int argc, SOCKET s)
+{
+    SendQueueStats stats;
+    int capacity;
+    DropPolicy policy;
+
+    if (argc > 0) {
+        SQ_GetStats(&stats);
+        policy = stats.policy;
+        if (argc > 1 && (argv[1][1] || (argv[1][0] != 'o' && argv[1][0] != 'n')))
+            return SendErr(s, "Invalid argument!");
+        if (argc > 1)
+            policy = argv[1][0] == 'o' ? SQ_DROP_OLDEST : SQ_DROP_NEWEST;
+        capacity = strtol(argv[0], NULL, 10);
+        if (SQ_Configure(capacity, policy) < 0)
+            return SendErr(s, "Capacity is out of 1 to %d!", SQ_MAX_CAPACITY);
+    }
+    return SendOK(s, (Writer)tq, NULL);
+}
+
+int tq(void * ud, SocketBuf * sb)
+{
+    SendQueueStats stats;
+
+    SQ_GetStats(&stats);
+    SB_Print(sb, "%d\n%s\n%d\n%d\n%d\n", stats.capacity,
+        stats.policy == SQ_DROP_OLDEST ? "o" : "n", (int)stats.queued,
+        (int)stats.sent, (int)stats.dropped);
+    return 0;
+}
+
+/*
+** Split the watch path of a display in place into the arguments w takes for
+** it, see pushPath: <level> <l|u|g> <name>[fields], or [fields].
+** Return the number of arguments, or 0 when it's no such path.
+*/
+static int splitPath(char * path, char * argv[3])
+{
+    char * p = path;
+    int argc = 0;
+
+    while (*p && argc < 3) {
+        argv[argc++] = p;
+        p = strchr(p, ' ');
+        if (!p)
+            break;
+        *p++ = 0;
+    }
+    if (p && *p)
+        return 0;
+    return argc == 3 || (argc == 1 && argv[0][0] == '|') ? argc : 0;
+}
+
+/*
+** Push the value the watch path of a display refers to, as w does, or the
+** error message. Return 1 when the value is pushed, or 0 when the message is.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX.
+*/
+static int pushDisplayPath(lua_State * L, lua_Debug * ar, const char * text)
+{
+    char path[DISPLAY_MAX_PATH];
+    char * argv[3];
+    const char * err;
+    int argc;
+    int used;
+
+    strcpy(path, text);     //checked by setDisplay
+    argc = splitPath(path, argv);
+    err = pushPath(L, ar, argv, argc, &used);
+    if (err) {
+        lua_pushstring(L, err);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+** Input format:
+** sd <level>
+** Expression
 ** or:
-** db <File> <Line>
+** sd w
+** Path
 **
 ** Output format:
 ** OK
+** Id
 **
+** Register an expression to be evaluated in the function at the stack level at
+** every break, or a watch path as w takes it, see pushPath, to be looked up,
+** with the result sent in the BR message.
 ** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
 ** unchanged after call, but the "debugger" table may be changed.
 */
-int setBreakPoint(lua_State * L, const char * src, char * argv[], int argc, int del, SOCKET s)
+int setDisplay(lua_State * L, DebuggerInfo * info, char * argv[], int argc, char * body)
 {
-    int line;
-    const char * file;
-    char path[_MAX_PATH + 1];
+    char path[DISPLAY_MAX_PATH];
+    char * pathArgv[3];
+    int level;
+    int id;
 
-    if (argc < 2 || (line = strtol(argv[1], NULL, 10)) <= 0) {
-        return SendErr(s, "Invalid argument!");
+    if (argc < 1 || !body || !*body) {
+        return SendErr(info->s, "Invalid argument!");
+    }
+    if (!strcmp(argv[0], "w")) {
+        level = 0;
+        if (strlen(body) >= sizeof(path))
+            return SendErr(info->s, "Invalid argument!");
+        strcpy(path, body);
+        if (!splitPath(path, pathArgv))
+            return SendErr(info->s, "Invalid argument!");
+    }
+    else if ((level = strtol(argv[0], NULL, 10)) < 1) {
+        return SendErr(info->s, "Invalid argument!");
     }
 
-    if (!strcmp(argv[0], "."))
-        file = src;
-    else
-        file = argv[0];
+    lua_pushliteral(L, "displays");
+    lua_rawget(L, -2);
+    lua_createtable(L, 2, 0);
+    lua_pushinteger(L, level);
+    lua_rawseti(L, -2, DISPLAY_LEVEL);
+    lua_pushstring(L, body);
+    lua_rawseti(L, -2, DISPLAY_EXPR);
+    id = ++info->lastDisplayId;
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+    return SendOK(info->s, (Writer)sampleId, &id);
+}
 
-    if (!_fullpath(path, file, _MAX_PATH) || _access(path, 0)) {
-        return SendErr(s, "Invalid path!");
+/*
+** Input format:
+** dd <id>
+**
+** Output format:
+** OK
+**
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call, but the "debugger" table may be changed.
+*/
+int delDisplay(lua_State * L, DebuggerInfo * info, char * argv[], int argc)
+{
+    int id;
+
+    if (argc < 1 || (id = strtol(argv[0], NULL, 10)) <= 0) {
+        return SendErr(info->s, "Invalid argument!");
     }
-#ifdef OS_WIN
-    _strlwr(path);
-#endif
 
-    lua_pushliteral(L, "breakpoints");
-    lua_rawget(L, -2);
-    lua_pushstring(L, path);
+    lua_pushliteral(L, "displays");
     lua_rawget(L, -2);
+    lua_rawgeti(L, -1, id);
     if (lua_isnil(L, -1)) {
-        lua_pop(L, 1);
-        lua_newtable(L);
-        lua_pushstring(L, path);
-        lua_pushvalue(L, -2);
-        lua_rawset(L, -4);
+        lua_pop(L, 2);
+        return SendErr(info->s, "Display is not found!");
     }
-    if (del)
-        lua_pushnil(L);
-    else
-        lua_pushboolean(L, 1);
-    lua_rawseti(L, -2, line);
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
+    return SendOK(info->s, NULL, NULL);
+}
 
-    if (del) { //check if the path table is empty
-        lua_pushnil(L);
-        if (!lua_next(L, -2)) { //remove the entry from breakpoints table if it's empty
-            lua_pushstring(L, path);
-            lua_pushnil(L);
-            lua_rawset(L, -4);
-        }
-        else
-            lua_pop(L, 2);
+/*
+** Input format:
+** ds <depth>
+**
+** Output format:
+** OK
+**
+** Set how many stack frames are sent in the BR message, 0 for none.
+*/
+int setDisplayStack(DebuggerInfo * info, char * argv[], int argc)
+{
+    int depth;
+
+    if (argc < 1 || (depth = strtol(argv[0], NULL, 10)) < 0) {
+        return SendErr(info->s, "Invalid argument!");
     }
-    lua_pop(L, 2);
-    return SendOK(s, NULL, NULL);
+    info->stackDepth = depth;
+    return SendOK(info->s, NULL, NULL);
 }
 
-static int lb(lua_State * L, SocketBuf * sb);
+static int ld(lua_State * L, SocketBuf * sb);
 
 /*
 ** Input format:
-** lb
+** ld
 **
 ** Output format:
 ** OK
-** File
-** Line Number
-** File
-** Line Number
+** Id
+** Level
+** Expression
+** Id
+** Level
+** Expression
 ** ...
 **
+** The level of a watch path is w, and the path is sent as the expression.
 ** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
 ** unchanged after call.
 */
-int listBreakPoints(lua_State * L, SOCKET s)
+int listDisplays(lua_State * L, SOCKET s)
 {
-    return SendOK(s, (Writer)lb, L);
+    return SendOK(s, (Writer)ld, L);
 }
 
-static int sortKey(lua_State * L);
-
-int lb(lua_State * L, SocketBuf * sb)
+int ld(lua_State * L, SocketBuf * sb)
 {
     int i, n;
     int top = lua_gettop(L);
 
-    lua_pushliteral(L, "breakpoints");
+    lua_pushliteral(L, "displays");
     lua_rawget(L, -2);
     n = sortKey(L);
 
     for (i = 1; i <= n; i++) {
-        int j, m;
-        const char * path;
-
         lua_rawgeti(L, -1, i);
-        path = lua_tostring(L, -1);
-        lua_rawget(L, -3);
-        assert(lua_istable(L, -1));
-
-        m = sortKey(L);
-        for (j = 1; j <= m; j++) {
-            lua_rawgeti(L, -1, j);
-            SB_Print(sb, "%s\n%d\n", path, lua_tointeger(L, -1));
-            lua_pop(L, 1);
-        }
-        lua_pop(L, 2);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -4);
+        lua_rawgeti(L, -1, DISPLAY_LEVEL);
+        lua_rawgeti(L, -2, DISPLAY_EXPR);
+        if (lua_tointeger(L, -2))
+            SB_Print(sb, "%d\n%d\n%s\n", lua_tointeger(L, -4), lua_tointeger(L, -2),
+                lua_tostring(L, -1));
+        else
+            SB_Print(sb, "%d\nw\n%s\n", lua_tointeger(L, -4), lua_tostring(L, -1));
+        lua_pop(L, 4);
     }
     lua_pop(L, 2);
     assert(top == lua_gettop(L));
@@ -1206,63 +4973,79 @@ int lb(lua_State * L, SocketBuf * sb)
 }
 
 /*
-** Given a table on top of L, it sorts the keys of that table and stores
-** the sorted keys in a new table returned on top of L. Thus L increases by 1.
-** Return the length of the new table.
+** Output format, following the line number in the BR message:
+** Frame Count
+** File
+** Line Number
+** Function Name
+** Name What
+** ...
+** Id
+** Expression
+** Value
+** ...
+**
+** Frames are as the ones of ps, up to info->stackDepth. Then each display is
+** evaluated, or its watch path looked up, and sent with its first result, or
+** "e" followed by the error message when it fails: hex encoded in a text flow,
+** or its raw bytes in a binary flow.
+** On top of L is the "debugger" table stored in LUA_REGISTRYINDEX. L stays
+** unchanged after call.
 */
-int sortKey(lua_State * L)
+int br(Args_br * args, SocketBuf * sb)
 {
-    int i = 1;
-    lua_newtable(L);
-    lua_pushnil(L);
-    while (lua_next(L, -3)) {
-        lua_pushvalue(L, -2);
-        lua_rawseti(L, -4, i++);
-        lua_pop(L, 1);
-    }
+    lua_State * L = args->L;
+    lua_Debug ar;
+    int i, n;
+    int top = lua_gettop(L);
 
-    lua_getglobal(L, "table");
-    lua_getfield(L, -1, "sort");
-    lua_pushvalue(L, -3);
-    lua_call(L, 1, 0);
-    lua_pop(L, 1);
-    return i - 1;
-}
+    for (n = 0; n < args->info->stackDepth && lua_getstack(L, n, &ar); n++);
+    SB_Print(sb, "%d\n", n);
+    for (i = 0; i < n; i++) {
+        lua_getstack(L, i, &ar);
+        lua_getinfo(L, "nSl", &ar);
+        printFrame(sb, &ar);
+    }
 
-/*
-** L stays unchanged.
-*/
-int exec(lua_State * L, lua_Debug * ar, char * argv[], int argc, SOCKET s)
-{
-    return -2;
-}
+    lua_pushliteral(L, "displays");
+    lua_rawget(L, top);
+    n = sortKey(L);
+    for (i = 1; i <= n; i++) {
+        int id, level;
+        const char * text;
 
-/*
-** Input format:
-** m <addr> <len>
-**
-** Output format:
-** OK
-** content
-**
-** Warning:
-** This function may read an unreadable address and cause a hard/OS exception!
-*/
-int watchMemory(char * argv[], int argc, SOCKET s)
-{
-    void * addr;
-    unsigned int len;
-    SocketBuf sb;
+        lua_rawgeti(L, -1, i);
+        id = lua_tointeger(L, -1);
+        lua_rawget(L, -3);
+        lua_rawgeti(L, -1, DISPLAY_LEVEL);
+        level = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        lua_rawgeti(L, -1, DISPLAY_EXPR);
+        text = lua_tostring(L, -1);
+        SB_Print(sb, "%d\n%s\n", id, text);
 
-    if (argc < 2 || (addr = (void *)strtoul(argv[0], NULL, 0)) == 0
-        || (len = strtoul(argv[1], NULL, 0)) <= 0
-        || (unsigned int)((unsigned int)addr + len) < (unsigned int)addr) //overflow!
-    {
-        return SendErr(s, "Invalid argument!");
+        lua_pushvalue(L, top);
+        if (level == 0) {
+            if (pushDisplayPath(L, args->ar, text)) {
+                printVar(sb, NULL, L);
+                lua_pop(L, 4);
+                continue;
+            }
+        }
+        else if (level != 1 && !lua_getstack(L, level - 1, &ar)) {
+            lua_pushfstring(L, "No function at stack level %d.", level);
+        }
+        else if (evaluate(L, level == 1 ? args->ar : &ar, level, text, args->info)) {
+            lua_State * co = lua_tothread(L, -1);
+            lua_settop(co, 1);  //the first result, or nil
+            printVar(sb, NULL, co);
+            lua_pop(L, 4);
+            continue;
+        }
+        SB_Print(sb, "e%Q\n", lua_tostring(L, -1), (int)lua_objlen(L, -1));
+        lua_pop(L, 4);
     }
-
-    SB_Init(&sb, s);
-    SB_Print(&sb, "OK\n%08x\n", len);
-    SB_Add(&sb, addr, len);
-    return SB_Send(&sb);
+    lua_pop(L, 2);
+    assert(top == lua_gettop(L));
+    return 0;
 }
@@ -0,0 +1,270 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include "Hex.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HEX_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#define HEX_WRITE_BUF 1024
+
+typedef void (* Kernel)(char * dst, const char * src, int len);
+
+static const char g_digits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+static void EncodeScalar(char * dst, const char * src, int len)
+{
+    const unsigned char * s = (const unsigned char *)src;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        dst[i * 2] = g_digits[s[i] >> 4];
+        dst[i * 2 + 1] = g_digits[s[i] & 0x0F];
+    }
+}
+
+/*
+** A digit is taken by its low 4 bits, plus 9 for a letter, whose bit 0x40 is
+** set.
+*/
+#define DIGIT(ch) (((ch) & 0x0F) + ((ch) & 0x40 ? 9 : 0))
+
+static void DecodeScalar(char * dst, const char * src, int len)
+{
+    int i;
+
+    for (i = 0; i + 1 < len; i += 2)
+        dst[i / 2] = (char)((DIGIT(src[i]) << 4) | DIGIT(src[i + 1]));
+}
+
+#if defined(HEX_X86)
+
+/*
+** Turn the values 0 to 15 in the bytes of n into their digits: '0' plus the
+** value, plus 39 more for 10 and above, 'a' being '0' + 49.
+*/
+TARGET_SSE2 static __m128i Digits128(__m128i n)
+{
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8(39));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+}
+
+TARGET_SSE2 static void EncodeSse2(char * dst, const char * src, int len)
+{
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i hi = Digits128(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = Digits128(_mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    EncodeScalar(dst + i * 2, src + i, len - i);
+}
+
+/*
+** Decode 16 characters into 8 bytes, each in the low byte of a 16 bits lane.
+*/
+TARGET_SSE2 static __m128i Pairs128(__m128i v)
+{
+    __m128i n = _mm_add_epi8(_mm_and_si128(v, _mm_set1_epi8(0x0F)),
+        _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(0x40)),
+        _mm_set1_epi8(0x40)), _mm_set1_epi8(9)));
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x00FF)), 4),
+        _mm_srli_epi16(n, 8));
+}
+
+TARGET_SSE2 static void DecodeSse2(char * dst, const char * src, int len)
+{
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m128i a = Pairs128(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m128i b = Pairs128(_mm_loadu_si128((const __m128i *)(src + i + 16)));
+        _mm_storeu_si128((__m128i *)(dst + i / 2), _mm_packus_epi16(a, b));
+    }
+    DecodeScalar(dst + i / 2, src + i, len - i);
+}
+
+TARGET_AVX2 static __m256i Digits256(__m256i n)
+{
+    const __m256i table = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f', '0', '1', '2', '3', '4', '5', '6', '7',
+        '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    return _mm256_shuffle_epi8(table, n);
+}
+
+TARGET_AVX2 static void EncodeAvx2(char * dst, const char * src, int len)
+{
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    int i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i hi = Digits256(_mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i lo = Digits256(_mm256_and_si256(v, mask));
+        //Unpacking works within 128 bits lanes: a holds bytes 0-7 and 16-23
+        //encoded, b bytes 8-15 and 24-31.
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    EncodeSse2(dst + i * 2, src + i, len - i);
+}
+
+TARGET_AVX2 static __m256i Pairs256(__m256i v)
+{
+    __m256i n = _mm256_add_epi8(_mm256_and_si256(v, _mm256_set1_epi8(0x0F)),
+        _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(0x40)),
+        _mm256_set1_epi8(0x40)), _mm256_set1_epi8(9)));
+    return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0x00FF)), 4),
+        _mm256_srli_epi16(n, 8));
+}
+
+TARGET_AVX2 static void DecodeAvx2(char * dst, const char * src, int len)
+{
+    int i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i a = Pairs256(_mm256_loadu_si256((const __m256i *)(src + i)));
+        __m256i b = Pairs256(_mm256_loadu_si256((const __m256i *)(src + i + 32)));
+        //Packing works within 128 bits lanes too, giving the quarters of the
+        //result in the order 0, 2, 1, 3.
+        _mm256_storeu_si256((__m256i *)(dst + i / 2),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    DecodeSse2(dst + i / 2, src + i, len - i);
+}
+
+/*
+** Does the CPU, and the OS by saving the registers, support AVX2? And SSE2,
+** which every x86-64 CPU does?
+*/
+static int HasAvx2(void)
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return 0;
+    __cpuid(r, 1);
+    if (!(r[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)  //OSXSAVE, XMM and YMM
+        return 0;
+    __cpuidex(r, 7, 0);
+    return (r[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static int HasSse2(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return 1;
+#elif defined(_MSC_VER)
+    int r[4];
+    __cpuid(r, 1);
+    return (r[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+static Kernel g_encode = NULL;
+static Kernel g_decode = NULL;
+static const char * g_kernel = "scalar";
+
+/*
+** Choose the kernels. Threads choosing at once choose the same.
+*/
+static void Choose(void)
+{
+    Kernel encode = EncodeScalar;
+    Kernel decode = DecodeScalar;
+
+#if defined(HEX_X86)
+    if (HasAvx2()) {
+        encode = EncodeAvx2;
+        decode = DecodeAvx2;
+        g_kernel = "avx2";
+    }
+    else if (HasSse2()) {
+        encode = EncodeSse2;
+        decode = DecodeSse2;
+        g_kernel = "sse2";
+    }
+#endif
+    g_decode = decode;
+    g_encode = encode;
+}
+
+void HEX_Encode(char * dst, const char * src, int len)
+{
+    if (!g_encode)
+        Choose();
+    g_encode(dst, src, len);
+}
+
+void HEX_Decode(char * dst, const char * src, int len)
+{
+    if (!g_decode)
+        Choose();
+    g_decode(dst, src, len);
+}
+
+void HEX_Write(FILE * out, const char * src, int len)
+{
+    char buf[HEX_WRITE_BUF];
+    int n;
+
+    for (len &= ~1; len > 0; src += n, len -= n) {
+        n = len < (int)sizeof(buf) * 2 ? len : (int)sizeof(buf) * 2;
+        HEX_Decode(buf, src, n);
+        fwrite(buf, 1, n / 2, out);
+    }
+}
+
+const char * HEX_Kernel(void)
+{
+    if (!g_encode)
+        Choose();
+    return g_kernel;
+}
@@ -0,0 +1,59 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+
+#ifndef __LZ_H__
+#define __LZ_H__
+
+/*
+** A small LZ77 codec writing the block format of LZ4: a block is a series of
+** sequences, each a token whose high 4 bits are the number of literals and low
+** 4 bits the length of the match less 4 (15 meaning that bytes of 255 and a
+** last one less than 255 add to it), the literals, and the offset of the match
+** back in the output as 2 bytes little endian. The last sequence has literals
+** only, and, as in LZ4, ends with at least the last 5 bytes of the input as
+** literals.
+** Blocks are compressed on their own, with no dictionary, so each can be
+** decompressed as soon as it's received.
+*/
+
+/*
+** Max length of a block, which is the size of the buffer of a Socket Buffer of
+** the debuggee.
+*/
+#define LZ_BLOCK_MAX 4096
+
+/*
+** Compress len bytes of src into dst, which holds cap bytes.
+** Return the length compressed, or 0 when it doesn't fit in cap.
+*/
+int LZ_Compress(const char * src, int len, char * dst, int cap);
+
+/*
+** Decompress a block of len bytes from src into dst, which holds cap bytes.
+** Return the length decompressed, or -1 when the block is invalid or doesn't
+** fit in cap.
+*/
+int LZ_Decompress(const char * src, int len, char * dst, int cap);
+
+#endif
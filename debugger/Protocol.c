@@ -22,7 +22,16 @@
 ******************************************************************************/
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "Protocol.h"
+#include "SendQueue.h"
+
+/*
+** Id of the request being answered, or -1 when it came without one.
+*/
+static int g_requestId = -1;
 
 SOCKET Connect(const char * addrStr, unsigned short port)
 {
@@ -45,19 +54,122 @@ SOCKET Connect(const char * addrStr, unsigned short port)
     return s;
 }
 
-int SendBreak(SOCKET s, const char * file, int line)
+SOCKET ConnectLocal(const char * path)
+{
+#if defined(OS_LINUX)
+    SOCKET s;
+    struct sockaddr_un addr;
+    assert(path);
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return INVALID_SOCKET;
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+#else
+    return INVALID_SOCKET;
+#endif
+}
+
+int SendBreak(SOCKET s, const char * file, int line, Writer writer, void * writerData)
 {
     SocketBuf sb;
+    int rc = 0;
 
     SB_Init(&sb, s);
-    SB_Print(&sb, "BR\n%s\n%d\n\n", file, line);
-    SB_Add(&sb, "", 1); //Add the End-of-flow(EOF)
-    return SB_Send(&sb);
+    SB_Print(&sb, "BR\n");
+    SB_Intern(&sb, 1);
+    SB_Print(&sb, "%s\n", file);
+    SB_Intern(&sb, 0);
+    SB_Print(&sb, "%d\n", line);
+    if (writer)
+        while ((rc = writer(writerData, &sb)) == 1);
+    SB_Add(&sb, "\n", sizeof("\n")); //Include the End-of-flow(EOF)
+    SB_Send(&sb);
+    return (rc == 0 && !sb.ioerr) ? 0 : (rc < 0 ? rc : -1);
 }
 
 int SendQuit(SOCKET s)
 {
-    return SendData(s, "QT\n\n", sizeof("QT\n\n")); //Including the EOF
+    SocketBuf sb;
+
+    SB_Init(&sb, s);
+    SB_Add(&sb, "QT\n\n", sizeof("QT\n\n")); //Including the EOF
+    return SB_Send(&sb);
+}
+
+int Handshake(FlowReader * reader, int resumed, Agreement * agreed)
+{
+    char hi[64];
+    char * buf;
+    char * p;
+    unsigned short one = 1;
+    int version;
+    int len;
+    int rc;
+
+    agreed->version = 1;
+    agreed->compress = 0;
+    agreed->ring[0] = 0;
+    //Include the End-of-flow(EOF)
+    len = sprintf(hi, "HI\n%d\n%d\n%d\n%d\n\n", PROT_VERSION, (int)sizeof(void *),
+        (int)*(unsigned char *)&one, resumed) + 1;
+    if (SendData(reader->s, hi, len) < 0)
+        return -1;
+
+    rc = RecvFlow(reader, &buf);
+    if (rc < 0)
+        return rc;
+    if (strncmp(buf, "pv ", 3) || (version = strtol(buf + 3, &p, 10)) < 1
+        || version > PROT_VERSION)
+        return -2;
+    if ((agreed->compress = !strncmp(p, " z", 2) && (!p[2] || p[2] == ' ')))
+        p += 2;
+    if (!strncmp(p, " m/", 3)) {
+        if (strlen(p + 2) >= sizeof(agreed->ring))
+            return -2;
+        strcpy(agreed->ring, p + 2);
+        p += strlen(p);
+    }
+    if (*p)
+        return -2;
+    agreed->version = version;
+    return version;
+}
+
+void Agree(const Agreement * agreed)
+{
+    SB_SetBinary(agreed->version >= 2);
+    SB_SetStringTable(agreed->version >= 5);
+    SB_SetCompression(agreed->compress);
+    if (*agreed->ring)
+        SQ_MapRing(agreed->ring);
+}
+
+int SendSamples(SOCKET s, Writer writer, void * writerData)
+{
+    SocketBuf sb;
+    int rc = 0;
+
+    SB_InitFrame(&sb);
+    SB_Add(&sb, "SP\n", sizeof("SP\n") - 1);
+    while ((rc = writer(writerData, &sb)) == 1);
+    SB_Add(&sb, "\n", sizeof("\n")); //Include the End-of-flow(EOF)
+    SB_Send(&sb);
+    if (rc == 0 && !sb.ioerr)
+        return SQ_Push(s, SB_TakeFrame(&sb));
+    free(SB_TakeFrame(&sb));
+    return rc < 0 ? rc : -1;
 }
 
 int SendErr(SOCKET s, const char * fmt, ...)
@@ -66,7 +178,7 @@ int SendErr(SOCKET s, const char * fmt, ...)
     va_list ap;
 
     SB_Init(&sb, s);
-    SB_Add(&sb, "ER\n", sizeof("ER\n") - 1);
+    AddResponseTag(&sb, "ER");
     va_start(ap, fmt);
     SB_VPrint(&sb, fmt, ap);
     va_end(ap);
@@ -80,7 +192,7 @@ int SendOK(SOCKET s, Writer writer, void * writerData)
     int rc = 0;
 
     SB_Init(&sb, s);
-    SB_Add(&sb, "OK\n", sizeof("OK\n") - 1);
+    AddResponseTag(&sb, "OK");
     if (writer)
         while ((rc = writer(writerData, &sb)) == 1);
     SB_Add(&sb, "\n", sizeof("\n")); //Include the End-of-flow(EOF)
@@ -88,25 +200,76 @@ int SendOK(SOCKET s, Writer writer, void * writerData)
     return (rc == 0 && !sb.ioerr) ? 0 : (rc < 0 ? rc : -1);
 }
 
-int RecvCmd(SOCKET s, char * buf, int len)
+void AddResponseTag(SocketBuf * sb, const char * tag)
 {
-    char * p = buf;
-    int avail = len;
-    int received = 0;
+    SB_Print(sb, "%s\n", tag);
+    if (g_requestId >= 0)
+        SB_Print(sb, "@%08x\n", g_requestId);
+}
 
-    while (avail > 0) {
-        int l = recv(s, p, avail, 0);
-        if (l == SOCKET_ERROR)
-            return -1;
+void FR_Init(FlowReader * reader, SOCKET s)
+{
+    reader->s = s;
+    reader->buf = NULL;
+    reader->size = 0;
+    reader->len = 0;
+    reader->scanned = 0;
+    reader->used = 0;
+}
+
+void FR_Free(FlowReader * reader)
+{
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->size = 0;
+}
+
+int RecvFlow(FlowReader * reader, char ** flow)
+{
+    char * eof;
+    char * p;
+
+    //Drop the flow handed out last, keeping what follows it.
+    if (reader->used) {
+        reader->len -= reader->used;
+        memmove(reader->buf, reader->buf + reader->used, reader->len);
+        reader->used = 0;
+        reader->scanned = 0;
+    }
+
+    while (1) {
+        int l;
+        eof = reader->len > reader->scanned ? (char *)memchr(reader->buf + reader->scanned,
+            0, reader->len - reader->scanned) : NULL;
+        if (eof)
+            break;
 
-        received += l;
-        if (p[l - 1] == 0)
-            return received - 1; //Return payload length, excluding the EOF character.
+        reader->scanned = reader->len;
+        if (reader->len == reader->size) {
+            int newSize = reader->size ? reader->size * 2 : PROT_MAX_CMD_LEN;
+            if (newSize > PROT_MAX_FLOW_LEN)
+                return -2;  //Too long
+            p = (char *)realloc(reader->buf, newSize);
+            if (!p)
+                return -2;
+            reader->buf = p;
+            reader->size = newSize;
+        }
 
-        p += l;
-        avail -= l;
+        l = recv(reader->s, reader->buf + reader->len, reader->size - reader->len, 0);
+        if (l == SOCKET_ERROR || l == 0)
+            return -1;
+        reader->len += l;
     }
 
-    return -2;  //Too long
+    reader->used = eof - reader->buf + 1;
+    p = reader->buf;
+    g_requestId = -1;
+    if (*p == '@') {
+        g_requestId = (int)strtol(p + 1, &p, 16);
+        while (*p == ' ')
+            ++p;
+    }
+    *flow = p;
+    return eof - p; //Return payload length, excluding the EOF character.
 }
-
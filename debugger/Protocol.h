@@ -32,6 +32,12 @@
 */
 #define PROT_MAX_CMD_LEN 1024
 
+/*
+** Max length of a flow from the controller, i.e. a command with its body,
+** including the terminating zero.
+*/
+#define PROT_MAX_FLOW_LEN (1024 * 1024)
+
 /*
 ** Max number of arguments contained in one command. The command itself counts,
 ** i.g. command "ll 2" containing 2 arguments.
@@ -44,22 +50,129 @@
 */
 #define PROT_MAX_STR_LEN 256
 
+/*
+** Version of the protocol. In version 1, flows from the debuggee are text; in
+** version 2 they are binary (see SocketBuf.h). Flows from the controller are
+** text in both. A debuggee of version 2 also accepts request ids (see
+** RecvFlow), whatever flows are agreed on. One of version 3 also pages tables
+** for w, one of version 4 lists variables by changes for ll, lu and lg, one
+** of version 6 filters what ll, lu, lg and w list, one of version 8 diffs a
+** table against a snapshot of it for df, one of version 9 aggregates the
+** values of a table for q, one of version 10 compresses what it sends when
+** asked to in the handshake, one of version 11 sets up the queue of
+** samples for tq, one of version 12 puts SP messages into a ring in shared
+** memory when offered one in the handshake, and one of version 13 resumes its
+** session with another controller when the connection is lost (see
+** Reconnect.h).
+** Flows of versions 3 and 4 are the same as those of version 2, and those of
+** version 5 also intern paths, names and keys in a session string table (see
+** SocketBuf.h). Flows of version 6 are the same as those of version 5, and
+** those of version 7 also pack runs of numbers in tables paged for w into
+** blocks of raw numbers (see pageTable in Debugger.c). Flows of versions 8 to
+** 13 are the same as those of version 7.
+*/
+#define PROT_VERSION 13
+
+/*
+** A reader of flows from the remote controller. Flows may arrive back to back,
+** several in one segment or one across segments, so the bytes received beyond
+** the flow handed out are kept for the next read.
+*/
+typedef struct {
+    SOCKET s;
+    char * buf;     //grown by realloc as needed
+    int size;       //size of buf
+    int len;        //bytes held in buf
+    int scanned;    //bytes in buf known not to hold an EOF
+    int used;       //bytes of the flow handed out last, including its EOF
+} FlowReader;
+
 /*
 ** Connect to a remote controller.
 */
 SOCKET Connect(const char * addr, unsigned short port);
 
 /*
-** Send break message.
+** Connect to a controller on the same host by the Unix domain socket at path.
+** Not supported on Windows, where INVALID_SOCKET is always returned.
+*/
+SOCKET ConnectLocal(const char * path);
+
+/*
+** Longest name of a ring in shared memory the controller may offer.
+*/
+#define PROT_MAX_RING_NAME 64
+
+/*
+** What's agreed on with the remote controller in the handshake.
+*/
+typedef struct {
+    int version;        //of the protocol
+    int compress;       //compress what's sent, see SB_SetCompression
+    char ring[PROT_MAX_RING_NAME];  //name of the ring offered, or "" when none
+} Agreement;
+
+/*
+** Agree with the remote controller on the version of the protocol, right after
+** connecting. The debuggee tells the pointer size and byte order of the raw
+** values in binary flows, and the controller answers with the highest version
+** both sides support. The controller may also ask for compression by z,
+** whatever the version, and a controller on the same host may offer, by m, the
+** name of a ring in shared memory for SP messages (see SendQueue.h).
+** The debuggee also tells whether it resumes a session, keeping breakpoints
+** and the like from the connection lost, which an older controller ignores.
+** The answer is read by reader, which is kept for the commands to follow, and
+** stored in agreed. Nothing else is touched, so that the reconnecting thread
+** may handshake too (see Reconnect.h); what's agreed on takes effect only by
+** Agree.
+** The answer is waited for however long it takes, as a controller may ask its
+** user for breakpoints first; one older than the handshake doesn't answer it
+** but drops the connection, which fails the handshake.
+** Return the version, or -1 when socket error, or -2 when the answer is invalid.
+**
+** Message format:
+** HI
+** Version
+** Pointer Size
+** Little Endian(1 or 0)
+** Resumed(1 or 0)
+**
+** Answer format:
+** pv <version> [z] [m<name>]
+*/
+int Handshake(FlowReader * reader, int resumed, Agreement * agreed);
+
+/*
+** Put in effect what's agreed on in the handshake, for the whole process:
+** binary flows when the version is 2 or above, a new session string table when
+** it's 5 or above, compression when asked for, after which all that the debuggee
+** sends goes in blocks, and the ring offered, which is mapped if it can be, SP
+** messages going on the socket otherwise. Call it on the Lua thread only.
+*/
+void Agree(const Agreement * agreed);
+
+/*
+** User defined writer function. When called, should return 1 when there are
+** more data to write, and 0 when no more, and a negative when some error
+** happens. SendOK will return the code by writer. So a writer should not
+** return -1 in order to be distinguished from Socket IO Error(-1) returned by
+** SendOK.
+*/
+typedef int (* Writer)(void * writerData, SocketBuf * sb);
+
+/*
+** Send break message. What follows the line number, if any, is written by
+** writer, which may be NULL.
 ** Return 0 when success, or -1 when socket error.
 **
 ** Message format:
 ** BR
 ** File
 ** Line Number
+** ...
 **
 */
-int SendBreak(SOCKET s, const char * file, int line);
+int SendBreak(SOCKET s, const char * file, int line, Writer writer, void * writerData);
 
 /*
 ** Send quit message.
@@ -70,43 +183,73 @@ int SendBreak(SOCKET s, const char * file, int line);
 */
 int SendQuit(SOCKET s);
 
+/*
+** Send a batch of samples taken from registered watch expressions while the
+** script is running. The records are written by writer. The message is queued
+** for the sender thread rather than sent right away (see SendQueue.h).
+** Return 0 when success, or -1 when socket error.
+**
+** Message format:
+** SP
+** Id
+** Timestamp
+** Value
+** Id
+** Timestamp
+** Value
+** ...
+**
+*/
+int SendSamples(SOCKET s, Writer writer, void * writerData);
+
 /*
 ** Respond with error.
 ** Return 0 when success, or -1 when socket error.
 **
 ** Message format:
 ** ER
+** [@Request Id]
 ** msg-body
 **
 */
 int SendErr(SOCKET s, const char * fmt, ...);
 
-/*
-** User defined writer function. When called, should return 1 when there are
-** more data to write, and 0 when no more, and a negative when some error
-** happens. SendOK will return the code by writer. So a writer should not
-** return -1 in order to be distinguished from Socket IO Error(-1) returned by
-** SendOK.
-*/
-typedef int (* Writer)(void * writerData, SocketBuf * sb);
-
 /*
 ** Respond with OK.
 ** Return 0 when success, or -1 when socket error.
 **
 ** Message format:
 ** OK
+** [@Request Id]
 ** msg-body
 **
 */
 int SendOK(SOCKET s, Writer writer, void * writerData);
 
 /*
-** Wait for command from remote controller.
-** The comand must be a one-line text without a end-of-line character but a
-** terminating zero(EOF).
-** Return the payload length, excluding the end EOF character.
+** Start a response in sb with tag, "OK" or "ER", followed by the id of the
+** request being answered, if it came with one. For responses not made by
+** SendOK nor SendErr.
+*/
+void AddResponseTag(SocketBuf * sb, const char * tag);
+
+/*
+** Init a flow reader on socket s, and free what it holds.
+*/
+void FR_Init(FlowReader * reader, SOCKET s);
+void FR_Free(FlowReader * reader);
+
+/*
+** Wait for a flow from remote controller, i.e. a command optionally followed by
+** a body after the first end-of-line character, e.g. a batch of breakpoints.
+** The flow must end with a terminating zero(EOF). *flow is set to it, which
+** stays valid until the next call.
+** A command may be led by a request id in hex, like "@2a ll 1", so that a
+** controller sending commands back to back can match the responses: the id is
+** stripped off the flow and echoed in the responses until the next flow.
+** Return the payload length, excluding the end EOF character, or -1 when socket
+** error, or -2 when the flow is longer than PROT_MAX_FLOW_LEN or no memory.
 */
-int RecvCmd(SOCKET s, char * buf, int len);
+int RecvFlow(FlowReader * reader, char ** flow);
 
 #endif
@@ -0,0 +1,182 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include <string.h>
+#include "Reconnect.h"
+
+#if defined(OS_WIN)
+#include <process.h>
+
+#define BARRIER() MemoryBarrier()
+
+#else
+#include <pthread.h>
+#include <time.h>
+
+#define BARRIER() __sync_synchronize()
+
+#endif
+
+static char g_addr[128];
+static unsigned short g_port = 0;
+static int g_local = 0;
+
+static lua_State * g_L = NULL;
+static lua_Hook g_hook = NULL;
+static volatile int g_stop = 0;
+static volatile int g_ready = 0;        //set by the thread once connected
+static volatile SOCKET g_trying = INVALID_SOCKET;
+static SOCKET g_s = INVALID_SOCKET;
+static FlowReader g_reader;
+static Agreement g_agreed;
+static int g_started = 0;
+
+#if defined(OS_WIN)
+static HANDLE g_thread;
+#else
+static pthread_t g_thread;
+#endif
+
+void RC_SetPeer(const char * addr, unsigned short port, const char * path)
+{
+    g_local = path != NULL;
+    strncpy(g_addr, path ? path : addr, sizeof(g_addr) - 1);
+    g_addr[sizeof(g_addr) - 1] = 0;
+    g_port = port;
+}
+
+/*
+** Sleep for ms milliseconds, or less when told to stop.
+*/
+static void Pause(int ms)
+{
+    for (; ms > 0 && !g_stop; ms -= 100) {
+#if defined(OS_WIN)
+        Sleep(100);
+#else
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = 100000000;
+        nanosleep(&ts, NULL);
+#endif
+    }
+}
+
+/*
+** The thread: connect and handshake until it succeeds or is told to stop.
+*/
+#if defined(OS_WIN)
+static unsigned __stdcall Run(void * arg)
+#else
+static void * Run(void * arg)
+#endif
+{
+    while (!g_stop) {
+        FlowReader reader;
+        SOCKET s;
+        Agreement agreed;
+        int version;
+
+        Pause(RC_INTERVAL);
+        s = g_local ? ConnectLocal(g_addr) : Connect(g_addr, g_port);
+        if (s == INVALID_SOCKET)
+            continue;
+        g_trying = s;
+        FR_Init(&reader, s);
+        version = g_stop ? -1 : Handshake(&reader, 1, &agreed);
+        g_trying = INVALID_SOCKET;
+        if (version < 0) {
+            FR_Free(&reader);
+            closesocket(s);
+            continue;
+        }
+
+        g_s = s;
+        g_reader = reader;
+        g_agreed = agreed;
+        BARRIER();
+        g_ready = 1;
+        lua_sethook(g_L, g_hook, LUA_MASKCOUNT, 1);
+        break;
+    }
+    return 0;
+}
+
+int RC_Start(lua_State * L, lua_Hook hook)
+{
+    RC_Stop();
+    g_L = L;
+    g_hook = hook;
+    g_stop = 0;
+    g_ready = 0;
+#if defined(OS_WIN)
+    g_thread = (HANDLE)_beginthreadex(NULL, 0, Run, NULL, 0, NULL);
+    if (!g_thread)
+        return -1;
+#else
+    if (pthread_create(&g_thread, NULL, Run, NULL))
+        return -1;
+#endif
+    g_started = 1;
+    return 0;
+}
+
+SOCKET RC_Take(FlowReader * reader, Agreement * agreed)
+{
+    SOCKET s;
+
+    if (!g_ready)
+        return INVALID_SOCKET;
+    BARRIER();
+    s = g_s;
+    *reader = g_reader;
+    *agreed = g_agreed;
+    g_s = INVALID_SOCKET;
+    g_ready = 0;
+    return s;
+}
+
+void RC_Stop(void)
+{
+    SOCKET s;
+
+    if (!g_started)
+        return;
+    g_stop = 1;
+    s = g_trying;
+    if (s != INVALID_SOCKET)
+        shutdown(s, 2);     //Unblock a handshake waiting for the answer.
+#if defined(OS_WIN)
+    WaitForSingleObject(g_thread, INFINITE);
+    CloseHandle(g_thread);
+#else
+    pthread_join(g_thread, NULL);
+#endif
+    g_started = 0;
+    if (g_ready) {
+        FR_Free(&g_reader);
+        closesocket(g_s);
+        g_s = INVALID_SOCKET;
+        g_ready = 0;
+    }
+}
@@ -0,0 +1,77 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef __RECONNECT_H__
+#define __RECONNECT_H__
+
+#include <lua.h>
+#include "Protocol.h"
+
+/*
+** NOTE:
+** When the connection to the remote controller is lost, the debuggee doesn't
+** stop debugging for good but goes detached: the hook is removed from the Lua
+** state the library was loaded in and from the one running then, while
+** breakpoints, samples, displays and the like are kept. Other coroutines drop
+** the hook at their next event, so the script soon runs as if no debugger were
+** loaded. A thread of its own then connects to the controller again every
+** RC_INTERVAL milliseconds and handshakes, telling the controller that the
+** session is resumed; it only connects and exchanges the handshake, touching
+** none of the state the Lua thread uses. Once it succeeds, it installs a count
+** hook on the state the library was loaded in, lua_sethook being safe to call
+** from another thread (lua.c calls it from a signal handler), and the hook
+** takes the connection by RC_Take and attaches to it on the Lua thread, where
+** what's agreed on in the handshake is put in effect. Coroutines having dropped
+** the hook get it again only when created after that.
+*/
+
+#define RC_INTERVAL 1000
+
+/*
+** Set where to connect again: the Unix domain socket at path when path isn't
+** NULL, or addr:port otherwise.
+*/
+void RC_SetPeer(const char * addr, unsigned short port, const char * path);
+
+/*
+** Start connecting to the controller in the background. Once connected, hook
+** is installed on L as a count hook firing on the next instruction, so L must
+** be the state the library was loaded in, which lives as long as the library.
+** Return -1 when the thread can't be started, or 0 when succeed.
+*/
+int RC_Start(lua_State * L, lua_Hook hook);
+
+/*
+** Take the connection made, along with the reader which holds what follows the
+** handshake and what's agreed on in it, which is yet to be put in effect by
+** Agree.
+** Return the socket, or INVALID_SOCKET when no connection is made yet.
+*/
+SOCKET RC_Take(FlowReader * reader, Agreement * agreed);
+
+/*
+** Stop connecting, and close the connection made but not taken, if any.
+*/
+void RC_Stop(void);
+
+#endif
@@ -0,0 +1,311 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include <assert.h>
+#include <stdlib.h>
+#include "SendQueue.h"
+#include "ShmRing.h"
+
+#if defined(OS_WIN)
+#include <process.h>
+
+#define CAS(p, o, n) (InterlockedCompareExchange((LONG volatile *)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define BARRIER() MemoryBarrier()
+
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+
+#define CAS(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define BARRIER() __sync_synchronize()
+
+#endif
+
+/*
+** The ring: slots hold pointers to frames, so that the frame taken by the
+** sender thread is its own while the slot is filled again. head and tail only
+** grow, masked by the capacity, a power of 2, so that slots follow each other
+** across the wrap of the counters. The Lua thread puts a frame at head and
+** moves head; whoever takes the frame at tail moves tail by a compare-and-swap,
+** i.e. the sender thread to send it, or the Lua thread to drop it, and the one
+** which moves tail owns the frame.
+*/
+static Frame * volatile * g_slots = NULL;
+static unsigned int g_capacity = SQ_CAPACITY;
+static DropPolicy g_policy = SQ_DROP_OLDEST;
+static volatile unsigned int g_head = 0;
+static volatile unsigned int g_tail = 0;
+
+static unsigned long g_queued = 0;      //by the Lua thread
+static unsigned long g_dropped = 0;     //by the Lua thread
+static volatile unsigned long g_sent = 0;  //by the sender thread
+static unsigned int g_evicted = 0;      //frames dropped out of the ring by the Lua thread
+static volatile unsigned int g_done = 0;    //frames taken and done with by the sender thread
+static volatile int g_failed = 0;
+static volatile int g_stop = 0;
+static int g_started = 0;
+static SOCKET g_s = INVALID_SOCKET;
+static ShmRing g_ring = {NULL, NULL, 0, 0};
+
+#if defined(OS_WIN)
+static HANDLE g_thread;
+static HANDLE g_ready;
+#else
+static pthread_t g_thread;
+static sem_t g_ready;
+#endif
+
+/*
+** Take the frame at tail, or return NULL when the ring is empty.
+*/
+static Frame * Take(void)
+{
+    while (1) {
+        unsigned int t = g_tail;
+        Frame * frame;
+
+        if (t == g_head)
+            return NULL;
+        BARRIER();
+        frame = g_slots[t & (g_capacity - 1)];
+        if (CAS(&g_tail, t, t + 1))
+            return frame;
+    }
+}
+
+static void Wait(void)
+{
+#if defined(OS_WIN)
+    WaitForSingleObject(g_ready, INFINITE);
+#else
+    while (sem_wait(&g_ready) < 0 && errno == EINTR);
+#endif
+}
+
+static void Post(void)
+{
+#if defined(OS_WIN)
+    ReleaseSemaphore(g_ready, 1, NULL);
+#else
+    sem_post(&g_ready);
+#endif
+}
+
+/*
+** The sender thread: send the frames as they're queued, until told to stop.
+** Once sending fails, frames are dropped uncounted, and SQ_Push and SQ_Drain
+** fail.
+*/
+#if defined(OS_WIN)
+static unsigned __stdcall Run(void * arg)
+#else
+static void * Run(void * arg)
+#endif
+{
+    Frame * frame;
+
+    while (!g_stop) {
+        Wait();
+        while (!g_stop && (frame = Take())) {
+            if (!g_failed && SendData(g_s, frame->data, (int)frame->len) < 0)
+                g_failed = 1;
+            else if (!g_failed)
+                g_sent++;
+            free(frame);
+            BARRIER();
+            g_done++;
+        }
+    }
+    return 0;
+}
+
+static int Start(SOCKET s)
+{
+    if (!g_slots && !(g_slots = (Frame **)calloc(g_capacity, sizeof(Frame *))))
+        return -1;
+    g_s = s;
+    g_stop = 0;
+    g_failed = 0;
+#if defined(OS_WIN)
+    if (!(g_ready = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL)))
+        return -1;
+    g_thread = (HANDLE)_beginthreadex(NULL, 0, Run, NULL, 0, NULL);
+    if (!g_thread) {
+        CloseHandle(g_ready);
+        return -1;
+    }
+#else
+    if (sem_init(&g_ready, 0, 0) < 0)
+        return -1;
+    if (pthread_create(&g_thread, NULL, Run, NULL)) {
+        sem_destroy(&g_ready);
+        return -1;
+    }
+#endif
+    g_started = 1;
+    return 0;
+}
+
+/*
+** Put a frame into the shared ring. The messages dropped out of it to make room
+** were counted as sent when they were put.
+*/
+static int PutShared(Frame * frame)
+{
+    int rc = SR_Put(&g_ring, frame->data, (unsigned int)frame->len,
+        g_policy == SQ_DROP_OLDEST);
+
+    g_queued++;
+    if (rc < 0) {
+        g_dropped++;
+    }
+    else {
+        g_sent += 1 - rc;
+        g_dropped += rc;
+    }
+    free(frame);
+    return 0;
+}
+
+int SQ_MapRing(const char * name)
+{
+    SR_Close(&g_ring);
+    return SR_Open(&g_ring, name);
+}
+
+int SQ_Push(SOCKET s, Frame * frame)
+{
+    unsigned int h = g_head;
+
+    if (g_ring.header)
+        return PutShared(frame);
+
+    if ((!g_started && Start(s) < 0) || g_failed) {
+        free(frame);
+        return -1;
+    }
+
+    g_queued++;
+    while (h - g_tail >= g_capacity) {
+        unsigned int t = g_tail;
+        Frame * oldest;
+
+        if (g_policy == SQ_DROP_NEWEST) {
+            free(frame);
+            g_dropped++;
+            return 0;
+        }
+        //The sender thread may take the oldest frame first, making room.
+        oldest = g_slots[t & (g_capacity - 1)];
+        if (CAS(&g_tail, t, t + 1)) {
+            free(oldest);
+            g_dropped++;
+            g_evicted++;
+        }
+    }
+
+    g_slots[h & (g_capacity - 1)] = frame;
+    BARRIER();
+    g_head = h + 1;
+    Post();
+    return 0;
+}
+
+/*
+** Sleep for about a millisecond while waiting for the sender thread.
+*/
+static void Pause(void)
+{
+#if defined(OS_WIN)
+    Sleep(1);
+#else
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+int SQ_Drain(void)
+{
+    while (g_started && !g_failed && g_done + g_evicted != g_head)
+        Pause();
+    return g_failed ? -1 : 0;
+}
+
+void SQ_Stop(void)
+{
+    Frame * frame;
+
+    SR_Close(&g_ring);
+    if (!g_started)
+        return;
+    g_stop = 1;
+    Post();
+#if defined(OS_WIN)
+    WaitForSingleObject(g_thread, INFINITE);
+    CloseHandle(g_thread);
+    CloseHandle(g_ready);
+#else
+    pthread_join(g_thread, NULL);
+    sem_destroy(&g_ready);
+#endif
+    while ((frame = Take()))
+        free(frame);
+    g_head = g_tail = 0;
+    g_done = g_evicted = 0;
+    g_started = 0;
+}
+
+int SQ_Configure(int capacity, DropPolicy policy)
+{
+    Frame ** slots;
+    int size = 1;
+
+    if (capacity < 1 || capacity > SQ_MAX_CAPACITY)
+        return -1;
+    while (size < capacity)
+        size *= 2;
+    capacity = size;
+    assert(g_head == g_tail);
+    if ((unsigned int)capacity != g_capacity) {
+        if (!(slots = (Frame **)calloc(capacity, sizeof(Frame *))))
+            return -1;
+        free((void *)g_slots);
+        g_slots = slots;
+        g_capacity = capacity;
+    }
+    g_policy = policy;
+    return 0;
+}
+
+void SQ_GetStats(SendQueueStats * stats)
+{
+    stats->capacity = (int)g_capacity;
+    stats->policy = g_policy;
+    stats->queued = g_queued;
+    stats->sent = g_sent;
+    stats->dropped = g_dropped;
+}
@@ -0,0 +1,103 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#ifndef __SENDQUEUE_H__
+#define __SENDQUEUE_H__
+
+#include "Socket.h"
+#include "SocketBuf.h"
+
+/*
+** NOTE:
+** Messages streamed while the script runs, i.e. SP messages, aren't sent by
+** the Lua thread but queued as frames (see SB_InitFrame) for a sender thread,
+** so a slow controller or network never stalls the script. The queue is a ring
+** of SQ_CAPACITY frames unless told otherwise, with a single producer, the Lua
+** thread, and a single consumer, the sender thread, neither taking a lock. When
+** the ring is full, either the oldest frame in it or the new one is dropped,
+** and counted as such.
+** Everything else is still sent by the Lua thread, but only after SQ_Drain, so
+** that the messages reach the controller in order.
+** When the controller is on the same host and offers a ring in shared memory
+** (see ShmRing.h), SP messages are put into it by the Lua thread instead,
+** without a sender thread or a system call per message. The policy applies to
+** that ring too, whose size the controller decides. The controller takes what's
+** left in the ring before reading a break or a quit message, so the order holds.
+*/
+
+#define SQ_CAPACITY 64
+#define SQ_MAX_CAPACITY 65536
+
+typedef enum
+{
+    SQ_DROP_OLDEST = 0,
+    SQ_DROP_NEWEST
+} DropPolicy;
+
+typedef struct
+{
+    int capacity;
+    DropPolicy policy;
+    unsigned long queued;   //frames queued, dropped or not
+    unsigned long sent;     //frames sent, or put into the shared ring and not dropped
+    unsigned long dropped;  //frames dropped when the ring was full
+} SendQueueStats;
+
+/*
+** Queue a frame to be sent on s, starting the sender thread the first time.
+** The frame is freed once it's sent or dropped.
+** Return -1 when the sender thread can't be started or failed sending a frame,
+** or 0 when succeed.
+*/
+int SQ_Push(SOCKET s, Frame * frame);
+
+/*
+** Put frames into the shared ring created under name by the controller from
+** now on, rather than queuing them for the sender thread.
+** Return -1 when the ring can't be mapped, or 0 when succeed.
+*/
+int SQ_MapRing(const char * name);
+
+/*
+** Wait until every queued frame is sent.
+** Return -1 when the sender thread failed sending a frame, or 0 when succeed.
+*/
+int SQ_Drain(void);
+
+/*
+** Stop the sender thread, if it's started, and drop the frames still queued.
+** The shared ring, if mapped, is unmapped.
+*/
+void SQ_Stop(void);
+
+/*
+** Set the capacity of the ring and the policy applied when it's full. Only
+** when nothing is queued, i.e. after SQ_Drain. The capacity is rounded up to a
+** power of 2.
+** Return -1 when the capacity is out of 1 to SQ_MAX_CAPACITY, or 0 when succeed.
+*/
+int SQ_Configure(int capacity, DropPolicy policy);
+
+void SQ_GetStats(SendQueueStats * stats);
+
+#endif
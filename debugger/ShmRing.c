@@ -0,0 +1,246 @@
+/******************************************************************************
+* Copyright (C) 2011 Robert Ray<louirobert@gmail.com>.  All rights reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+* CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+* TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+* SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include "ShmRing.h"
+
+#if defined(OS_LINUX)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAS(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define BARRIER() __sync_synchronize()
+
+static int Map(ShmRing * ring, int fd, size_t len)
+{
+    void * p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+    ring->header = (RingHeader *)p;
+    ring->data = (char *)p + sizeof(RingHeader);
+    ring->mapped = len;
+    ring->size = (unsigned int)(len - sizeof(RingHeader));
+    return 0;
+}
+
+int SR_Create(ShmRing * ring, const char * name, unsigned int size)
+{
+    unsigned int n = SR_MIN_SIZE;
+    size_t len;
+    int fd;
+
+    while (n < size && n < SR_MAX_SIZE)
+        n <<= 1;
+    len = sizeof(RingHeader) + n;
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, len) < 0 || Map(ring, fd, len) < 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    ring->header->head = 0;
+    ring->header->tail = 0;
+    ring->header->waiting = 0;
+    ring->header->size = n;
+    return 0;
+}
+
+int SR_Open(ShmRing * ring, const char * name)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= sizeof(RingHeader)) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size > sizeof(RingHeader) + SR_MAX_SIZE
+        || Map(ring, fd, (size_t)st.st_size) < 0)
+        return -1;
+    if (ring->header->size != ring->size || (ring->size & (ring->size - 1))) {
+        SR_Close(ring);
+        return -1;
+    }
+    return 0;
+}
+
+void SR_Unlink(const char * name)
+{
+    shm_unlink(name);
+}
+
+void SR_Close(ShmRing * ring)
+{
+    if (ring->header) {
+        munmap(ring->header, ring->mapped);
+        ring->header = NULL;
+        ring->data = NULL;
+        ring->mapped = 0;
+        ring->size = 0;
+    }
+}
+
+/*
+** Copy len bytes at the position pos of the ring into buf, or the other way
+** round when in is nonzero, wrapping around at the end.
+*/
+static void Copy(ShmRing * ring, unsigned int pos, char * buf, unsigned int len, int in)
+{
+    unsigned int size = ring->size;
+    unsigned int at = pos & (size - 1);
+    unsigned int l = size - at < len ? size - at : len;
+
+    if (in) {
+        memcpy(ring->data + at, buf, l);
+        memcpy(ring->data, buf + l, len - l);
+    }
+    else {
+        memcpy(buf, ring->data + at, l);
+        memcpy(buf + l, ring->data, len - l);
+    }
+}
+
+int SR_Put(ShmRing * ring, const void * data, unsigned int len, int dropOldest)
+{
+    RingHeader * h = ring->header;
+    unsigned int head = h->head;
+    unsigned int need = len + 4;
+    int dropped = 0;
+
+    if (len > ring->size - 4)
+        return -1;
+    while (ring->size - (head - h->tail) < need) {
+        unsigned int t = h->tail;
+        unsigned int l;
+
+        if (!dropOldest)
+            return -1;
+        //The controller may take the oldest message first, making room.
+        Copy(ring, t, (char *)&l, 4, 0);
+        if (head - t > ring->size || l > ring->size - 4 || l + 4 > head - t) {
+            if (CAS(&h->tail, t, head))     //Not a message put: all is dropped.
+                dropped++;
+        }
+        else if (CAS(&h->tail, t, t + 4 + l))
+            dropped++;
+    }
+
+    Copy(ring, head, (char *)&len, 4, 1);
+    Copy(ring, head + 4, (char *)data, len, 1);
+    BARRIER();
+    h->head = head + need;
+    BARRIER();
+    if (h->waiting)
+        syscall(SYS_futex, &h->head, FUTEX_WAKE, 1, NULL, NULL, 0);
+    return dropped;
+}
+
+int SR_Get(ShmRing * ring, char * buf, unsigned int cap)
+{
+    RingHeader * h = ring->header;
+
+    while (1) {
+        unsigned int t = h->tail;
+        unsigned int l;
+
+        if (t == h->head)
+            return 0;
+        BARRIER();
+        Copy(ring, t, (char *)&l, 4, 0);
+        //A length overwritten after the message was dropped is thrown away
+        //with the copy, as tail has moved by then.
+        if (l <= ring->size - 4 && l <= cap) {
+            Copy(ring, t + 4, buf, l, 0);
+            BARRIER();
+            if (CAS(&h->tail, t, t + 4 + l))
+                return (int)l;
+        }
+        else if (CAS(&h->tail, t, h->head)) {
+            return -1;  //Not a length being overwritten, as tail stayed.
+        }
+    }
+}
+
+void SR_Wait(ShmRing * ring, int ms)
+{
+    RingHeader * h = ring->header;
+    unsigned int head = h->head;
+    struct timespec ts;
+
+    if (head != h->tail)
+        return;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    h->waiting = 1;
+    BARRIER();
+    if (h->head == head)
+        syscall(SYS_futex, &h->head, FUTEX_WAIT, head, &ts, NULL, 0);
+    h->waiting = 0;
+}
+
+#else
+
+int SR_Create(ShmRing * ring, const char * name, unsigned int size)
+{
+    return -1;
+}
+
+int SR_Open(ShmRing * ring, const char * name)
+{
+    return -1;
+}
+
+void SR_Unlink(const char * name)
+{
+}
+
+void SR_Close(ShmRing * ring)
+{
+}
+
+int SR_Put(ShmRing * ring, const void * data, unsigned int len, int dropOldest)
+{
+    return -1;
+}
+
+int SR_Get(ShmRing * ring, char * buf, unsigned int cap)
+{
+    return 0;
+}
+
+void SR_Wait(ShmRing * ring, int ms)
+{
+}
+
+#endif
@@ -30,7 +30,10 @@
 #elif defined(OS_LINUX)
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>    //iovec
+#include <sys/un.h>     //sockaddr_un
 #include <netinet/in.h> //sockaddr_in
+#include <netinet/tcp.h>    //TCP_CORK
 #include <arpa/inet.h>  //inet_addr
 #include <unistd.h>     //close
 
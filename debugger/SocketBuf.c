@@ -27,6 +27,12 @@
 #include <string.h>
 #include <ctype.h>
 #include "SocketBuf.h"
+#include "Lz.h"
+#include "Hex.h"
+
+#if SOCKET_BUF_CAP > LZ_BLOCK_MAX
+#error "A socket buf can not be greater than a compressed block."
+#endif
 
 #ifdef OS_LINUX
 #define _gcvt gcvt
@@ -51,6 +57,55 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 }
 #endif
 
+static int g_binary = 0;
+
+void SB_SetBinary(int on)
+{
+    g_binary = on ? 1 : 0;
+}
+
+/*
+** The session string table: an open addressing hash table of the words
+** interned, each with its id, which is the order it was added in. It has twice
+** as many slots as words, so there's always an empty one to end a probe.
+*/
+typedef struct {
+    char * str;     //NULL for an empty slot
+    int len;
+    int id;
+} Interned;
+
+#define INTERN_SLOTS (INTERN_MAX * 2)
+
+static int g_stringTable = 0;
+static Interned * g_interned = NULL;
+static int g_internedCount = 0;
+
+void SB_SetStringTable(int on)
+{
+    int i;
+
+    if (g_interned) {
+        for (i = 0; i < INTERN_SLOTS; i++)
+            free(g_interned[i].str);
+        free(g_interned);
+        g_interned = NULL;
+    }
+    g_internedCount = 0;
+    g_stringTable = on ? 1 : 0;
+}
+
+static int g_compress = 0;
+
+void SB_SetCompression(int on)
+{
+    g_compress = on ? 1 : 0;
+}
+
+void SB_Intern(SocketBuf * sb, int on)
+{
+    sb->intern = on && sb->strings && !sb->frame;
+}
 
 void SB_Init(SocketBuf * sb, SOCKET s)
 {
@@ -58,6 +113,35 @@ void SB_Init(SocketBuf * sb, SOCKET s)
     sb->avail = SOCKET_BUF_CAP;
     sb->p = sb->buf;
     sb->ioerr = 0;
+    sb->binary = g_binary;
+    sb->more = 0;
+    sb->wlen = 0;
+    sb->sent = 0;
+    sb->strings = g_binary && g_stringTable;
+    sb->intern = 0;
+    sb->compress = g_compress;
+    sb->corked = 0;
+    sb->frame = NULL;
+}
+
+void SB_InitFrame(SocketBuf * sb)
+{
+    SB_Init(sb, INVALID_SOCKET);
+    sb->frame = (Frame *)malloc(sizeof(Frame) + SOCKET_BUF_CAP);
+    if (sb->frame) {
+        sb->frame->len = 0;
+        sb->frame->cap = SOCKET_BUF_CAP;
+    }
+    else {
+        sb->ioerr = 1;
+    }
+}
+
+Frame * SB_TakeFrame(SocketBuf * sb)
+{
+    Frame * frame = sb->frame;
+    sb->frame = NULL;
+    return frame;
 }
 
 void SB_Reset(SocketBuf * sb)
@@ -65,9 +149,96 @@ void SB_Reset(SocketBuf * sb)
     sb->avail = SOCKET_BUF_CAP;
     sb->p = sb->buf;
     sb->ioerr = 0;
+    sb->more = 0;
+    sb->wlen = 0;
+    sb->sent = 0;
+    sb->intern = 0;
 }
 
-int SB_Add(SocketBuf * sb, const void * data, int len)
+/*
+** Cork the socket while a flow spans several sends, so that the kernel sends
+** full segments rather than one for each, and uncork it once the flow is sent.
+** Only where there's TCP_CORK, and not on sockets refusing it, i.e. Unix domain
+** sockets, which are never tried again.
+*/
+#ifdef TCP_CORK
+static int g_corkable = 1;
+#endif
+
+static void Cork(SocketBuf * sb, int on)
+{
+#ifdef TCP_CORK
+    if (sb->corked != on && !sb->frame && g_corkable) {
+        if (setsockopt(sb->s, IPPROTO_TCP, TCP_CORK, (const char *)&on, sizeof(on)) < 0)
+            g_corkable = 0;
+        else
+            sb->corked = on;
+    }
+#endif
+}
+
+/*
+** Send len bytes of data, or add them to the frame when there is one.
+*/
+static int Output(SocketBuf * sb, const char * data, int len)
+{
+    Frame * frame = sb->frame;
+
+    if (!frame)
+        return SendData(sb->s, data, len);
+    if (frame->len + len > frame->cap) {
+        size_t cap = frame->cap * 2 >= frame->len + len ? frame->cap * 2 : frame->len + len;
+        if (!(frame = (Frame *)realloc(frame, sizeof(Frame) + cap)))
+            return -1;
+        frame->cap = cap;
+        sb->frame = frame;
+    }
+    memcpy(frame->data + frame->len, data, len);
+    frame->len += len;
+    return 0;
+}
+
+/*
+** Send the first n bytes of the buffer, as a block when the stream is
+** compressed (see SB_SetCompression). The socket is corked until the end of
+** the flow unless it's the last send of the flow.
+*/
+static int Flush(SocketBuf * sb, int n, int last)
+{
+    char block[8 + SOCKET_BUF_CAP];
+    unsigned int h;
+    int len = 0;
+    int hn = 0;
+
+    if (!last)
+        Cork(sb, 1);
+    if (!sb->compress)
+        return Output(sb, sb->buf, n);
+    if (n == 0)
+        return 0;
+
+    if (n >= LZ_MIN_BLOCK)
+        len = LZ_Compress(sb->buf, n, block + 8, n - 1);
+    if (!len) {
+        memcpy(block + 8, sb->buf, n);
+        len = n;
+    }
+    h = ((unsigned int)len << 1) | (len < n ? 1 : 0);
+    do {
+        block[hn] = (char)(h & 0x7F);
+        h >>= 7;
+        if (h)
+            block[hn] |= 0x80;
+        ++hn;
+    } while (h);
+    memmove(block + 8 - hn, block, hn);
+    return Output(sb, block + 8 - hn, hn + len);
+}
+
+/*
+** Put data into the buffer as it is, sending the buffer whenever it's full.
+*/
+static int Put(SocketBuf * sb, const void * data, int len)
 {
     const char * d = (const char *)data;
     while (len > 0) {
@@ -81,10 +252,11 @@ int SB_Add(SocketBuf * sb, const void * data, int len)
         if (!len)
             break;
 
-        if (SendData(sb->s, sb->buf, SOCKET_BUF_CAP) < 0) {
+        if (Flush(sb, SOCKET_BUF_CAP, 0) < 0) {
             sb->ioerr = 1;
             return -1;
         }
+        sb->sent += SOCKET_BUF_CAP;
 
         sb->avail = SOCKET_BUF_CAP;
         sb->p = sb->buf;
@@ -92,12 +264,219 @@ int SB_Add(SocketBuf * sb, const void * data, int len)
     return 0;
 }
 
+/*
+** Put the header of a frame, which is h + 1 as an unsigned LEB128 varint.
+*/
+static int PutHeader(SocketBuf * sb, unsigned int h)
+{
+    char header[8];
+    int n = 0;
+
+    ++h;
+    do {
+        header[n] = (char)(h & 0x7F);
+        h >>= 7;
+        if (h)
+            header[n] |= 0x80;
+        ++n;
+    } while (h);
+    return Put(sb, header, n);
+}
+
+/*
+** Send the current word of a binary flow in a frame of the kind, which is 1
+** when the word continues in the next frame, 0 when it doesn't, or 2 when it's
+** added to the string table.
+*/
+static int PutFrame(SocketBuf * sb, int kind)
+{
+    unsigned int len = (unsigned int)sb->wlen;
+
+    if (PutHeader(sb, sb->strings ? (len << 2) | kind : (len << 1) | kind) < 0
+        || Put(sb, sb->word, sb->wlen) < 0)
+        return -1;
+    sb->wlen = 0;
+    sb->more = kind == 1;
+    return 0;
+}
+
+static unsigned int Hash(const char * str, int len)
+{
+    unsigned int h = 2166136261u;   //FNV-1a
+
+    while (len-- > 0) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+** Look up the current word in the string table, adding it when it's not there
+** and the table has room.
+** Return its id with *added telling if it's just added, or -1 when it isn't in
+** the table.
+*/
+static int Lookup(SocketBuf * sb, int * added)
+{
+    unsigned int i;
+    Interned * e;
+
+    *added = 0;
+    if (!g_interned) {
+        g_interned = (Interned *)calloc(INTERN_SLOTS, sizeof(Interned));
+        if (!g_interned)
+            return -1;
+    }
+
+    i = Hash(sb->word, sb->wlen) & (INTERN_SLOTS - 1);
+    for (e = g_interned + i; e->str; e = g_interned + i) {
+        if (e->len == sb->wlen && !memcmp(e->str, sb->word, sb->wlen))
+            return e->id;
+        i = (i + 1) & (INTERN_SLOTS - 1);
+    }
+
+    if (g_internedCount == INTERN_MAX || !(e->str = (char *)malloc(sb->wlen)))
+        return -1;
+    memcpy(e->str, sb->word, sb->wlen);
+    e->len = sb->wlen;
+    e->id = g_internedCount++;
+    *added = 1;
+    return e->id;
+}
+
+/*
+** Add data to the current word of a binary flow, or to the buffer of a text
+** flow.
+*/
+static int Append(SocketBuf * sb, const void * data, int len)
+{
+    const char * d = (const char *)data;
+
+    if (!sb->binary)
+        return Put(sb, data, len);
+
+    while (len > 0) {
+        int l = SOCKET_BUF_CAP - sb->wlen;
+        if (l > len)
+            l = len;
+        memcpy(sb->word + sb->wlen, d, l);
+        sb->wlen += l;
+        len -= l;
+        d += l;
+
+        if (len > 0 && PutFrame(sb, 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+** End the current word of a binary flow, interning it when asked to. Empty
+** words are dropped, as they are in a text flow.
+*/
+static int EndWord(SocketBuf * sb)
+{
+    if (sb->intern && !sb->more && sb->wlen >= INTERN_MIN_LEN && sb->wlen <= INTERN_MAX_LEN) {
+        int added;
+        int id = Lookup(sb, &added);
+        if (added)
+            return PutFrame(sb, 2);
+        if (id >= 0) {
+            sb->wlen = 0;
+            return PutHeader(sb, ((unsigned int)id << 2) | 3);
+        }
+    }
+    if (sb->wlen > 0 || sb->more)
+        return PutFrame(sb, 0);
+    return 0;
+}
+
+int SB_Add(SocketBuf * sb, const void * data, int len)
+{
+    const char * d = (const char *)data;
+    const char * end = d + len;
+
+    if (!sb->binary)
+        return Put(sb, data, len);
+
+    while (d < end) {
+        const char * p = d;
+        while (p < end && *p != '\n' && *p)
+            ++p;
+        if (Append(sb, d, p - d) < 0)
+            return -1;
+        if (p < end) {
+            if (EndWord(sb) < 0)
+                return -1;
+            if (!*p && Put(sb, p, 1) < 0)   //the EOF
+                return -1;
+            ++p;
+        }
+        d = p;
+    }
+    return 0;
+}
+
+/*
+** Largest frame of a block sent in place, whose header must hold its length.
+*/
+#define IN_PLACE_FRAME (1 << 28)
+
+int SB_AddRaw(SocketBuf * sb, const void * data, int len)
+{
+    const char * d = (const char *)data;
+    int tail = 0;
+
+    if (len < SB_IN_PLACE_MIN || sb->compress || sb->frame)
+        return Append(sb, data, len);
+
+    //The part of the current word in sb goes first, in a frame of its own, and
+    //the last part of the block is left in the word, as controllers read what
+    //ends a word as they read the rest of it without looking for another frame.
+    if (sb->binary) {
+        if (sb->wlen > 0 && PutFrame(sb, 1) < 0)
+            return -1;
+        tail = 1 + (len - 1) % SOCKET_BUF_CAP;
+        len -= tail;
+    }
+    while (len > 0) {
+        int l = len < IN_PLACE_FRAME ? len : IN_PLACE_FRAME;
+        unsigned int h = (unsigned int)l;
+        if (sb->binary) {
+            if (PutHeader(sb, sb->strings ? (h << 2) | 1 : (h << 1) | 1) < 0)
+                return -1;
+            sb->more = 1;
+        }
+        Cork(sb, 1);
+        if (SendDataV(sb->s, sb->buf, SOCKET_BUF_CAP - sb->avail, d, l) < 0) {
+            sb->ioerr = 1;
+            return -1;
+        }
+        sb->sent += SOCKET_BUF_CAP - sb->avail + l;
+        sb->avail = SOCKET_BUF_CAP;
+        sb->p = sb->buf;
+        len -= l;
+        d += l;
+    }
+    return Append(sb, d, tail);
+}
+
 /*
 ** Functions like SB_Add except that SB_AddRepeat repeats adding character ch count count,
 ** rather than adds a block of memory.
 */
 static int SB_AddRepeat(SocketBuf * sb, char ch, int count)
 {
+    if (sb->binary) {
+        char pad[16];
+        memset(pad, ch, sizeof(pad));
+        for (; count > 0; count -= sizeof(pad))
+            if (Append(sb, pad, count < (int)sizeof(pad) ? count : (int)sizeof(pad)) < 0)
+                return -1;
+        return 0;
+    }
+
     while (count > 0) {
         int l = sb->avail >= count ? count : sb->avail;
         memset(sb->p, ch, l);
@@ -108,10 +487,11 @@ static int SB_AddRepeat(SocketBuf * sb, char ch, int count)
         if (!count)
             break;
 
-        if (SendData(sb->s, sb->buf, SOCKET_BUF_CAP) < 0) {
+        if (Flush(sb, SOCKET_BUF_CAP, 0) < 0) {
             sb->ioerr = 1;
             return -1;
         }
+        sb->sent += SOCKET_BUF_CAP;
 
         sb->avail = SOCKET_BUF_CAP;
         sb->p = sb->buf;
@@ -121,42 +501,42 @@ static int SB_AddRepeat(SocketBuf * sb, char ch, int count)
 
 static char g_map[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
-#define HB(ch) (((ch) >> 4) & 0x0F)
-#define LB(ch) ((ch) & 0x0F)
-
-#define ENCODE(buf, ch)\
-    do {\
-        (buf)[0] = g_map[HB(ch)]; \
-        (buf)[1] = g_map[LB(ch)]; \
-    } while (0);
-
 /*
 ** Functions like SB_Add, but SB_AddQuote first encodes the input str, then adds
 ** the encoded string to buffer. The encoding method is simple: represent the value
 ** of a char variable in two ANSI readable characters. For example, if there's
 ** char a = 0x80;
 ** then encode(a) == "80"
+** The string is encoded right into buf in sb, as much of it at a time as fits
+** (see Hex.h).
+** In a binary flow str is added as it is.
 */
 static int SB_AddQuote(SocketBuf * sb, const char * str, int len)
 {
     const char * end = str + len;
+
+    if (sb->binary)
+        return Append(sb, str, len);
+
     while (str < end) {
         //Fill buf in sb until the buf is full or end of str is reached.
-        while (sb->avail >= 2 && str < end) {
-            ENCODE(sb->p, *str);
-            sb->p += 2;
-            sb->avail -= 2;
-            ++str;
-        }
+        int n = sb->avail / 2;
+        if (n > end - str)
+            n = (int)(end - str);
+        HEX_Encode(sb->p, str, n);
+        sb->p += n * 2;
+        sb->avail -= n * 2;
+        str += n;
         //Return if str is totally put into buf.
         if (str == end)
             break;
 
         //Send current full buf in sb if there's more data in str.
-        if (SendData(sb->s, sb->buf, SOCKET_BUF_CAP - sb->avail) < 0) {
+        if (Flush(sb, SOCKET_BUF_CAP - sb->avail, 0) < 0) {
             sb->ioerr = 1;
             return -1;
         }
+        sb->sent += SOCKET_BUF_CAP - sb->avail;
         //Reset sb for the next filling.
         sb->avail = SOCKET_BUF_CAP;
         sb->p = sb->buf;
@@ -209,7 +589,7 @@ static const char * nextArg(const char * fmt, char * flag, int * width,
         assert(ch != '.' && "Precision is not supported yet!");
         assert(ch != 'h' && ch != 'l' && ch != 'I' && "Type prefix is not supported yet!");
 
-        if (ch == 's' || ch == 'x' || ch == 'd' || ch == 'N' || ch == 'Q') {
+        if (ch == 's' || ch == 'x' || ch == 'd' || ch == 'N' || ch == 'Q' || ch == 'p') {
             *type = ch;
             *endArg = ++p;
             break;
@@ -277,6 +657,12 @@ int SB_VPrint(SocketBuf * sb, const char * fmt, va_list ap)
 
             assert(!flag && width == -1);
             d = va_arg(ap, double);
+            if (sb->binary) {
+                rc = Append(sb, &d, sizeof(d));
+                if (rc < 0)
+                    break;
+                continue;
+            }
             _gcvt(d, 100, buf);
             len = strlen(buf);
             if (buf[len - 1] == '.')
@@ -292,6 +678,29 @@ int SB_VPrint(SocketBuf * sb, const char * fmt, va_list ap)
             len = va_arg(ap, int);
             rc = SB_AddQuote(sb, str, len);
         }
+        else if (type == 'p') {
+            const void * ptr;
+            size_t n;
+            char buf[2 + sizeof(size_t) * 2];
+            char * q = buf + sizeof(buf);
+            int i;
+
+            assert(!flag && width == -1);
+            ptr = va_arg(ap, const void *);
+            if (sb->binary) {
+                rc = Append(sb, &ptr, sizeof(ptr));
+            }
+            else {
+                n = (size_t)ptr;
+                for (i = 0; i < 8 || n; i++) {
+                    *--q = g_map[n & 0x0F];
+                    n >>= 4;
+                }
+                *--q = 'x';
+                *--q = '0';
+                rc = SB_Add(sb, q, buf + sizeof(buf) - q);
+            }
+        }
 
         if (rc < 0)
             break;
@@ -314,17 +723,74 @@ int SB_Print(SocketBuf * sb, const char * fmt, ...)
     return rc;
 }
 
+size_t SB_Size(SocketBuf * sb)
+{
+    return sb->sent + (SOCKET_BUF_CAP - sb->avail) + sb->wlen;
+}
+
 int SB_Send(SocketBuf * sb)
 {
     int rc;
     if (sb->ioerr)
         return -1;
 
-    rc = SendData(sb->s, sb->buf, SOCKET_BUF_CAP - sb->avail);
+    if (sb->binary && EndWord(sb) < 0)
+        return -1;
+
+    rc = Flush(sb, SOCKET_BUF_CAP - sb->avail, 1);
+    Cork(sb, 0);
     sb->ioerr = rc < 0 ? 1 : 0;
     return rc;
 }
 
+int SendDataV(SOCKET s, const void * head, int len, const void * data, size_t size)
+{
+#if defined(OS_WIN)
+    WSABUF bufs[2];
+    DWORD sent;
+
+    bufs[0].buf = (char *)head;
+    bufs[0].len = len;
+    bufs[1].buf = (char *)data;
+    bufs[1].len = (ULONG)size;
+    while (bufs[0].len + bufs[1].len > 0) {
+        int i = bufs[0].len ? 0 : 1;
+        if (WSASend(s, bufs + i, 2 - i, &sent, 0, NULL, NULL) == SOCKET_ERROR)
+            return -1;
+        for (; i < 2 && sent > 0; i++) {
+            DWORD l = sent < bufs[i].len ? sent : bufs[i].len;
+            bufs[i].buf += l;
+            bufs[i].len -= l;
+            sent -= l;
+        }
+    }
+#else
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t sent;
+
+    iov[0].iov_base = (void *)head;
+    iov[0].iov_len = len;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+        int i = iov[0].iov_len ? 0 : 1;
+        msg.msg_iov = iov + i;
+        msg.msg_iovlen = 2 - i;
+        if ((sent = sendmsg(s, &msg, 0)) == SOCKET_ERROR)
+            return -1;
+        for (; i < 2 && sent > 0; i++) {
+            size_t l = (size_t)sent < iov[i].iov_len ? (size_t)sent : iov[i].iov_len;
+            iov[i].iov_base = (char *)iov[i].iov_base + l;
+            iov[i].iov_len -= l;
+            sent -= l;
+        }
+    }
+#endif
+    return 0;
+}
+
 int SendData(SOCKET s, const void * buf, int len)
 {
     const char * b = (const char *)buf;
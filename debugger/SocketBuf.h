@@ -42,20 +42,112 @@
 ** All these functions, when encounter a socket failure, will set an error flag(ioerr),
 ** and the next call to these functions with ioerr set will fail. SB_Reset can
 ** clear the error flag.
+**
+** A Socket Buffer sends either text flows, where words are separated by
+** end-of-line characters and a flow ends with a terminating zero(EOF), or,
+** after SB_SetBinary(1), binary flows. In a binary flow every word goes out as
+** one or more frames, each led by a header which is an unsigned LEB128 varint
+** of ((length << 1) | more) + 1, where more tells that the word continues in
+** the next frame. A zero byte in place of a header is the EOF. What is written
+** is the same in both cases, i.e. "\n" still ends a word and "\0" ends a flow,
+** but %p, %N and %Q are written as raw bytes rather than as text.
+**
+** After SB_SetStringTable(1) binary flows may also intern words: the header is
+** then ((length << 2) | kind) + 1, where kind 0 is a frame ending its word, 1 a
+** frame with the word continued in the next, 2 a whole word which both sides
+** add to their session string table under the next id (from 0 on), and 3 a
+** whole word given only by its id in place of length, with no bytes following.
+** Only words ended between SB_Intern(sb, 1) and SB_Intern(sb, 0) are interned,
+** i.e. those which recur within the session, such as paths and names, and only
+** when they are of INTERN_MIN_LEN to INTERN_MAX_LEN bytes and the table has room.
+**
+** A Socket Buffer initialized by SB_InitFrame collects what it would send in a
+** frame in memory instead, to be sent later as it is (see SendQueue.h).
 */
+
+/*
+** Bytes collected by a Socket Buffer to be sent later.
+*/
+typedef struct {
+    size_t len;
+    size_t cap;
+    char data[1];
+} Frame;
+
 typedef struct {
     SOCKET s;
     char * p;
     int avail;
     int ioerr;
     char buf[SOCKET_BUF_CAP];
+    int binary;     //send binary flows?
+    int more;       //has part of the current word been sent in a frame?
+    int wlen;       //length of the current word in word
+    char word[SOCKET_BUF_CAP];
+    size_t sent;    //bytes sent before those in buf
+    int strings;    //may words go through the session string table?
+    int intern;     //intern the words ended from now on?
+    int compress;   //send the buffer in blocks, compressed when they're big?
+    int corked;     //is the socket corked while a flow spans several sends?
+    Frame * frame;  //where bytes are collected rather than sent, or NULL
 } SocketBuf;
 
+#define INTERN_MIN_LEN 4
+#define INTERN_MAX_LEN 255
+
+/*
+** Max number of words in the session string table. Once it's full, words are
+** sent in full again.
+*/
+#define INTERN_MAX 8192
+
+/*
+** Choose the flows sent by Socket Buffers initialized from now on: binary when
+** on is nonzero, or text otherwise.
+*/
+void SB_SetBinary(int on);
+
+/*
+** Choose whether the binary flows sent by Socket Buffers initialized from now
+** on may intern words, starting a new session with an empty string table.
+*/
+void SB_SetStringTable(int on);
+
+/*
+** Choose whether the bytes sent by Socket Buffers initialized from now on go
+** as a stream of blocks, one each time the buffer is sent. A block is led by
+** an unsigned LEB128 varint of (length << 1) | compressed, and a block of
+** LZ_MIN_BLOCK bytes or more is compressed by LZ (see Lz.h) when that makes
+** it smaller. Flows in the blocks are the same as they would be otherwise.
+*/
+void SB_SetCompression(int on);
+
+#define LZ_MIN_BLOCK 256
+
+/*
+** Intern the words ended in sb from now on when on is nonzero, or stop doing so
+** otherwise. Nothing changes unless the flow may intern words, and words put in
+** a frame are never interned, as the frame may be dropped rather than sent.
+*/
+void SB_Intern(SocketBuf * sb, int on);
+
 /*
 ** Init a Socket Buffer
 */
 void SB_Init(SocketBuf * sb, SOCKET s);
 
+/*
+** Init a Socket Buffer which collects the bytes in a frame rather than sending
+** them. Once SB_Send is called, take the frame by SB_TakeFrame.
+*/
+void SB_InitFrame(SocketBuf * sb);
+
+/*
+** Take the frame of a Socket Buffer initialized by SB_InitFrame, which is to be
+** freed by free.
+*/
+Frame * SB_TakeFrame(SocketBuf * sb);
+
 /*
 ** Reset a Socket Buffer, that is, clear error flag and reset buffer state to init state.
 */
@@ -66,7 +158,10 @@ void SB_Reset(SocketBuf * sb);
 ** send the its content and rest the buffer and continue filling the buffer with
 ** the rest of string.
 ** The fmt argument specifies a format like printf does, but with more restriction
-** and some extension.
+** and some extension:
+** %N prints a double, %Q a buffer and its length in hex (which are the raw
+** bytes in a binary flow), and %p a pointer in hex with at least 8 digits (its
+** raw sizeof(void *) bytes in a binary flow).
 */
 int SB_Print(SocketBuf * sb, const char * fmt, ...);
 
@@ -80,10 +175,34 @@ int SB_VPrint(SocketBuf * sb, const char * fmt, va_list ap);
 int SB_Add(SocketBuf * sb, const void * data, int len);
 
 /*
-** Send the content in buffer right now.
+** Functions like SB_Add, but data is a raw block of memory, which, in a binary
+** flow, is added to the current word as it is. A block of SB_IN_PLACE_MIN bytes
+** or more is sent right away from where it is, together with what's in the
+** buffer, in one gathered write, rather than copied through the buffer; unless
+** the bytes sent are compressed (see SB_SetCompression) or put in a frame.
+*/
+int SB_AddRaw(SocketBuf * sb, const void * data, int len);
+
+#define SB_IN_PLACE_MIN 8192
+
+/*
+** Get the number of bytes added to a Socket Buffer since it was reset, sent or
+** not.
+*/
+size_t SB_Size(SocketBuf * sb);
+
+/*
+** Send the content in buffer right now. In a binary flow the current word, if
+** any, is ended first.
 */
 int SB_Send(SocketBuf * sb);
 
 int SendData(SOCKET s, const void * buf, int len);
 
+/*
+** Send len bytes of head and then size bytes of data in one gathered write,
+** calling it again for what's left when only part is sent.
+*/
+int SendDataV(SOCKET s, const void * head, int len, const void * data, size_t size);
+
 #endif